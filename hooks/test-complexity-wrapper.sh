@@ -143,9 +143,11 @@ find_source_file_ceedling() {
     return 1
 }
 
-FAILED=0
-TOTAL_VIOLATIONS=0
-PASSED_COUNT=0
+# Collect every test/source pair into a manifest so the tool runs once, parsing each
+# source file a single time even when several test files cover it
+MANIFEST=$(mktemp)
+trap 'rm -f "$MANIFEST"' EXIT
+PAIR_COUNT=0
 
 for test_file in "${FILES[@]}"; do
     if [ ! -f "$test_file" ]; then
@@ -168,41 +170,35 @@ for test_file in "${FILES[@]}"; do
             ;;
     esac
 
-    # Build command
-    CMD="$TOOL_PATH \"$test_file\" \"$source_file\" --threshold=$THRESHOLD --boundary-threshold=$BOUNDARY_THRESHOLD --level=$LEVEL"
+    # Tab-separated, so paths with spaces survive
+    printf '%s\t%s\n' "$test_file" "$source_file" >> "$MANIFEST"
+    PAIR_COUNT=$((PAIR_COUNT + 1))
+done
 
-    if [ "$CHECK_BOUNDARIES" = false ]; then
-        CMD="$CMD --no-check-boundaries"
-    fi
+if [ $PAIR_COUNT -eq 0 ]; then
+    exit 0
+fi
 
-    if [ "$VERBOSE" = true ]; then
-        CMD="$CMD --verbose"
-    fi
+# Build command
+CMD=("$TOOL_PATH" --manifest "$MANIFEST" --threshold="$THRESHOLD" --boundary-threshold="$BOUNDARY_THRESHOLD" --level="$LEVEL")
 
-    # Run analysis
-    OUTPUT=$(eval $CMD 2>&1)
-    EXIT_CODE=$?
+if [ "$CHECK_BOUNDARIES" = false ]; then
+    CMD+=(--no-check-boundaries)
+fi
 
-    if [ $EXIT_CODE -ne 0 ]; then
-        echo -e "${RED}✗ $test_file${NC}"
-        echo "  Source: $source_file"
-        echo "$OUTPUT"
-        FAILED=1
-        TOTAL_VIOLATIONS=$((TOTAL_VIOLATIONS + 1))
-    else
-        PASSED_COUNT=$((PASSED_COUNT + 1))
-        if [ "$VERBOSE" = true ]; then
-            echo -e "${GREEN}✓ $test_file${NC}"
-            echo "  Source: $source_file"
-            echo "$OUTPUT"
-        fi
-    fi
-done
+if [ "$VERBOSE" = true ]; then
+    CMD+=(--verbose)
+fi
+
+# Run analysis
+OUTPUT=$("${CMD[@]}" 2>&1)
+EXIT_CODE=$?
 
 # Final summary
-if [ $FAILED -eq 1 ]; then
+if [ $EXIT_CODE -ne 0 ]; then
+    echo "$OUTPUT"
     echo ""
-    echo -e "${RED}Found $TOTAL_VIOLATIONS test quality violation(s)${NC}"
+    echo -e "${RED}Found test quality violation(s)${NC}"
     if [ "$LEVEL" = "error" ]; then
         echo "Pre-commit check failed - fix the issues or use --no-verify to bypass"
         exit 1
@@ -211,9 +207,10 @@ if [ $FAILED -eq 1 ]; then
         exit 0
     fi
 else
-    if [ "$VERBOSE" = true ] || [ $PASSED_COUNT -gt 0 ]; then
-        echo ""
-        echo -e "${GREEN}✓ All test quality checks passed ($PASSED_COUNT files)${NC}"
+    if [ "$VERBOSE" = true ]; then
+        echo "$OUTPUT"
     fi
+    echo ""
+    echo -e "${GREEN}✓ All test quality checks passed ($PAIR_COUNT files)${NC}"
     exit 0
 fi
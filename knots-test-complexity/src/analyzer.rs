@@ -1,7 +1,9 @@
-use anyhow::Result;
-use tree_sitter::{Node, Parser};
+use anyhow::{Context, Result};
+use std::sync::Arc;
+use tree_sitter::{Node, Tree, TreeCursor};
 use crate::boundary::{BoundaryAnalysis, BoundaryDetector};
-use knots::{calculate_mccabe_complexity, calculate_cognitive_complexity};
+use knots::calculate_all_metrics;
+use knots::syntax::walk_preorder;
 
 #[derive(Debug, Clone)]
 pub struct FunctionMetrics {
@@ -17,6 +19,8 @@ pub struct FileAnalysis {
     pub functions: Vec<FunctionMetrics>,
     pub total_cyclomatic_complexity: u32,
     pub total_cognitive_complexity: u32,
+    /// Boundaries (as a source file) and literal values (as a test file)
+    pub boundaries: BoundaryDetector,
 }
 
 impl FileAnalysis {
@@ -26,6 +30,7 @@ impl FileAnalysis {
             functions: Vec::new(),
             total_cyclomatic_complexity: 0,
             total_cognitive_complexity: 0,
+            boundaries: BoundaryDetector::new(),
         }
     }
 
@@ -36,9 +41,11 @@ impl FileAnalysis {
     }
 }
 
+/// Compares one test file against its source file. The file analyses are shared so a
+/// batch run can check several test files against one source parsed only once.
 pub struct TestQualityAnalyzer {
-    pub test_analysis: FileAnalysis,
-    pub source_analysis: FileAnalysis,
+    pub test_analysis: Arc<FileAnalysis>,
+    pub source_analysis: Arc<FileAnalysis>,
     pub threshold: f64,
     pub boundary_threshold: f64,
 }
@@ -71,12 +78,27 @@ impl TestQualityAnalyzer {
         let test_analysis = analyze_file(test_file)?;
         let source_analysis = analyze_file(source_file)?;
 
-        Ok(Self {
+        Ok(Self::from_analyses(
+            Arc::new(test_analysis),
+            Arc::new(source_analysis),
+            threshold,
+            boundary_threshold,
+        ))
+    }
+
+    /// Build an analyzer from files that have already been analyzed
+    pub fn from_analyses(
+        test_analysis: Arc<FileAnalysis>,
+        source_analysis: Arc<FileAnalysis>,
+        threshold: f64,
+        boundary_threshold: f64,
+    ) -> Self {
+        Self {
             test_analysis,
             source_analysis,
             threshold,
             boundary_threshold,
-        })
+        }
     }
 
     pub fn analyze(&self, check_boundaries: bool) -> AnalysisResult {
@@ -105,19 +127,12 @@ impl TestQualityAnalyzer {
 
         // Perform boundary analysis if requested
         let boundary_analysis = if check_boundaries {
-            match self.analyze_boundaries() {
-                Ok(analysis) => {
-                    // Boundary coverage below threshold is a failure
-                    if analysis.coverage_percent < (self.boundary_threshold * 100.0) {
-                        passed = false;
-                    }
-                    Some(analysis)
-                }
-                Err(e) => {
-                    eprintln!("Warning: Boundary analysis failed: {}", e);
-                    None
-                }
+            let analysis = self.source_analysis.boundaries.analyze_test_coverage(&self.test_analysis.boundaries);
+            // Boundary coverage below threshold is a failure
+            if analysis.coverage_percent < (self.boundary_threshold * 100.0) {
+                passed = false;
             }
+            Some(analysis)
         } else {
             None
         };
@@ -146,12 +161,6 @@ impl TestQualityAnalyzer {
         }
     }
 
-    fn analyze_boundaries(&self) -> Result<BoundaryAnalysis> {
-        let mut detector = BoundaryDetector::new();
-        detector.detect_boundaries(&self.source_analysis.file_path)?;
-        detector.analyze_test_coverage(&self.test_analysis.file_path)
-    }
-
     fn generate_recommendations(&self, recommendations: &mut Vec<String>, cyclomatic_ratio: f64, boundary_analysis: &Option<BoundaryAnalysis>) {
         // Only generate complexity recommendations if complexity ratio failed
         if cyclomatic_ratio < self.threshold {
@@ -210,49 +219,75 @@ impl TestQualityAnalyzer {
     }
 }
 
-/// Analyze a C file and extract function complexity metrics using knots
-pub fn analyze_file(file_path: &str) -> Result<FileAnalysis> {
-    let source_code = std::fs::read(file_path)?;
+/// A C file read and parsed exactly once. Complexity extraction, boundary detection
+/// and test-value extraction all work from these bytes and this tree, so their results
+/// always describe the same contents.
+pub struct LoadedFile {
+    pub path: String,
+    pub source: Vec<u8>,
+    pub tree: Tree,
+}
 
-    let mut parser = Parser::new();
-    let language = tree_sitter_c::language();
-    parser.set_language(&language)?;
+impl LoadedFile {
+    /// Read and parse a file
+    pub fn read(path: &str) -> Result<Self> {
+        let source = std::fs::read(path).with_context(|| format!("Failed to read file: {}", path))?;
+        Self::parse(path.to_string(), source)
+    }
+
+    /// Parse contents that are already in memory
+    pub fn parse(path: String, source: Vec<u8>) -> Result<Self> {
+        let tree = knots::parser::parse_c(&source)?
+            .ok_or_else(|| anyhow::anyhow!("Failed to parse file: {}", path))?;
+        Ok(Self { path, source, tree })
+    }
+}
 
-    let tree = parser.parse(&source_code, None)
-        .ok_or_else(|| anyhow::anyhow!("Failed to parse file: {}", file_path))?;
+/// Analyze a C file and extract function complexity metrics using knots
+pub fn analyze_file(file_path: &str) -> Result<FileAnalysis> {
+    Ok(analyze_loaded(&LoadedFile::read(file_path)?))
+}
 
-    let root_node = tree.root_node();
-    let mut file_analysis = FileAnalysis::new(file_path.to_string());
+/// Function metrics and boundary facts for a loaded file, from one traversal of its tree
+pub fn analyze_loaded(file: &LoadedFile) -> FileAnalysis {
+    let mut file_analysis = FileAnalysis::new(file.path.clone());
+    let source_code = file.source.as_slice();
 
-    // Find all function definitions
-    visit_functions(&root_node, &source_code, &mut |node| {
-        let metrics = extract_function_metrics(&node, &source_code);
-        file_analysis.add_function(metrics);
+    let mut cursor = file.tree.walk();
+    visit_nodes(&mut cursor, &mut |node, in_condition| {
+        if node.kind() == "function_definition" {
+            let metrics = extract_function_metrics(&node, source_code);
+            file_analysis.add_function(metrics);
+        }
+        file_analysis.boundaries.visit(node, source_code, in_condition);
     });
 
-    Ok(file_analysis)
+    file_analysis
 }
 
-fn visit_functions<F>(node: &Node, source_code: &[u8], callback: &mut F)
+/// Call `callback` for every node, with whether it lies inside an `if` condition.
+/// Iterative, so machine-generated or deeply nested C cannot overflow the stack.
+fn visit_nodes<F>(cursor: &mut TreeCursor, callback: &mut F)
 where
-    F: FnMut(Node),
+    F: FnMut(Node, bool),
 {
-    if node.kind() == "function_definition" {
-        callback(*node);
-    }
-
-    let mut cursor = node.walk();
-    for child in node.children(&mut cursor) {
-        visit_functions(&child, source_code, callback);
-    }
+    // Each ancestor contributes (inside a condition, is an if_statement)
+    let mut ancestors = Vec::new();
+    walk_preorder(cursor, &mut (false, false), &mut ancestors, |cursor, &mut (in_condition, is_if)| {
+        let node = cursor.node();
+        let in_condition = in_condition || (is_if && cursor.field_name() == Some("condition"));
+        callback(node, in_condition);
+        (in_condition, node.kind() == "if_statement")
+    });
 }
 
 fn extract_function_metrics(node: &Node, source: &[u8]) -> FunctionMetrics {
-    let function_name = extract_function_name(node, source);
+    let function_name = knots::analysis::function_name(*node, source).unwrap_or_else(|| "unknown".to_string());
 
-    // Use knots' complexity calculations directly
-    let cyclomatic_complexity = calculate_mccabe_complexity(*node, source);
-    let cognitive_complexity = calculate_cognitive_complexity(*node, source);
+    // Use knots' complexity calculations directly (one fused pass for both metrics)
+    let complexity = calculate_all_metrics(*node, source);
+    let cyclomatic_complexity = complexity.mccabe;
+    let cognitive_complexity = complexity.cognitive;
 
     let line_start = node.start_position().row + 1;
     let line_end = node.end_position().row + 1;
@@ -265,53 +300,3 @@ fn extract_function_metrics(node: &Node, source: &[u8]) -> FunctionMetrics {
         line_end,
     }
 }
-
-fn extract_function_name(node: &Node, source: &[u8]) -> String {
-    let mut cursor = node.walk();
-    for child in node.children(&mut cursor) {
-        if child.kind() == "function_declarator" {
-            return get_declarator_name(&child, source);
-        } else if child.kind() == "pointer_declarator" {
-            // For functions returning pointers
-            if let Some(name) = get_function_name_from_declarator(&child, source) {
-                return name;
-            }
-        }
-    }
-    "unknown".to_string()
-}
-
-fn get_function_name_from_declarator(node: &Node, source: &[u8]) -> Option<String> {
-    let mut cursor = node.walk();
-
-    for child in node.children(&mut cursor) {
-        if child.kind() == "function_declarator" {
-            return Some(get_declarator_name(&child, source));
-        } else if child.kind() == "pointer_declarator" {
-            if let Some(name) = get_function_name_from_declarator(&child, source) {
-                return Some(name);
-            }
-        }
-    }
-
-    None
-}
-
-fn get_declarator_name(node: &Node, source: &[u8]) -> String {
-    let mut cursor = node.walk();
-
-    for child in node.children(&mut cursor) {
-        if child.kind() == "identifier" {
-            if let Ok(text) = child.utf8_text(source) {
-                return text.to_string();
-            }
-        } else if child.kind() == "pointer_declarator" || child.kind() == "function_declarator" {
-            let name = get_declarator_name(&child, source);
-            if name != "unknown" {
-                return name;
-            }
-        }
-    }
-
-    "unknown".to_string()
-}
@@ -0,0 +1,293 @@
+// Batch mode: check many test/source pairs in one process, parsing each file once
+
+use anyhow::{Context, Result};
+use std::collections::{HashMap, HashSet};
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread;
+
+use crate::analyzer::{analyze_file, AnalysisResult, FileAnalysis, TestQualityAnalyzer};
+
+/// A test file and the source file it is measured against
+#[derive(Debug, Clone, PartialEq)]
+pub struct TestPair {
+    pub test_file: String,
+    pub source_file: String,
+}
+
+/// Settings applied to every pair of a batch
+pub struct BatchSettings {
+    pub threshold: f64,
+    pub boundary_threshold: f64,
+    pub check_boundaries: bool,
+    /// Worker threads; 0 means one per available CPU
+    pub jobs: usize,
+}
+
+/// What happened to one pair
+pub enum PairOutcome {
+    Analyzed(AnalysisResult),
+    /// A file could not be read or parsed
+    Failed { pair: TestPair, error: String },
+}
+
+impl PairOutcome {
+    pub fn passed(&self) -> bool {
+        matches!(self, PairOutcome::Analyzed(result) if result.passed)
+    }
+}
+
+/// Read a manifest with one `TEST_FILE SOURCE_FILE` pair per line.
+///
+/// A line holding a tab is split at it, so its paths may contain spaces; otherwise the
+/// paths are separated by any whitespace. Blank lines and lines starting with `#` are
+/// ignored.
+pub fn load_manifest(path: &Path) -> Result<Vec<TestPair>> {
+    let content = fs::read_to_string(path)
+        .with_context(|| format!("Failed to read manifest: {}", path.display()))?;
+
+    let mut pairs = Vec::new();
+    for (number, line) in content.lines().enumerate() {
+        let trimmed = line.trim();
+        if trimmed.is_empty() || trimmed.starts_with('#') {
+            continue;
+        }
+
+        let fields: Vec<&str> = if line.contains('\t') {
+            line.split('\t').collect()
+        } else {
+            trimmed.split_whitespace().collect()
+        };
+        let [test_file, source_file] = fields[..] else {
+            anyhow::bail!(
+                "{}:{}: expected 'TEST_FILE SOURCE_FILE', found '{}'",
+                path.display(),
+                number + 1,
+                trimmed
+            );
+        };
+        pairs.push(TestPair {
+            test_file: test_file.to_string(),
+            source_file: source_file.to_string(),
+        });
+    }
+
+    Ok(pairs)
+}
+
+/// Pair every `test_<name>.c` under `tests_dir` with `<name>.c` under `sources_dir`.
+///
+/// When several source files share a name the first in path order is used. Test files
+/// without a matching source are reported on stderr and skipped.
+pub fn discover_pairs(tests_dir: &Path, sources_dir: &Path) -> Result<Vec<TestPair>> {
+    let mut test_files = Vec::new();
+    collect_c_files(tests_dir, None, &mut test_files)?;
+    test_files.retain(|path| test_subject(path).is_some());
+    test_files.sort();
+
+    let mut source_files = Vec::new();
+    collect_c_files(sources_dir, Some(tests_dir), &mut source_files)?;
+    source_files.sort();
+
+    let mut sources_by_name: HashMap<String, PathBuf> = HashMap::new();
+    for path in source_files {
+        let Some(name) = path.file_name().and_then(|n| n.to_str()) else { continue };
+        if name.starts_with("test_") {
+            continue;
+        }
+        sources_by_name.entry(name.to_string()).or_insert(path);
+    }
+
+    let mut pairs = Vec::new();
+    for test_file in test_files {
+        let subject = test_subject(&test_file).expect("filtered to test files above");
+        match sources_by_name.get(&subject) {
+            Some(source_file) => pairs.push(TestPair {
+                test_file: test_file.to_string_lossy().into_owned(),
+                source_file: source_file.to_string_lossy().into_owned(),
+            }),
+            None => eprintln!(
+                "Warning: no {} found under {} for {}",
+                subject,
+                sources_dir.display(),
+                test_file.display()
+            ),
+        }
+    }
+
+    Ok(pairs)
+}
+
+/// The source file name a test file covers: `test_uart.c` -> `uart.c`
+fn test_subject(path: &Path) -> Option<String> {
+    let name = path.file_name()?.to_str()?;
+    let subject = name.strip_prefix("test_")?;
+    (subject.len() > ".c".len()).then(|| subject.to_string())
+}
+
+fn collect_c_files(dir: &Path, skip: Option<&Path>, files: &mut Vec<PathBuf>) -> Result<()> {
+    let entries = fs::read_dir(dir).with_context(|| format!("Failed to read directory: {}", dir.display()))?;
+
+    for entry in entries {
+        let path = entry?.path();
+        if skip.is_some_and(|skip| same_path(&path, skip)) {
+            continue;
+        }
+        if path.is_dir() {
+            collect_c_files(&path, skip, files)?;
+        } else if path.extension().is_some_and(|ext| ext == "c") {
+            files.push(path);
+        }
+    }
+
+    Ok(())
+}
+
+fn same_path(a: &Path, b: &Path) -> bool {
+    match (fs::canonicalize(a), fs::canonicalize(b)) {
+        (Ok(a), Ok(b)) => a == b,
+        _ => a == b,
+    }
+}
+
+/// Analyze every pair, in input order.
+///
+/// Each distinct file is read and parsed once, however many pairs mention it, and both
+/// the parsing and the per-pair checks run on `settings.jobs` threads.
+pub fn run(pairs: &[TestPair], settings: &BatchSettings) -> Vec<PairOutcome> {
+    let jobs = resolve_jobs(settings.jobs);
+
+    // The same file may be spelled differently in different pairs, so files are keyed
+    // by canonical path
+    let mut keys: HashMap<&str, PathBuf> = HashMap::new();
+    let mut seen = HashSet::new();
+    let mut distinct: Vec<(PathBuf, &str)> = Vec::new();
+    for path in pairs.iter().flat_map(|pair| [pair.test_file.as_str(), pair.source_file.as_str()]) {
+        if keys.contains_key(path) {
+            continue;
+        }
+        let key = fs::canonicalize(path).unwrap_or_else(|_| PathBuf::from(path));
+        if seen.insert(key.clone()) {
+            distinct.push((key.clone(), path));
+        }
+        keys.insert(path, key);
+    }
+
+    let analyses: HashMap<PathBuf, Result<Arc<FileAnalysis>, String>> = distinct
+        .iter()
+        .map(|(key, _)| key.clone())
+        .zip(parallel_map(&distinct, jobs, |(_, path)| {
+            analyze_file(path).map(Arc::new).map_err(|e| format!("{:#}", e))
+        }))
+        .collect();
+
+    parallel_map(pairs, jobs, |pair| {
+        let test = &analyses[&keys[pair.test_file.as_str()]];
+        let source = &analyses[&keys[pair.source_file.as_str()]];
+        match (test, source) {
+            (Ok(test), Ok(source)) => {
+                let analyzer = TestQualityAnalyzer::from_analyses(
+                    Arc::clone(test),
+                    Arc::clone(source),
+                    settings.threshold,
+                    settings.boundary_threshold,
+                );
+                PairOutcome::Analyzed(analyzer.analyze(settings.check_boundaries))
+            }
+            (Err(error), _) | (_, Err(error)) => PairOutcome::Failed {
+                pair: pair.clone(),
+                error: error.clone(),
+            },
+        }
+    })
+}
+
+fn resolve_jobs(requested: usize) -> usize {
+    if requested > 0 {
+        return requested;
+    }
+
+    thread::available_parallelism()
+        .map(|n| n.get())
+        .unwrap_or(1)
+}
+
+/// Apply `f` to every item on up to `jobs` threads, returning results in input order
+fn parallel_map<T, R, F>(items: &[T], jobs: usize, f: F) -> Vec<R>
+where
+    T: Sync,
+    R: Send,
+    F: Fn(&T) -> R + Sync,
+{
+    let next = AtomicUsize::new(0);
+    let results = Mutex::new(Vec::with_capacity(items.len()));
+
+    thread::scope(|scope| {
+        for _ in 0..jobs.clamp(1, items.len().max(1)) {
+            scope.spawn(|| loop {
+                let index = next.fetch_add(1, Ordering::Relaxed);
+                let Some(item) = items.get(index) else { break };
+                let result = f(item);
+                results.lock().unwrap().push((index, result));
+            });
+        }
+    });
+
+    let mut results = results.into_inner().unwrap();
+    results.sort_by_key(|(index, _)| *index);
+    results.into_iter().map(|(_, result)| result).collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_discover_and_manifest_pairs() {
+        let dir = std::env::temp_dir().join(format!("knots-test-complexity-batch-{}", std::process::id()));
+        fs::create_dir_all(dir.join("Test")).unwrap();
+        fs::create_dir_all(dir.join("src/drivers")).unwrap();
+        fs::write(dir.join("src/drivers/uart.c"), "int uart(void) { return 0; }").unwrap();
+        fs::write(dir.join("src/timer.c"), "int timer(void) { return 0; }").unwrap();
+        fs::write(dir.join("Test/test_uart.c"), "void test_uart(void) {}").unwrap();
+        fs::write(dir.join("Test/test_timer.c"), "void test_timer(void) {}").unwrap();
+        fs::write(dir.join("Test/test_missing.c"), "void test_missing(void) {}").unwrap();
+
+        let pairs = discover_pairs(&dir.join("Test"), &dir).unwrap();
+        let names: Vec<_> = pairs
+            .iter()
+            .map(|p| (file_name(&p.test_file), file_name(&p.source_file)))
+            .collect();
+        assert_eq!(names, vec![("test_timer.c", "timer.c"), ("test_uart.c", "uart.c")]);
+
+        let manifest = dir.join("pairs.txt");
+        fs::write(&manifest, "# test source\nTest/test_uart.c src/drivers/uart.c\n\n").unwrap();
+        assert_eq!(
+            load_manifest(&manifest).unwrap(),
+            vec![TestPair {
+                test_file: "Test/test_uart.c".to_string(),
+                source_file: "src/drivers/uart.c".to_string(),
+            }]
+        );
+
+        fs::write(&manifest, "Test/my tests/test_uart.c\tsrc/uart driver.c\n").unwrap();
+        assert_eq!(
+            load_manifest(&manifest).unwrap(),
+            vec![TestPair {
+                test_file: "Test/my tests/test_uart.c".to_string(),
+                source_file: "src/uart driver.c".to_string(),
+            }]
+        );
+
+        fs::write(&manifest, "Test/test_uart.c\n").unwrap();
+        assert!(load_manifest(&manifest).is_err());
+
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    fn file_name(path: &str) -> &str {
+        Path::new(path).file_name().unwrap().to_str().unwrap()
+    }
+}
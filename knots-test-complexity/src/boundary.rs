@@ -1,6 +1,5 @@
-use anyhow::Result;
-use regex::Regex;
 use std::collections::HashSet;
+use tree_sitter::Node;
 
 #[derive(Debug, Clone)]
 pub struct BoundaryValue {
@@ -21,8 +20,27 @@ impl BoundaryValue {
     }
 }
 
+/// Integer types whose variables must be tested at their limits
+const INTEGER_TYPES: &[(&str, i64, i64)] = &[
+    ("uint8_t", 0, 255),
+    ("uint16_t", 0, 65535),
+    ("uint32_t", 0, 4294967295),
+    ("int8_t", -128, 127),
+    ("int16_t", -32768, 32767),
+    ("int32_t", -2147483648, 2147483647),
+];
+
+/// Boundary facts gathered from one file's syntax tree.
+///
+/// `visit` is called for every node of the single traversal `analyze_file` already
+/// makes, so nothing is re-read or re-scanned. Working on the tree instead of the text
+/// means comments, string literals and identifiers such as `test_255` never count.
+/// A source file contributes its boundaries and a test file its literal values, but
+/// both are collected for every file so either role can be checked.
+#[derive(Debug, Default)]
 pub struct BoundaryDetector {
     boundaries: Vec<BoundaryValue>,
+    literal_values: HashSet<i64>,
 }
 
 pub struct BoundaryAnalysis {
@@ -34,135 +52,134 @@ pub struct BoundaryAnalysis {
 
 impl BoundaryDetector {
     pub fn new() -> Self {
-        Self {
-            boundaries: Vec::new(),
-        }
-    }
-
-    /// Detect boundary values in source code
-    pub fn detect_boundaries(&mut self, file_path: &str) -> Result<Vec<BoundaryValue>> {
-        let source_code = std::fs::read_to_string(file_path)?;
-
-        // Detect integer type declarations
-        self.detect_integer_types(&source_code)?;
-
-        // Detect range checks and constants
-        self.detect_range_checks(&source_code)?;
-
-        Ok(self.boundaries.clone())
+        Self::default()
     }
 
-    /// Detect integer type declarations (uint8_t, uint16_t, etc.)
-    fn detect_integer_types(&mut self, source: &str) -> Result<()> {
-        let type_patterns = vec![
-            ("uint8_t", 0, 255),
-            ("uint16_t", 0, 65535),
-            ("uint32_t", 0, 4294967295i64),
-            ("int8_t", -128, 127),
-            ("int16_t", -32768, 32767),
-            ("int32_t", -2147483648i64, 2147483647i64),
-        ];
-
-        for (type_name, min_val, max_val) in type_patterns {
-            // Regex to find variable declarations
-            // Matches: uint8_t foo; or uint8_t foo = 0; or uint8_t foo, bar;
-            let pattern = format!(r"\b{}\s+(\w+)\s*[;=,]", type_name);
-            let re = Regex::new(&pattern)?;
-
-            for captures in re.captures_iter(source) {
-                if let Some(var_name) = captures.get(1) {
-                    let var_str = var_name.as_str();
-
-                    // Skip common prefixes that might not be actual variables
-                    if var_str.starts_with("MAX_") || var_str.starts_with("MIN_") {
-                        continue;
+    /// Inspect one node. `in_condition` is true for nodes inside an `if` condition.
+    pub fn visit(&mut self, node: Node, source: &[u8], in_condition: bool) {
+        match node.kind() {
+            // uint8_t foo; / uint8_t foo = 0; / struct fields / parameters
+            "declaration" | "field_declaration" | "parameter_declaration" => self.visit_declaration(node, source),
+            // if (x > MAX), if (MIN <= x), ...
+            "binary_expression" if in_condition => self.visit_comparison(node, source),
+            // #define MAX_VALUE 255
+            "preproc_def" => self.visit_define(node, source),
+            "number_literal" if !is_negated(node) => {
+                if let Some(value) = integer_literal(node, source) {
+                    self.literal_values.insert(value);
+                }
+            }
+            "unary_expression" => {
+                let negated_literal = node.child_by_field_name("operator").is_some_and(|op| op.kind() == "-")
+                    && node.child_by_field_name("argument").is_some_and(|arg| arg.kind() == "number_literal");
+                if negated_literal {
+                    let argument = node.child_by_field_name("argument").unwrap();
+                    if let Some(value) = integer_literal(argument, source) {
+                        self.literal_values.insert(-value);
                     }
-
-                    self.boundaries.push(BoundaryValue {
-                        variable_name: var_str.to_string(),
-                        type_name: type_name.to_string(),
-                        min_value: min_val,
-                        max_value: max_val,
-                    });
                 }
             }
+            _ => {}
         }
-
-        Ok(())
     }
 
-    /// Detect range checks (if (x > MAX), if (x < MIN), etc.)
-    fn detect_range_checks(&mut self, source: &str) -> Result<()> {
-        // Patterns to detect comparison with constants
-        let patterns = vec![
-            // if (x > CONSTANT) or if (x >= CONSTANT)
-            (r"if\s*\(\s*\w+\s*>=?\s*(\d+)", "range_check_upper"),
-            // if (x < CONSTANT) or if (x <= CONSTANT)
-            (r"if\s*\(\s*\w+\s*<=?\s*(\d+)", "range_check_lower"),
-            // if (CONSTANT < x) or if (CONSTANT <= x)
-            (r"if\s*\(\s*(\d+)\s*<=?\s*\w+", "range_check_lower"),
-            // if (CONSTANT > x) or if (CONSTANT >= x)
-            (r"if\s*\(\s*(\d+)\s*>=?\s*\w+", "range_check_upper"),
-            // Defined constants like #define MAX_VALUE 255
-            (r"#define\s+\w*MAX\w*\s+(\d+)", "constant_max"),
-            (r"#define\s+\w*MIN\w*\s+(\d+)", "constant_min"),
-        ];
-
-        for (pattern_str, boundary_type) in patterns {
-            let re = Regex::new(pattern_str)?;
-
-            for captures in re.captures_iter(source) {
-                if let Some(value_match) = captures.get(1) {
-                    if let Ok(value) = value_match.as_str().parse::<i64>() {
-                        // Create boundary based on the constant
-                        let (min_val, max_val) = if boundary_type.contains("upper") || boundary_type.contains("max") {
-                            // Upper bound: test value and value+1
-                            (value.saturating_sub(1), value)
-                        } else {
-                            // Lower bound: test value-1 and value
-                            (value, value.saturating_add(1))
-                        };
-
-                        self.boundaries.push(BoundaryValue {
-                            variable_name: format!("constant_{}", value),
-                            type_name: boundary_type.to_string(),
-                            min_value: min_val,
-                            max_value: max_val,
-                        });
-                    }
-                }
+    fn visit_declaration(&mut self, node: Node, source: &[u8]) {
+        let Some(type_node) = node.child_by_field_name("type") else { return };
+        let type_name = text(type_node, source);
+        let Some(&(type_name, min_value, max_value)) = INTEGER_TYPES.iter().find(|(name, _, _)| *name == type_name) else {
+            return;
+        };
+
+        for i in 0..node.child_count() {
+            if node.field_name_for_child(i as u32) != Some("declarator") {
+                continue;
+            }
+            let Some(declarator) = node.child(i) else { continue };
+            // Only plain variables: pointers, arrays and function prototypes have no range
+            let name_node = match declarator.kind() {
+                "identifier" | "field_identifier" => Some(declarator),
+                "init_declarator" => declarator
+                    .child_by_field_name("declarator")
+                    .filter(|d| d.kind() == "identifier"),
+                _ => None,
+            };
+            let Some(name_node) = name_node else { continue };
+            let variable_name = text(name_node, source);
+
+            // Skip common prefixes that might not be actual variables
+            if variable_name.starts_with("MAX_") || variable_name.starts_with("MIN_") {
+                continue;
             }
-        }
 
-        Ok(())
+            self.boundaries.push(BoundaryValue {
+                variable_name: variable_name.to_string(),
+                type_name: type_name.to_string(),
+                min_value,
+                max_value,
+            });
+        }
     }
 
-    /// Count boundary tests in test file
-    pub fn analyze_test_coverage(&self, test_file_path: &str) -> Result<BoundaryAnalysis> {
-        let source_code = std::fs::read_to_string(test_file_path)?;
-        let mut found_values = HashSet::new();
+    fn visit_comparison(&mut self, node: Node, source: &[u8]) {
+        let Some(operator) = node.child_by_field_name("operator") else { return };
+        if !matches!(operator.kind(), ">" | ">=" | "<" | "<=") {
+            return;
+        }
+        let (Some(left), Some(right)) = (node.child_by_field_name("left"), node.child_by_field_name("right")) else {
+            return;
+        };
 
-        // Extract all numeric literals from test file (including negative numbers)
-        let number_re = Regex::new(r"(-?\d+)\b")?;
+        // Exactly one side must be a constant; `x > 100` and `100 > x` both bound x from
+        // above, `x < 100` and `100 < x` from below
+        let constant = match (left.kind() == "number_literal", right.kind() == "number_literal") {
+            (true, false) => left,
+            (false, true) => right,
+            _ => return,
+        };
+        let Some(value) = integer_literal(constant, source) else { return };
 
-        for captures in number_re.captures_iter(&source_code) {
-            if let Some(num_match) = captures.get(1) {
-                if let Ok(value) = num_match.as_str().parse::<i64>() {
-                    found_values.insert(value);
-                }
-            }
+        if operator.kind().starts_with('>') {
+            self.push_constant(value, "range_check_upper");
+        } else {
+            self.push_constant(value, "range_check_lower");
         }
+    }
 
-        // Also look for hex literals (0xFF, 0xFFFF, etc.)
-        let hex_re = Regex::new(r"\b(0[xX][0-9a-fA-F]+)\b")?;
-        for captures in hex_re.captures_iter(&source_code) {
-            if let Some(hex_match) = captures.get(1) {
-                let hex_str = hex_match.as_str();
-                if let Ok(value) = i64::from_str_radix(&hex_str[2..], 16) {
-                    found_values.insert(value);
-                }
-            }
+    fn visit_define(&mut self, node: Node, source: &[u8]) {
+        let (Some(name), Some(value)) = (node.child_by_field_name("name"), node.child_by_field_name("value")) else {
+            return;
+        };
+        let Some(value) = parse_integer(text(value, source).trim()) else { return };
+        let name = text(name, source);
+
+        if name.contains("MAX") {
+            self.push_constant(value, "constant_max");
+        }
+        if name.contains("MIN") {
+            self.push_constant(value, "constant_min");
         }
+    }
+
+    fn push_constant(&mut self, value: i64, boundary_type: &str) {
+        let (min_value, max_value) = if boundary_type.contains("upper") || boundary_type.contains("max") {
+            // Upper bound: test value and value+1
+            (value.saturating_sub(1), value)
+        } else {
+            // Lower bound: test value-1 and value
+            (value, value.saturating_add(1))
+        };
+
+        self.boundaries.push(BoundaryValue {
+            variable_name: format!("constant_{}", value),
+            type_name: boundary_type.to_string(),
+            min_value,
+            max_value,
+        });
+    }
+
+    /// Check how many of this source file's boundaries the test file's literals cover
+    pub fn analyze_test_coverage(&self, test: &BoundaryDetector) -> BoundaryAnalysis {
+        let found_values = &test.literal_values;
 
         // Calculate coverage
         let mut total_required = 0;
@@ -201,28 +218,65 @@ impl BoundaryDetector {
             100.0 // No boundaries required = 100% coverage
         };
 
-        Ok(BoundaryAnalysis {
+        BoundaryAnalysis {
             required_boundaries: self.boundaries.clone(),
-            found_test_values: found_values,
+            found_test_values: found_values.clone(),
             coverage_percent,
             missing_boundaries: missing,
-        })
+        }
     }
 }
 
+fn text<'a>(node: Node, source: &'a [u8]) -> &'a str {
+    std::str::from_utf8(&source[node.byte_range()]).unwrap_or("")
+}
+
+/// A literal directly under unary minus is recorded (negated) by its parent instead
+fn is_negated(node: Node) -> bool {
+    node.parent().is_some_and(|parent| {
+        parent.kind() == "unary_expression" && parent.child_by_field_name("operator").is_some_and(|op| op.kind() == "-")
+    })
+}
+
+fn integer_literal(node: Node, source: &[u8]) -> Option<i64> {
+    parse_integer(text(node, source))
+}
+
+/// Parse a C integer literal (decimal, hex, octal or binary, with optional u/l
+/// suffixes); floating-point literals yield None
+fn parse_integer(literal: &str) -> Option<i64> {
+    let digits = literal.trim_end_matches(['u', 'U', 'l', 'L']);
+    let (digits, radix) = if let Some(hex) = digits.strip_prefix("0x").or_else(|| digits.strip_prefix("0X")) {
+        (hex, 16)
+    } else if let Some(binary) = digits.strip_prefix("0b").or_else(|| digits.strip_prefix("0B")) {
+        (binary, 2)
+    } else if digits.len() > 1 && digits.starts_with('0') {
+        (&digits[1..], 8)
+    } else {
+        (digits, 10)
+    };
+    i64::from_str_radix(digits, radix).ok()
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::analyzer::{analyze_loaded, LoadedFile};
+
+    fn detect(code: &str) -> BoundaryDetector {
+        let file = LoadedFile::parse("test.c".to_string(), code.as_bytes().to_vec()).unwrap();
+        analyze_loaded(&file).boundaries
+    }
 
     #[test]
     fn test_detect_uint8_boundary() {
         let code = r#"
         uint8_t counter = 0;
         uint16_t timer_ms = 0;
+        uint8_t *buffer;
         "#;
 
-        let mut detector = BoundaryDetector::new();
-        detector.detect_integer_types(code).unwrap();
+        let detector = detect(code);
 
         assert_eq!(detector.boundaries.len(), 2);
         assert_eq!(detector.boundaries[0].type_name, "uint8_t");
@@ -235,15 +289,31 @@ mod tests {
     #[test]
     fn test_detect_range_checks() {
         let code = r#"
-        if (counter > 100) {
-            // overflow check
-        }
         #define MAX_VALUE 255
+        void check(int counter) {
+            if (counter > 100 && 10 <= counter) {
+                // overflow check
+            }
+        }
+        "#;
+
+        let detector = detect(code);
+        let kinds: Vec<_> = detector.boundaries.iter().map(|b| (b.type_name.as_str(), b.max_value)).collect();
+
+        assert_eq!(kinds, vec![("constant_max", 255), ("range_check_upper", 100), ("range_check_lower", 11)]);
+    }
+
+    #[test]
+    fn test_literals_ignore_comments_and_strings() {
+        let code = r#"
+        // 255 in a comment
+        void test_overflow_65535(void) {
+            TEST_ASSERT_EQUAL(0xFF, saturate(-1, "256"));
+        }
         "#;
 
-        let mut detector = BoundaryDetector::new();
-        detector.detect_range_checks(code).unwrap();
+        let detector = detect(code);
 
-        assert!(detector.boundaries.len() >= 2);
+        assert_eq!(detector.literal_values, HashSet::from([255, -1]));
     }
 }
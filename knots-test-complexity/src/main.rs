@@ -1,11 +1,14 @@
 use anyhow::Result;
 use clap::Parser;
+use std::path::PathBuf;
 
 mod analyzer;
+mod batch;
 mod boundary;
 mod reporter;
 
 use analyzer::TestQualityAnalyzer;
+use batch::BatchSettings;
 use reporter::Reporter;
 
 #[derive(Parser)]
@@ -14,10 +17,28 @@ use reporter::Reporter;
 #[command(about = "Test quality analyzer for C unit tests - validates test complexity against source complexity", long_about = None)]
 struct Args {
     /// Test file path (e.g., Test/test_battery_service.c)
-    test_file: String,
+    #[arg(required_unless_present_any = ["manifest", "tests"])]
+    test_file: Option<String>,
 
     /// Source file path (e.g., Core/Src/modules/battery_service/battery_service.c)
-    source_file: String,
+    #[arg(required_unless_present_any = ["manifest", "tests"])]
+    source_file: Option<String>,
+
+    /// Batch mode: check every pair listed in FILE, one "TEST_FILE SOURCE_FILE" per line
+    #[arg(long, value_name = "FILE", conflicts_with_all = ["test_file", "source_file", "tests"])]
+    manifest: Option<PathBuf>,
+
+    /// Batch mode: check every test_<name>.c under DIR against <name>.c under --sources
+    #[arg(long, value_name = "DIR", conflicts_with_all = ["test_file", "source_file"])]
+    tests: Option<PathBuf>,
+
+    /// Directory searched for the source files of --tests
+    #[arg(long, value_name = "DIR", default_value = ".")]
+    sources: PathBuf,
+
+    /// Worker threads for batch mode (0 = one per CPU)
+    #[arg(short, long, value_name = "N", default_value_t = 0)]
+    jobs: usize,
 
     /// Minimum test-to-source complexity ratio (default: 0.70 = 70%)
     #[arg(short, long, default_value = "0.70")]
@@ -59,21 +80,29 @@ fn main() -> Result<()> {
         std::process::exit(1);
     }
 
+    if args.manifest.is_some() || args.tests.is_some() {
+        return run_batch(&args);
+    }
+
+    let (Some(test_file), Some(source_file)) = (&args.test_file, &args.source_file) else {
+        unreachable!("clap requires both files outside batch mode");
+    };
+
     // Check if files exist
-    if !std::path::Path::new(&args.test_file).exists() {
-        eprintln!("Error: Test file not found: {}", args.test_file);
+    if !std::path::Path::new(test_file).exists() {
+        eprintln!("Error: Test file not found: {}", test_file);
         std::process::exit(1);
     }
 
-    if !std::path::Path::new(&args.source_file).exists() {
-        eprintln!("Error: Source file not found: {}", args.source_file);
+    if !std::path::Path::new(source_file).exists() {
+        eprintln!("Error: Source file not found: {}", source_file);
         std::process::exit(1);
     }
 
     // Create analyzer and run analysis
     let analyzer = TestQualityAnalyzer::new(
-        &args.test_file,
-        &args.source_file,
+        test_file,
+        source_file,
         args.threshold,
         args.boundary_threshold,
     )?;
@@ -91,3 +120,32 @@ fn main() -> Result<()> {
 
     Ok(())
 }
+
+/// Check many test/source pairs in one process and report them together
+fn run_batch(args: &Args) -> Result<()> {
+    let pairs = match (&args.manifest, &args.tests) {
+        (Some(manifest), _) => batch::load_manifest(manifest)?,
+        (None, Some(tests)) => batch::discover_pairs(tests, &args.sources)?,
+        (None, None) => unreachable!("run_batch requires --manifest or --tests"),
+    };
+
+    let settings = BatchSettings {
+        threshold: args.threshold,
+        boundary_threshold: args.boundary_threshold,
+        check_boundaries: !args.no_check_boundaries,
+        jobs: args.jobs,
+    };
+    let outcomes = batch::run(&pairs, &settings);
+
+    let reporter = Reporter::new(args.verbose);
+    reporter.print_batch_report(&outcomes);
+
+    // Unreadable files are always an error, as they are for a single pair
+    let has_errors = outcomes.iter().any(|o| matches!(o, batch::PairOutcome::Failed { .. }));
+    let all_passed = outcomes.iter().all(|o| o.passed());
+    if has_errors || (!all_passed && args.level == "error") {
+        std::process::exit(1);
+    }
+
+    Ok(())
+}
@@ -1,5 +1,6 @@
 use colored::*;
 use crate::analyzer::AnalysisResult;
+use crate::batch::PairOutcome;
 use std::path::Path;
 
 pub struct Reporter {
@@ -118,4 +119,40 @@ impl Reporter {
         }
         println!("{}\n", "━".repeat(70).bright_black());
     }
+
+    /// Print a batch run: the full report for each failing pair (and, when verbose,
+    /// each passing one), a line per passing pair, then a combined summary
+    pub fn print_batch_report(&self, outcomes: &[PairOutcome]) {
+        for outcome in outcomes {
+            match outcome {
+                PairOutcome::Analyzed(result) if result.passed && !self.verbose => {
+                    println!("{} {} ({})", "✓".green(), result.test_file, result.source_file);
+                }
+                PairOutcome::Analyzed(result) => self.print_report(result),
+                PairOutcome::Failed { pair, error } => {
+                    println!("{} {} ({})", "✗".red(), pair.test_file, pair.source_file);
+                    println!("  {}", format!("Error: {}", error).red());
+                }
+            }
+        }
+
+        let analyzed = outcomes.iter().filter(|o| matches!(o, PairOutcome::Analyzed(_))).count();
+        let passed = outcomes.iter().filter(|o| o.passed()).count();
+        let errors = outcomes.len() - analyzed;
+
+        println!("\n{}", "━".repeat(70).bright_black());
+        println!("{}", format!("Batch Summary: {} test files", outcomes.len()).bold());
+        println!("  Passed: {}", passed);
+        println!("  Failed: {}", analyzed - passed);
+        if errors > 0 {
+            println!("  Errors: {}", errors);
+        }
+        println!("{}", "━".repeat(70).bright_black());
+        if passed == outcomes.len() {
+            println!("{}", "Result: ✓ PASS".green().bold());
+        } else {
+            println!("{}", "Result: ✗ FAIL".red().bold());
+        }
+        println!("{}\n", "━".repeat(70).bright_black());
+    }
 }
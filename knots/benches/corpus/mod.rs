@@ -0,0 +1,81 @@
+// Deterministic synthetic C sources shared by the benchmarks
+
+// Each bench target uses a different subset of the generators
+#![allow(dead_code)]
+
+use std::fmt::Write;
+
+/// A function with `statements` top-level statements, branching up to `depth` levels
+/// deep, mixing the constructs every metric kernel has to look at
+pub fn synthetic_function(name: &str, statements: usize, depth: usize) -> String {
+    let mut body = String::new();
+    let mut counter = 0;
+    emit_block(&mut body, statements, depth, 1, &mut counter);
+
+    format!(
+        "/**\n * @intent Synthetic benchmark function\n * @param x input\n * @return result\n */\n\
+         static int {name}(int x, int y, const char *label)\n{{\n{body}    return x;\n}}\n"
+    )
+}
+
+/// A translation unit of `functions` synthetic functions
+pub fn synthetic_file(seed: usize, functions: usize, statements: usize, depth: usize) -> String {
+    let mut source = String::from("#include <stdio.h>\n#include <stdlib.h>\n\nstatic int g_counter;\n\n");
+    for i in 0..functions {
+        // Vary the shape so files are not all identical
+        let statements = statements + (seed + i) % 5;
+        let depth = depth.min(1 + (seed + i) % (depth + 1));
+        source.push_str(&synthetic_function(&format!("fn_{}_{}", seed, i), statements, depth));
+        source.push('\n');
+    }
+    source
+}
+
+fn emit_block(out: &mut String, statements: usize, depth: usize, indent: usize, counter: &mut usize) {
+    let pad = "    ".repeat(indent);
+
+    for _ in 0..statements {
+        *counter += 1;
+        let n = *counter;
+
+        match (n % 6, depth > 0) {
+            (0, true) => {
+                writeln!(out, "{pad}if (x > {n} && (y < {n} || label != NULL)) {{").unwrap();
+                emit_block(out, 2, depth - 1, indent + 1, counter);
+                writeln!(out, "{pad}}} else if (y == {n}) {{").unwrap();
+                writeln!(out, "{pad}    y = y * 2 - {n};").unwrap();
+                writeln!(out, "{pad}}} else {{").unwrap();
+                emit_block(out, 1, depth - 1, indent + 1, counter);
+                writeln!(out, "{pad}}}").unwrap();
+            }
+            (1, true) => {
+                writeln!(out, "{pad}for (int i = 0; i < {n}; i++) {{").unwrap();
+                emit_block(out, 2, depth - 1, indent + 1, counter);
+                writeln!(out, "{pad}}}").unwrap();
+            }
+            (2, true) => {
+                writeln!(out, "{pad}while (x-- > 0 && y != {n}) {{").unwrap();
+                emit_block(out, 1, depth - 1, indent + 1, counter);
+                writeln!(out, "{pad}}}").unwrap();
+            }
+            (3, true) => {
+                writeln!(out, "{pad}switch (x % 3) {{").unwrap();
+                writeln!(out, "{pad}case 0:").unwrap();
+                emit_block(out, 1, depth - 1, indent + 1, counter);
+                writeln!(out, "{pad}    break;").unwrap();
+                writeln!(out, "{pad}default:").unwrap();
+                writeln!(out, "{pad}    y += x ? {n} : -{n};").unwrap();
+                writeln!(out, "{pad}}}").unwrap();
+            }
+            (4, _) => {
+                writeln!(out, "{pad}printf(\"%s %d\\n\", label, x + {n});").unwrap();
+            }
+            (5, _) => {
+                writeln!(out, "{pad}g_counter += {n};").unwrap();
+            }
+            _ => {
+                writeln!(out, "{pad}x = (x * {n} + y) / ({n} + 1);").unwrap();
+            }
+        }
+    }
+}
@@ -0,0 +1,117 @@
+// Benchmarks for the per-function metric kernels and whole-file measurement
+//
+// Run with `cargo bench -p knots --bench metrics`. Criterion keeps results under
+// target/criterion; see the README for saving and comparing against a baseline.
+
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use std::path::Path;
+use tree_sitter::{Node, Tree};
+
+use knots::analysis::visit_functions;
+use knots::complexity::{
+    calculate_abc_complexity, calculate_all_metrics, calculate_cognitive_complexity, calculate_mccabe_complexity,
+    calculate_nesting_depth, calculate_return_count, calculate_sloc, calculate_test_scoring,
+};
+
+mod corpus;
+
+/// (statements, nesting depth) of the synthetic functions, smallest to largest
+const SHAPES: &[(usize, usize)] = &[(8, 1), (40, 3), (160, 5), (400, 7)];
+
+fn parse(source: &[u8]) -> Tree {
+    knots::parser::parse_c(source)
+        .expect("C language loads")
+        .expect("synthetic source parses")
+}
+
+fn first_function(tree: &Tree) -> Node<'_> {
+    let root = tree.root_node();
+    (0..root.named_child_count())
+        .filter_map(|i| root.named_child(i))
+        .find(|node| node.kind() == "function_definition")
+        .expect("source has a function definition")
+}
+
+fn bench_kernels(c: &mut Criterion) {
+    let mut group = c.benchmark_group("kernels");
+
+    for &(statements, depth) in SHAPES {
+        let source = corpus::synthetic_function("bench", statements, depth);
+        let src = source.as_bytes();
+        let tree = parse(src);
+        let node = first_function(&tree);
+        let shape = format!("{}x{}", statements, depth);
+
+        group.throughput(Throughput::Bytes(node.byte_range().len() as u64));
+        group.bench_with_input(BenchmarkId::new("mccabe", &shape), &node, |b, &node| {
+            b.iter(|| calculate_mccabe_complexity(black_box(node), src))
+        });
+        group.bench_with_input(BenchmarkId::new("cognitive", &shape), &node, |b, &node| {
+            b.iter(|| calculate_cognitive_complexity(black_box(node), src))
+        });
+        group.bench_with_input(BenchmarkId::new("nesting", &shape), &node, |b, &node| {
+            b.iter(|| calculate_nesting_depth(black_box(node)))
+        });
+        group.bench_with_input(BenchmarkId::new("sloc", &shape), &node, |b, &node| {
+            b.iter(|| calculate_sloc(black_box(node), src))
+        });
+        group.bench_with_input(BenchmarkId::new("abc", &shape), &node, |b, &node| {
+            b.iter(|| calculate_abc_complexity(black_box(node), src))
+        });
+        group.bench_with_input(BenchmarkId::new("returns", &shape), &node, |b, &node| {
+            b.iter(|| calculate_return_count(black_box(node)))
+        });
+        group.bench_with_input(BenchmarkId::new("test_scoring", &shape), &node, |b, &node| {
+            b.iter(|| calculate_test_scoring(black_box(node), src))
+        });
+        group.bench_with_input(BenchmarkId::new("all_metrics", &shape), &node, |b, &node| {
+            b.iter(|| calculate_all_metrics(black_box(node), src))
+        });
+    }
+
+    group.finish();
+}
+
+/// Parse a file and measure every function definition in it, as the CLI does per file
+fn measure_file(source: &[u8]) -> usize {
+    let tree = parse(source);
+    let mut measured = 0;
+    visit_functions(&mut tree.walk(), source, &mut |node, source| {
+        black_box(calculate_all_metrics(node, source));
+        measured += 1;
+    });
+    measured
+}
+
+fn bench_files(c: &mut Criterion) {
+    let mut group = c.benchmark_group("files");
+
+    let examples = Path::new(env!("CARGO_MANIFEST_DIR")).join("examples");
+    let mut paths: Vec<_> = std::fs::read_dir(&examples)
+        .expect("knots/examples exists")
+        .filter_map(|entry| entry.ok().map(|e| e.path()))
+        .filter(|path| path.extension().is_some_and(|ext| ext == "c"))
+        .collect();
+    paths.sort();
+
+    for path in paths {
+        let source = std::fs::read(&path).expect("example is readable");
+        let name = path.file_name().unwrap().to_string_lossy().into_owned();
+        group.throughput(Throughput::Bytes(source.len() as u64));
+        group.bench_with_input(BenchmarkId::new("example", name), &source, |b, source| {
+            b.iter(|| measure_file(black_box(source)))
+        });
+    }
+
+    // A large generated file, closer to the legacy driver sources knots is run on
+    let large = corpus::synthetic_file(0, 200, 30, 4);
+    group.throughput(Throughput::Bytes(large.len() as u64));
+    group.bench_with_input(BenchmarkId::new("synthetic", "200_functions"), large.as_bytes(), |b, source| {
+        b.iter(|| measure_file(black_box(source)))
+    });
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_kernels, bench_files);
+criterion_main!(benches);
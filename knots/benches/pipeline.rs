@@ -0,0 +1,72 @@
+// End-to-end benchmark: `knots -r` over a generated multi-thousand-file corpus
+//
+// Run with `cargo bench -p knots --bench pipeline`. The corpus is generated once
+// under Cargo's per-target temporary directory and reused by later runs.
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::process::Command;
+use std::time::Duration;
+
+mod corpus;
+
+const CORPUS_FILES: usize = 3000;
+const FUNCTIONS_PER_FILE: usize = 12;
+/// Bump when the generator changes so stale corpora are rebuilt
+const CORPUS_VERSION: &str = "1";
+
+/// Generate (or reuse) the corpus, spread over nested directories like a real tree
+fn corpus_dir() -> PathBuf {
+    let root = Path::new(env!("CARGO_TARGET_TMPDIR")).join("knots-bench-corpus");
+    let marker = root.join(".corpus-version");
+    let expected = format!("{} {} {}", CORPUS_VERSION, CORPUS_FILES, FUNCTIONS_PER_FILE);
+    if fs::read_to_string(&marker).is_ok_and(|v| v == expected) {
+        return root;
+    }
+
+    let _ = fs::remove_dir_all(&root);
+    for i in 0..CORPUS_FILES {
+        let dir = root.join(format!("module_{:02}/sub_{:02}", i % 40, (i / 40) % 10));
+        fs::create_dir_all(&dir).expect("create corpus directory");
+        let source = corpus::synthetic_file(i, FUNCTIONS_PER_FILE, 10, 3);
+        fs::write(dir.join(format!("file_{}.c", i)), source).expect("write corpus file");
+    }
+    fs::write(&marker, expected).expect("write corpus marker");
+    root
+}
+
+fn bench_recursive(c: &mut Criterion) {
+    let corpus = corpus_dir();
+    // report.txt is written to the working directory; keep it out of the corpus
+    let work_dir = Path::new(env!("CARGO_TARGET_TMPDIR")).join("knots-bench-work");
+    fs::create_dir_all(&work_dir).expect("create work directory");
+
+    let mut group = c.benchmark_group("pipeline");
+    group.sample_size(10).measurement_time(Duration::from_secs(30));
+    group.throughput(Throughput::Elements(CORPUS_FILES as u64));
+
+    for jobs in [1, 0] {
+        let label = if jobs == 0 { "all_cpus".to_string() } else { format!("{}_job", jobs) };
+        group.bench_with_input(BenchmarkId::new("recursive", label), &jobs, |b, &jobs| {
+            b.iter(|| {
+                let output = Command::new(env!("CARGO_BIN_EXE_knots"))
+                    .arg("-r")
+                    .arg(&corpus)
+                    // The corpus lives under the gitignored target/ directory
+                    .arg("--no-ignore")
+                    .arg("--jobs")
+                    .arg(jobs.to_string())
+                    .current_dir(&work_dir)
+                    .output()
+                    .expect("run knots");
+                assert!(output.status.success(), "knots failed: {}", String::from_utf8_lossy(&output.stderr));
+            })
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_recursive);
+criterion_main!(benches);
@@ -0,0 +1,291 @@
+// Embeddable analysis API: function discovery, measurement and filtering
+
+use anyhow::{Context, Result};
+use serde::{Deserialize, Serialize};
+use std::path::Path;
+use tree_sitter::{Node, Parser, Tree, TreeCursor};
+
+use crate::columnar::ColumnarRow;
+use crate::complexity::{calculate_all_metrics, TestScoringMetric};
+use crate::filter::{should_process_file, should_process_function, FilterRules};
+use crate::parser::new_c_parser;
+use crate::source::SourceReader;
+use crate::syntax::{walk_preorder, CSyntax, KindClass};
+
+/// Metrics for one named function definition
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct FunctionMetrics {
+    pub name: String,
+    /// The file the function was found in; empty until the metrics are filtered for a file
+    #[serde(skip)]
+    pub file_path: String,
+    pub mccabe: u32,
+    pub cognitive: u32,
+    pub nesting: u32,
+    pub sloc: u32,
+    pub abc_magnitude: f64,
+    pub return_count: u32,
+    pub test_scoring: TestScoringMetric,
+}
+
+impl FunctionMetrics {
+    /// The larger of McCabe and cognitive complexity, used for ranking and filtering
+    pub fn max_complexity(&self) -> u32 {
+        std::cmp::max(self.mccabe, self.cognitive)
+    }
+
+    /// This function as a row for `ColumnarWriter`
+    pub fn columnar_row(&self) -> ColumnarRow<'_> {
+        ColumnarRow {
+            name: &self.name,
+            file_path: &self.file_path,
+            mccabe: self.mccabe,
+            cognitive: self.cognitive,
+            nesting: self.nesting,
+            sloc: self.sloc,
+            abc_magnitude: self.abc_magnitude,
+            return_count: self.return_count,
+            test_scoring: self.test_scoring,
+        }
+    }
+}
+
+/// A reusable, single-threaded analysis context for embedding knots.
+///
+/// A session owns a C parser, the compiled filter rules and a read buffer, all reused
+/// from one file to the next. Create one per thread; each `knots serve` worker owns one.
+pub struct AnalysisSession {
+    parser: Parser,
+    reader: SourceReader,
+    include_rules: Option<FilterRules>,
+    exclude_rules: Option<FilterRules>,
+}
+
+impl AnalysisSession {
+    /// A session that measures every function
+    pub fn new() -> Result<Self> {
+        Self::with_filters(None, None)
+    }
+
+    /// A session that applies include/exclude rules (already compiled, e.g. by
+    /// `FilterRules::from_file`) to files and functions
+    pub fn with_filters(include_rules: Option<FilterRules>, exclude_rules: Option<FilterRules>) -> Result<Self> {
+        Ok(Self {
+            parser: new_c_parser()?,
+            reader: SourceReader::new(),
+            include_rules,
+            exclude_rules,
+        })
+    }
+
+    pub fn include_rules(&self) -> &Option<FilterRules> {
+        &self.include_rules
+    }
+
+    pub fn exclude_rules(&self) -> &Option<FilterRules> {
+        &self.exclude_rules
+    }
+
+    /// Whether the file rules let `path` be analyzed at all
+    pub fn accepts_file(&self, path: &str) -> bool {
+        should_process_file(path, &self.include_rules, &self.exclude_rules)
+    }
+
+    /// Read, parse and measure a file. Returns None if the file rules exclude it.
+    pub fn analyze_path(&mut self, path: &Path) -> Result<Option<Vec<FunctionMetrics>>> {
+        let file_path = path.to_string_lossy();
+        if !self.accepts_file(&file_path) {
+            return Ok(None);
+        }
+
+        let source_code = self
+            .reader
+            .read(path)
+            .with_context(|| format!("Failed to read file: {}", path.display()))?;
+        let tree = self.parser.parse(&*source_code, None);
+        self.parser.reset();
+        let tree = tree.with_context(|| format!("Failed to parse C code in {}", path.display()))?;
+
+        let functions = measure_functions(&tree, &source_code);
+        Ok(Some(filter_function_metrics(functions, &file_path, &self.include_rules, &self.exclude_rules)))
+    }
+
+    /// Parse and measure source that is already in memory, such as an unsaved editor
+    /// buffer. `file_path` is recorded in the results and matched by the function rules,
+    /// but the file rules are not applied.
+    pub fn analyze_bytes(&mut self, source_code: &[u8], file_path: &str) -> Result<Vec<FunctionMetrics>> {
+        let tree = self.parser.parse(source_code, None);
+        self.parser.reset();
+        let tree = tree.with_context(|| format!("Failed to parse C code in {}", file_path))?;
+
+        Ok(self.analyze_tree(&tree, source_code, file_path))
+    }
+
+    /// Measure an already-parsed tree
+    pub fn analyze_tree(&self, tree: &Tree, source_code: &[u8], file_path: &str) -> Vec<FunctionMetrics> {
+        filter_function_metrics(measure_functions(tree, source_code), file_path, &self.include_rules, &self.exclude_rules)
+    }
+}
+
+/// Measure every function in a file, before filtering and without a file path
+pub fn measure_functions(tree: &Tree, source_code: &[u8]) -> Vec<FunctionMetrics> {
+    let root_node = tree.root_node();
+    let mut cursor = root_node.walk();
+    let mut metrics = Vec::new();
+
+    visit_functions(&mut cursor, source_code, &mut |node, src| {
+        metrics.extend(measure_function(node, src));
+    });
+
+    metrics
+}
+
+/// Metrics for one function definition, or None if it has no recognizable name
+pub fn measure_function(node: Node, source_code: &[u8]) -> Option<FunctionMetrics> {
+    let name = function_name(node, source_code)?;
+    let complexity = calculate_all_metrics(node, source_code);
+
+    Some(FunctionMetrics {
+        name,
+        file_path: String::new(),
+        mccabe: complexity.mccabe,
+        cognitive: complexity.cognitive,
+        nesting: complexity.nesting,
+        sloc: complexity.sloc,
+        abc_magnitude: complexity.abc.magnitude(),
+        return_count: complexity.return_count,
+        test_scoring: complexity.test_scoring,
+    })
+}
+
+/// Keep the functions the rules accept, stamped with `file_path`
+pub fn filter_function_metrics(
+    metrics: Vec<FunctionMetrics>,
+    file_path: &str,
+    include_rules: &Option<FilterRules>,
+    exclude_rules: &Option<FilterRules>,
+) -> Vec<FunctionMetrics> {
+    metrics
+        .into_iter()
+        .filter(|func| should_process_function(&func.name, func.max_complexity(), include_rules, exclude_rules))
+        .map(|mut func| {
+            func.file_path = file_path.to_string();
+            func
+        })
+        .collect()
+}
+
+/// Call `callback` for every function definition under the cursor's node, including
+/// nested ones
+pub fn visit_functions<F>(cursor: &mut TreeCursor, source_code: &[u8], callback: &mut F)
+where
+    F: FnMut(Node, &[u8]),
+{
+    let syntax = CSyntax::get();
+    // Nothing is inherited, and a stack of () never allocates
+    let mut ancestors = Vec::new();
+    walk_preorder(cursor, &mut (), &mut ancestors, |cursor, _| {
+        let node = cursor.node();
+        if syntax.class(node.kind_id()).contains(KindClass::FUNCTION_DEFINITION) {
+            callback(node, source_code);
+        }
+    });
+}
+
+/// The name of a function definition, looking through pointer declarators for
+/// functions that return pointers
+pub fn function_name(node: Node, source_code: &[u8]) -> Option<String> {
+    let mut cursor = node.walk();
+
+    for child in node.children(&mut cursor) {
+        if child.kind() == "function_declarator" {
+            return get_declarator_name(child, source_code);
+        } else if child.kind() == "pointer_declarator" {
+            // For functions returning pointers, the function_declarator is nested inside
+            if let Some(name) = get_function_name_from_declarator(child, source_code) {
+                return Some(name);
+            }
+        }
+    }
+
+    None
+}
+
+fn get_function_name_from_declarator(node: Node, source_code: &[u8]) -> Option<String> {
+    let mut cursor = node.walk();
+
+    for child in node.children(&mut cursor) {
+        if child.kind() == "function_declarator" {
+            return get_declarator_name(child, source_code);
+        } else if child.kind() == "pointer_declarator" {
+            if let Some(name) = get_function_name_from_declarator(child, source_code) {
+                return Some(name);
+            }
+        }
+    }
+
+    None
+}
+
+fn get_declarator_name(node: Node, source_code: &[u8]) -> Option<String> {
+    let mut cursor = node.walk();
+
+    for child in node.children(&mut cursor) {
+        if child.kind() == "identifier" {
+            // Names are the only text we decode; tolerate non-UTF-8 bytes
+            return Some(String::from_utf8_lossy(&source_code[child.byte_range()]).into_owned());
+        } else if child.kind() == "pointer_declarator" || child.kind() == "function_declarator" {
+            if let Some(name) = get_declarator_name(child, source_code) {
+                return Some(name);
+            }
+        }
+    }
+
+    None
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn rules(json: &str) -> FilterRules {
+        let mut rules: FilterRules = serde_json::from_str(json).unwrap();
+        rules.compile().unwrap();
+        rules
+    }
+
+    #[test]
+    fn test_session_filters_and_stamps_paths() {
+        let source = b"int parse_header(int x) { if (x) { return 1; } return 0; }\nvoid helper(void) {}\n";
+
+        let mut session = AnalysisSession::new().unwrap();
+        let all = session.analyze_bytes(source, "src/a.c").unwrap();
+        let names: Vec<_> = all.iter().map(|f| (f.name.as_str(), f.file_path.as_str())).collect();
+        assert_eq!(names, vec![("parse_header", "src/a.c"), ("helper", "src/a.c")]);
+        assert_eq!(all[0].mccabe, 2);
+
+        let include = rules(r#"{"function_patterns": ["^parse_"]}"#);
+        let exclude = rules(r#"{"file_patterns": ["vendor/**"]}"#);
+        let mut session = AnalysisSession::with_filters(Some(include), Some(exclude)).unwrap();
+        let kept = session.analyze_bytes(source, "src/a.c").unwrap();
+        assert_eq!(kept.len(), 1);
+        assert_eq!((kept[0].name.as_str(), kept[0].file_path.as_str()), ("parse_header", "src/a.c"));
+
+        // Excluded files are not read at all, so this one need not exist
+        assert!(session.analyze_path(Path::new("vendor/missing.c")).unwrap().is_none());
+        assert!(!session.accepts_file("vendor/lib.c"));
+        let error = session.analyze_path(Path::new("src/missing.c")).unwrap_err();
+        assert!(format!("{:#}", error).contains("Failed to read file: src/missing.c"));
+
+        // Syntax errors are recovered from rather than failing the file: the functions
+        // around a broken one are still found
+        let broken = b"int parse_a(void) { return 1; }\nint parse_b(void) { return 2 }\nint parse_c(void) { return 3; }\n";
+        let names: Vec<_> = session
+            .analyze_bytes(broken, "src/b.c")
+            .unwrap()
+            .into_iter()
+            .map(|f| f.name)
+            .collect();
+        assert!(names.contains(&"parse_a".to_string()) && names.contains(&"parse_c".to_string()));
+    }
+}
@@ -0,0 +1,416 @@
+// Complexity baselines: --save-baseline snapshots every function's metrics keyed by
+// file, name and a hash of its normalized text, and --compare-baseline reports only the
+// functions that got worse, recognizing unchanged files and functions by hash
+
+use anyhow::{Context, Result};
+use serde::{Deserialize, Serialize};
+use std::collections::{BTreeMap, HashMap};
+use std::fs;
+use std::io::{BufReader, BufWriter, Write};
+use std::path::{Path, PathBuf};
+use tree_sitter::Node;
+use xxhash_rust::xxh3::Xxh3;
+
+use knots::analysis::{function_name, measure_function, visit_functions, FunctionMetrics};
+use knots::filter::should_process_function;
+
+use crate::cache::MetricsCache;
+use crate::pipeline::{self, PipelineConfig};
+use crate::timings::Phase;
+
+/// Unfiltered metrics of every function of a run, by file
+#[derive(Serialize, Deserialize)]
+pub struct Baseline {
+    version: String,
+    /// Keyed by path as discovered when the baseline was saved
+    files: BTreeMap<String, BaselineFile>,
+}
+
+#[derive(Serialize, Deserialize)]
+struct BaselineFile {
+    content_hash: String,
+    functions: Vec<BaselineFunction>,
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+struct BaselineFunction {
+    body_hash: String,
+    #[serde(flatten)]
+    metrics: FunctionMetrics,
+}
+
+impl Baseline {
+    pub fn load(path: &Path) -> Result<Self> {
+        let file = fs::File::open(path).with_context(|| format!("Failed to open baseline: {}", path.display()))?;
+        serde_json::from_reader(BufReader::new(file)).with_context(|| format!("Failed to read baseline: {}", path.display()))
+    }
+
+    fn write(&self, path: &Path) -> Result<()> {
+        let file = fs::File::create(path).with_context(|| format!("Failed to create baseline: {}", path.display()))?;
+        let mut out = BufWriter::new(file);
+        serde_json::to_writer(&mut out, self)?;
+        out.flush().with_context(|| format!("Failed to write baseline: {}", path.display()))
+    }
+
+    fn function_count(&self) -> usize {
+        self.files.values().map(|file| file.functions.len()).sum()
+    }
+}
+
+/// Analyze `files` and save every function's metrics and body hash to `path`
+pub fn save(files: &[PathBuf], path: &Path, jobs: usize, config: &PipelineConfig) -> Result<()> {
+    let mut baseline = Baseline {
+        version: env!("CARGO_PKG_VERSION").to_string(),
+        files: BTreeMap::new(),
+    };
+    let mut skipped_files = 0;
+
+    let work = |reader: &mut knots::source::SourceReader, file: &PathBuf| -> Result<Result<BaselineFile, String>> {
+        let source_code = match reader.read(file) {
+            Ok(code) => code,
+            Err(e) => return Ok(Err(format!("Skipping {}: {}", file.display(), e))),
+        };
+        let mut functions = Vec::new();
+        let parsed = config.limits.visit_trees(&source_code, |tree, piece| {
+            visit_functions(&mut tree.walk(), piece, &mut |node, source| {
+                if let Some(metrics) = measure_function(node, source) {
+                    functions.push(BaselineFunction {
+                        body_hash: body_hash(node, source),
+                        metrics,
+                    });
+                }
+            });
+        })?;
+        if let Err(reason) = parsed {
+            return Ok(Err(format!("Skipping {}: {}", file.display(), reason)));
+        }
+        Ok(Ok(BaselineFile {
+            content_hash: MetricsCache::content_key(&source_code),
+            functions,
+        }))
+    };
+
+    let mut next_file = files.iter();
+    pipeline::for_each_file(files, jobs, work, |outcome| {
+        let file = next_file.next().expect("one outcome per file");
+        match outcome {
+            Ok(entry) => {
+                baseline.files.insert(file.to_string_lossy().into_owned(), entry);
+            }
+            Err(warning) => {
+                eprintln!("Warning: {}", warning);
+                skipped_files += 1;
+            }
+        }
+        Ok(())
+    })?;
+
+    config.timings.time(Phase::Report, || baseline.write(path))?;
+    println!(
+        "Saved baseline of {} functions in {} files to {} ({} files skipped)",
+        baseline.function_count(),
+        baseline.files.len(),
+        path.display(),
+        skipped_files
+    );
+    Ok(())
+}
+
+/// How a current function relates to the baseline
+#[derive(Debug)]
+enum Change {
+    /// Same file, name and body hash; its metrics were not recomputed
+    Unchanged,
+    /// Same body as a baseline function under another name or in another file
+    Moved { name: String, from: String },
+    /// Same file and name, different body
+    Modified { name: String, regressions: Vec<Regression> },
+    New { name: String },
+}
+
+/// One metric of one function that got worse
+#[derive(Debug, PartialEq)]
+struct Regression {
+    metric: &'static str,
+    before: i64,
+    after: i64,
+}
+
+/// What comparing one file against the baseline found
+enum FileComparison {
+    /// Identical contents, so every function is unchanged; the file was not parsed
+    Identical(usize),
+    Compared(Vec<Change>),
+    Skipped(String),
+}
+
+/// Totals of a baseline comparison
+#[derive(Debug, Default)]
+pub struct ComparisonSummary {
+    pub unchanged: usize,
+    pub modified: usize,
+    pub moved: usize,
+    pub new: usize,
+    pub regressed: usize,
+    pub skipped_files: usize,
+}
+
+/// Compare `files` against the baseline at `path`, printing only the functions whose
+/// McCabe, cognitive or test score got worse
+pub fn compare(files: &[PathBuf], path: &Path, jobs: usize, config: &PipelineConfig, verbose: bool) -> Result<ComparisonSummary> {
+    let baseline = Baseline::load(path)?;
+
+    // Body hash -> (file, index) of every baseline function, for renames and moves
+    let mut by_hash: HashMap<&str, (&str, usize)> = HashMap::new();
+    for (file, entry) in &baseline.files {
+        for (index, func) in entry.functions.iter().enumerate() {
+            by_hash.entry(func.body_hash.as_str()).or_insert((file.as_str(), index));
+        }
+    }
+
+    let work = |reader: &mut knots::source::SourceReader, file: &PathBuf| -> Result<FileComparison> {
+        let source_code = match reader.read(file) {
+            Ok(code) => code,
+            Err(e) => return Ok(FileComparison::Skipped(format!("Skipping {}: {}", file.display(), e))),
+        };
+        let old = baseline.files.get(file.to_string_lossy().as_ref());
+        if let Some(old) = old.filter(|old| old.content_hash == MetricsCache::content_key(&source_code)) {
+            return Ok(FileComparison::Identical(old.functions.len()));
+        }
+
+        let mut changes = Vec::new();
+        let parsed = config.limits.visit_trees(&source_code, |tree, piece| {
+            visit_functions(&mut tree.walk(), piece, &mut |node, source| {
+                changes.extend(compare_function(node, source, old, &baseline, &by_hash, config));
+            });
+        })?;
+        if let Err(reason) = parsed {
+            return Ok(FileComparison::Skipped(format!("Skipping {}: {}", file.display(), reason)));
+        }
+        Ok(FileComparison::Compared(changes))
+    };
+
+    let mut summary = ComparisonSummary::default();
+    let mut next_file = files.iter();
+    pipeline::for_each_file(files, jobs, work, |comparison| {
+        let file = next_file.next().expect("one outcome per file");
+        let changes = match comparison {
+            FileComparison::Identical(count) => {
+                summary.unchanged += count;
+                return Ok(());
+            }
+            FileComparison::Skipped(warning) => {
+                eprintln!("Warning: {}", warning);
+                summary.skipped_files += 1;
+                return Ok(());
+            }
+            FileComparison::Compared(changes) => changes,
+        };
+
+        let mut printed_file = false;
+        for change in &changes {
+            let show = match change {
+                Change::Unchanged => {
+                    summary.unchanged += 1;
+                    false
+                }
+                Change::Moved { .. } => {
+                    summary.moved += 1;
+                    verbose
+                }
+                Change::New { .. } => {
+                    summary.new += 1;
+                    verbose
+                }
+                Change::Modified { regressions, .. } => {
+                    summary.modified += 1;
+                    if !regressions.is_empty() {
+                        summary.regressed += 1;
+                    }
+                    !regressions.is_empty()
+                }
+            };
+            if !show {
+                continue;
+            }
+
+            if !printed_file {
+                println!("✗ {}", file.display());
+                printed_file = true;
+            }
+            match change {
+                Change::Moved { name, from } => println!("  Moved: {} (was {})", name, from),
+                Change::New { name } => println!("  New: {}", name),
+                Change::Modified { name, regressions } => {
+                    println!("  Function: {}", name);
+                    for regression in regressions {
+                        println!("    {}: {} -> {}", regression.metric, regression.before, regression.after);
+                    }
+                }
+                Change::Unchanged => unreachable!("unchanged functions are not shown"),
+            }
+        }
+        Ok(())
+    })?;
+
+    if summary.regressed > 0 {
+        println!();
+    }
+    println!(
+        "Found {} regressed function(s) against {}: {} unchanged, {} modified, {} moved or renamed, {} new",
+        summary.regressed,
+        path.display(),
+        summary.unchanged,
+        summary.modified,
+        summary.moved,
+        summary.new
+    );
+    if summary.skipped_files > 0 {
+        println!("Could not analyze {} file(s)", summary.skipped_files);
+    }
+
+    Ok(summary)
+}
+
+/// Classify one current function. Metrics are only computed when no baseline function
+/// has the same body; None for unnamed or filtered-out functions.
+fn compare_function(
+    node: Node,
+    source: &[u8],
+    old_file: Option<&BaselineFile>,
+    baseline: &Baseline,
+    by_hash: &HashMap<&str, (&str, usize)>,
+    config: &PipelineConfig,
+) -> Option<Change> {
+    let name = function_name(node, source)?;
+    let hash = body_hash(node, source);
+
+    let same_name: Vec<&BaselineFunction> = old_file
+        .map(|file| file.functions.iter().filter(|func| func.metrics.name == name).collect())
+        .unwrap_or_default();
+    if same_name.iter().any(|func| func.body_hash == hash) {
+        return Some(Change::Unchanged);
+    }
+
+    // A body seen anywhere in the baseline has that function's metrics
+    let moved_from = by_hash.get(hash.as_str()).map(|&(file, index)| (file, &baseline.files[file].functions[index]));
+    let current = match moved_from {
+        Some((_, func)) => FunctionMetrics { name: name.clone(), ..func.metrics.clone() },
+        None => measure_function(node, source)?,
+    };
+    if !should_process_function(&name, current.max_complexity(), config.include_rules, config.exclude_rules) {
+        return None;
+    }
+
+    Some(match (same_name.first(), moved_from) {
+        (Some(old), _) => Change::Modified {
+            name,
+            regressions: regressions(&old.metrics, &current),
+        },
+        (None, Some((file, func))) => Change::Moved {
+            name,
+            from: format!("{} in {}", func.metrics.name, file),
+        },
+        (None, None) => Change::New { name },
+    })
+}
+
+/// The tracked metrics that are higher (worse) in `after` than in `before`
+fn regressions(before: &FunctionMetrics, after: &FunctionMetrics) -> Vec<Regression> {
+    let tracked = [
+        ("McCabe Complexity", before.mccabe as i64, after.mccabe as i64),
+        ("Cognitive Complexity", before.cognitive as i64, after.cognitive as i64),
+        (
+            "Test Score",
+            before.test_scoring.total_score as i64,
+            after.test_scoring.total_score as i64,
+        ),
+    ];
+    tracked
+        .into_iter()
+        .filter(|(_, before, after)| after > before)
+        .map(|(metric, before, after)| Regression { metric, before, after })
+        .collect()
+}
+
+/// Hash of a function's text and the comment directly before it (which the
+/// documentation score reads), with each line trimmed, blank lines dropped and the
+/// function's own name left out. Reindenting, adding blank lines, renaming or moving a
+/// function keeps its hash; any edit that can change a metric does not.
+fn body_hash(node: Node, source: &[u8]) -> String {
+    let mut hasher = Xxh3::new();
+
+    if let Some(comment) = node.prev_sibling().filter(|sibling| sibling.kind() == "comment") {
+        hash_lines(&mut hasher, &source[comment.byte_range()]);
+    }
+    hasher.update(b"\0");
+
+    let text = node.byte_range();
+    match name_range(node) {
+        Some(name) => {
+            hash_lines(&mut hasher, &source[text.start..name.start]);
+            hasher.update(b"\0");
+            hash_lines(&mut hasher, &source[name.end..text.end]);
+        }
+        None => hash_lines(&mut hasher, &source[text]),
+    }
+
+    format!("{:016x}", hasher.digest())
+}
+
+fn hash_lines(hasher: &mut Xxh3, text: &[u8]) {
+    for line in text.split(|&b| b == b'\n') {
+        let trimmed = line.trim_ascii();
+        if !trimmed.is_empty() {
+            hasher.update(trimmed);
+            hasher.update(b"\n");
+        }
+    }
+}
+
+/// Byte range of the name in a function definition's declarator chain
+fn name_range(node: Node) -> Option<std::ops::Range<usize>> {
+    let mut declarator = node.child_by_field_name("declarator")?;
+    while declarator.kind() != "identifier" {
+        declarator = declarator.child_by_field_name("declarator")?;
+    }
+    Some(declarator.byte_range())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use knots::complexity::TestScoringMetric;
+
+    fn metrics(mccabe: u32, cognitive: u32, total_score: i32) -> FunctionMetrics {
+        FunctionMetrics {
+            name: "parse".to_string(),
+            file_path: String::new(),
+            mccabe,
+            cognitive,
+            nesting: 1,
+            sloc: 10,
+            abc_magnitude: 2.0,
+            return_count: 1,
+            test_scoring: TestScoringMetric { total_score, ..Default::default() },
+        }
+    }
+
+    #[test]
+    fn test_only_worse_metrics_are_regressions() {
+        let found = regressions(&metrics(5, 8, 6), &metrics(7, 3, 9));
+        let names: Vec<_> = found.iter().map(|r| r.metric).collect();
+        assert_eq!(names, vec!["McCabe Complexity", "Test Score"]);
+        assert_eq!(found[1], Regression { metric: "Test Score", before: 6, after: 9 });
+        assert!(regressions(&metrics(5, 8, 6), &metrics(5, 8, 6)).is_empty());
+
+        // Normalization ignores indentation and blank lines but not content
+        let hash = |text: &[u8]| {
+            let mut hasher = Xxh3::new();
+            hash_lines(&mut hasher, text);
+            hasher.digest()
+        };
+        assert_eq!(hash(b"{\n    return 1;\n}\n"), hash(b"{\n\n\treturn 1;   \n}"));
+        assert_ne!(hash(b"{\n    return 1;\n}\n"), hash(b"{\n    return 2;\n}\n"));
+    }
+}
@@ -0,0 +1,150 @@
+// Persistent on-disk metrics cache keyed by file content hash and knots version
+
+use anyhow::{Context, Result};
+use serde::{Deserialize, Serialize};
+use std::fs;
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
+use xxhash_rust::xxh3::xxh3_128;
+
+use knots::analysis::FunctionMetrics;
+use knots::catalog::ApiCatalog;
+
+/// Unique suffix for temporary entry files written by this process
+static NEXT_TEMP_ID: AtomicU64 = AtomicU64::new(0);
+
+/// Cached, unfiltered metrics for one file's contents
+#[derive(Debug, Serialize, Deserialize)]
+struct CacheEntry {
+    version: String,
+    content_hash: String,
+    functions: Vec<FunctionMetrics>,
+}
+
+/// On-disk cache of per-file function metrics.
+///
+/// Entries live under `<dir>/knots-<version>/<xx>/<hash>.json`, so upgrading knots never
+/// reuses stale results. Runs with a custom API catalog use `knots-<version>-api-<id>`
+/// instead, since the catalog changes the test scores. Entries are written to a temporary
+/// file and renamed into place, which keeps the cache safe to share between concurrent CI
+/// jobs: readers only ever see complete entries, and a corrupt or missing entry is
+/// treated as a miss.
+pub struct MetricsCache {
+    root: PathBuf,
+}
+
+impl MetricsCache {
+    /// Open (and create if needed) the cache rooted at `dir`
+    pub fn open(dir: &Path) -> Result<Self> {
+        let root = match ApiCatalog::get().fingerprint() {
+            Some(catalog) => dir.join(format!("knots-{}-api-{:016x}", env!("CARGO_PKG_VERSION"), catalog)),
+            None => dir.join(format!("knots-{}", env!("CARGO_PKG_VERSION"))),
+        };
+        fs::create_dir_all(&root)
+            .with_context(|| format!("Failed to create cache directory: {}", root.display()))?;
+        Ok(Self { root })
+    }
+
+    /// Cache key for a file's contents
+    pub fn content_key(content: &[u8]) -> String {
+        format!("{:032x}", xxh3_128(content))
+    }
+
+    /// Load the cached metrics for `key`, if present and valid
+    pub fn load(&self, key: &str) -> Option<Vec<FunctionMetrics>> {
+        let data = fs::read(self.entry_path(key)).ok()?;
+        let entry: CacheEntry = serde_json::from_slice(&data).ok()?;
+
+        if entry.version != env!("CARGO_PKG_VERSION") || entry.content_hash != key {
+            return None;
+        }
+
+        Some(entry.functions)
+    }
+
+    /// Store the unfiltered metrics for `key`
+    pub fn store(&self, key: &str, functions: &[FunctionMetrics]) -> Result<()> {
+        let path = self.entry_path(key);
+        let dir = path.parent().expect("cache entries always have a shard directory");
+        fs::create_dir_all(dir)
+            .with_context(|| format!("Failed to create cache directory: {}", dir.display()))?;
+
+        let entry = CacheEntry {
+            version: env!("CARGO_PKG_VERSION").to_string(),
+            content_hash: key.to_string(),
+            functions: functions.to_vec(),
+        };
+
+        let temp_path = dir.join(format!(
+            "{}.{}.{}.tmp",
+            key,
+            std::process::id(),
+            NEXT_TEMP_ID.fetch_add(1, Ordering::Relaxed)
+        ));
+
+        let write_result = (|| -> Result<()> {
+            let mut file = fs::File::create(&temp_path)?;
+            file.write_all(&serde_json::to_vec(&entry)?)?;
+            file.sync_all()?;
+            fs::rename(&temp_path, &path)?;
+            Ok(())
+        })();
+
+        if write_result.is_err() {
+            let _ = fs::remove_file(&temp_path);
+        }
+
+        write_result.with_context(|| format!("Failed to write cache entry: {}", path.display()))
+    }
+
+    fn entry_path(&self, key: &str) -> PathBuf {
+        self.root.join(&key[..2]).join(format!("{}.json", key))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use knots::complexity::TestScoringMetric;
+
+    fn sample_metrics() -> FunctionMetrics {
+        FunctionMetrics {
+            name: "process".to_string(),
+            file_path: String::new(),
+            mccabe: 7,
+            cognitive: 9,
+            nesting: 3,
+            sloc: 42,
+            abc_magnitude: 12.449899597988733,
+            return_count: 2,
+            test_scoring: TestScoringMetric {
+                signature_score: 4,
+                dependency_score: 2,
+                observable_score: 0,
+                implementation_score: 3,
+                documentation_score: 2,
+                total_score: 7,
+            },
+        }
+    }
+
+    #[test]
+    fn test_cache_roundtrip() {
+        let dir = std::env::temp_dir().join(format!("knots-cache-test-{}", std::process::id()));
+        let cache = MetricsCache::open(&dir).unwrap();
+        let key = MetricsCache::content_key(b"int main(void) { return 0; }");
+
+        assert!(cache.load(&key).is_none());
+        cache.store(&key, &[sample_metrics()]).unwrap();
+
+        let loaded = cache.load(&key).unwrap();
+        assert_eq!(loaded.len(), 1);
+        assert_eq!(loaded[0].name, "process");
+        assert_eq!(loaded[0].sloc, 42);
+        assert_eq!(loaded[0].abc_magnitude.to_bits(), sample_metrics().abc_magnitude.to_bits());
+        assert_eq!(loaded[0].test_scoring.total_score, 7);
+
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
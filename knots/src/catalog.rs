@@ -0,0 +1,277 @@
+// Catalog of API functions and their side effects, which feeds the dependency and
+// observable behavior scores, loadable from JSON so project-specific APIs (RTOS
+// queues, HAL drivers) count like the C library calls built in
+
+use anyhow::{bail, Context, Result};
+use serde::{Deserialize, Serialize};
+use std::collections::{BTreeMap, HashMap};
+use std::fs;
+use std::path::Path;
+use std::sync::OnceLock;
+use xxhash_rust::xxh3::xxh3_64;
+
+/// Side effects of calling a function, as a set of flags
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct Effects(u8);
+
+impl Effects {
+    pub const NONE: Self = Self(0);
+    /// Reads or writes files or standard streams (dependency score)
+    pub const IO: Self = Self(1 << 0);
+    /// Allocates or frees memory (dependency score)
+    pub const ALLOCATION: Self = Self(1 << 1);
+    /// Talks to the operating system (dependency score)
+    pub const SYSTEM_CALL: Self = Self(1 << 2);
+    /// I/O whose results a test has to capture (observable behavior score)
+    pub const OBSERVABLE_IO: Self = Self(1 << 3);
+    /// Depends on random numbers (observable behavior score)
+    pub const RANDOM: Self = Self(1 << 4);
+    /// Depends on the clock (observable behavior score)
+    pub const TIME: Self = Self(1 << 5);
+
+    pub const fn union(self, other: Self) -> Self {
+        Self(self.0 | other.0)
+    }
+
+    /// Whether every flag of `other` is set
+    #[inline]
+    pub fn contains(self, other: Self) -> bool {
+        self.0 & other.0 == other.0
+    }
+}
+
+/// A side effect as named in catalog files
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+#[serde(rename_all = "snake_case")]
+pub enum Category {
+    Io,
+    Allocation,
+    SystemCall,
+    ObservableIo,
+    Random,
+    Time,
+}
+
+impl Category {
+    fn effects(self) -> Effects {
+        match self {
+            Category::Io => Effects::IO,
+            Category::Allocation => Effects::ALLOCATION,
+            Category::SystemCall => Effects::SYSTEM_CALL,
+            Category::ObservableIo => Effects::OBSERVABLE_IO,
+            Category::Random => Effects::RANDOM,
+            Category::Time => Effects::TIME,
+        }
+    }
+}
+
+const STREAM_IO: Effects = Effects::IO.union(Effects::OBSERVABLE_IO);
+
+/// The C library functions every catalog starts from, unless it opts out
+const DEFAULT_FUNCTIONS: &[(&str, Effects)] = &[
+    ("fopen", STREAM_IO),
+    ("fclose", STREAM_IO),
+    ("fread", STREAM_IO),
+    ("fwrite", STREAM_IO),
+    ("fprintf", STREAM_IO),
+    ("printf", STREAM_IO),
+    ("scanf", STREAM_IO),
+    ("puts", STREAM_IO),
+    ("fscanf", Effects::IO),
+    ("fgets", Effects::IO),
+    ("fputs", Effects::IO),
+    ("fseek", Effects::IO),
+    ("ftell", Effects::IO),
+    ("rewind", Effects::IO),
+    ("getc", Effects::IO),
+    ("putc", Effects::IO),
+    ("malloc", Effects::ALLOCATION),
+    ("calloc", Effects::ALLOCATION),
+    ("realloc", Effects::ALLOCATION),
+    ("free", Effects::ALLOCATION),
+    ("aligned_alloc", Effects::ALLOCATION),
+    ("time", Effects::SYSTEM_CALL.union(Effects::TIME)),
+    ("clock", Effects::SYSTEM_CALL.union(Effects::TIME)),
+    ("gettimeofday", Effects::TIME),
+    ("rand", Effects::SYSTEM_CALL.union(Effects::RANDOM)),
+    ("srand", Effects::SYSTEM_CALL.union(Effects::RANDOM)),
+    ("random", Effects::RANDOM),
+    ("getpid", Effects::SYSTEM_CALL),
+    ("fork", Effects::SYSTEM_CALL),
+    ("exec", Effects::SYSTEM_CALL),
+    ("system", Effects::SYSTEM_CALL),
+    ("signal", Effects::SYSTEM_CALL),
+    ("kill", Effects::SYSTEM_CALL),
+    ("wait", Effects::SYSTEM_CALL),
+    ("pipe", Effects::SYSTEM_CALL),
+];
+
+/// A catalog file
+#[derive(Debug, Deserialize)]
+#[serde(deny_unknown_fields)]
+struct CatalogFile {
+    /// Start from the built-in C library functions
+    #[serde(default = "default_true")]
+    include_defaults: bool,
+    /// Function names, or name prefixes ending in `*`, and their side effects. A name
+    /// listed with no categories has none, even if the built-in catalog gives it some.
+    #[serde(default)]
+    functions: BTreeMap<String, Vec<Category>>,
+}
+
+fn default_true() -> bool {
+    true
+}
+
+/// Function names mapped to their side effects, compiled for lookup by callee bytes
+#[derive(Debug, Clone)]
+pub struct ApiCatalog {
+    exact: HashMap<Box<[u8]>, Effects>,
+    prefixes: HashMap<Box<[u8]>, Effects>,
+    /// Distinct lengths of `prefixes`, shortest first
+    prefix_lens: Vec<usize>,
+    /// Identifies a loaded catalog's contents; `None` for the built-in one
+    fingerprint: Option<u64>,
+}
+
+static INSTALLED: OnceLock<ApiCatalog> = OnceLock::new();
+
+impl Default for ApiCatalog {
+    /// The built-in C library catalog
+    fn default() -> Self {
+        let exact = DEFAULT_FUNCTIONS
+            .iter()
+            .map(|&(name, effects)| (Box::from(name.as_bytes()), effects))
+            .collect();
+        Self {
+            exact,
+            prefixes: HashMap::new(),
+            prefix_lens: Vec::new(),
+            fingerprint: None,
+        }
+    }
+}
+
+impl ApiCatalog {
+    /// The catalog every metric walk of the process uses: the installed one, or the
+    /// built-in one if none was installed before first use
+    pub fn get() -> &'static ApiCatalog {
+        INSTALLED.get_or_init(ApiCatalog::default)
+    }
+
+    /// Make this the catalog of every later metric walk. Fails once `get` has been called,
+    /// since metrics measured before would disagree with those measured after.
+    pub fn install(self) -> Result<()> {
+        if INSTALLED.set(self).is_err() {
+            bail!("An API catalog is already in use");
+        }
+        Ok(())
+    }
+
+    /// Load a catalog from a JSON file
+    pub fn from_file(path: &Path) -> Result<Self> {
+        let content = fs::read_to_string(path)
+            .with_context(|| format!("Failed to read API catalog: {}", path.display()))?;
+        Self::from_json(&content).with_context(|| format!("Invalid API catalog: {}", path.display()))
+    }
+
+    /// Build a catalog from the contents of a catalog file
+    pub fn from_json(json: &str) -> Result<Self> {
+        let file: CatalogFile = serde_json::from_str(json)?;
+
+        let mut catalog = if file.include_defaults {
+            Self::default()
+        } else {
+            Self {
+                exact: HashMap::new(),
+                ..Self::default()
+            }
+        };
+
+        // The map is sorted, so equal catalogs hash equally however the file is written
+        let mut canonical = format!("defaults={}", file.include_defaults);
+        for (name, categories) in &file.functions {
+            let effects = categories
+                .iter()
+                .fold(Effects::NONE, |effects, category| effects.union(category.effects()));
+            canonical.push_str(&format!(";{}={}", name, effects.0));
+
+            match name.strip_suffix('*') {
+                Some("") => bail!("The prefix '*' would match every function"),
+                Some(prefix) => catalog.prefixes.insert(Box::from(prefix.as_bytes()), effects),
+                None => catalog.exact.insert(Box::from(name.as_bytes()), effects),
+            };
+        }
+
+        let mut prefix_lens: Vec<usize> = catalog.prefixes.keys().map(|prefix| prefix.len()).collect();
+        prefix_lens.sort_unstable();
+        prefix_lens.dedup();
+        catalog.prefix_lens = prefix_lens;
+        catalog.fingerprint = Some(xxh3_64(canonical.as_bytes()));
+        Ok(catalog)
+    }
+
+    /// Identifies a loaded catalog's contents, so cached metrics measured with another
+    /// catalog are not reused; `None` for the built-in catalog
+    pub fn fingerprint(&self) -> Option<u64> {
+        self.fingerprint
+    }
+
+    /// Side effects of calling `name`: its own entry if it has one, plus those of every
+    /// prefix it starts with. Costs one hash lookup per distinct prefix length.
+    #[inline]
+    pub fn lookup(&self, name: &[u8]) -> Effects {
+        let mut effects = self.exact.get(name).copied().unwrap_or_default();
+        for &len in self.prefix_lens.iter().take_while(|&&len| len <= name.len()) {
+            if let Some(&prefix_effects) = self.prefixes.get(&name[..len]) {
+                effects = effects.union(prefix_effects);
+            }
+        }
+        effects
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_catalog_extends_and_overrides_defaults() {
+        let builtin = ApiCatalog::default();
+        assert_eq!(builtin.lookup(b"printf"), Effects::IO.union(Effects::OBSERVABLE_IO));
+        assert_eq!(builtin.lookup(b"rand"), Effects::SYSTEM_CALL.union(Effects::RANDOM));
+        assert_eq!(builtin.lookup(b"xQueueSend"), Effects::NONE);
+        assert_eq!(builtin.fingerprint(), None);
+
+        let catalog = ApiCatalog::from_json(
+            r#"{
+                "functions": {
+                    "xQueueSend": ["io"],
+                    "HAL_UART_*": ["io", "observable_io"],
+                    "HAL_*": ["system_call"],
+                    "osDelay": ["time"],
+                    "free": []
+                }
+            }"#,
+        )
+        .unwrap();
+        assert_eq!(catalog.lookup(b"xQueueSend"), Effects::IO);
+        assert_eq!(catalog.lookup(b"osDelay"), Effects::TIME);
+        assert_eq!(catalog.lookup(b"HAL_GPIO_WritePin"), Effects::SYSTEM_CALL);
+        assert_eq!(
+            catalog.lookup(b"HAL_UART_Transmit"),
+            Effects::IO.union(Effects::OBSERVABLE_IO).union(Effects::SYSTEM_CALL)
+        );
+        assert_eq!(catalog.lookup(b"HAL"), Effects::NONE);
+        assert_eq!(catalog.lookup(b"free"), Effects::NONE);
+        assert_eq!(catalog.lookup(b"malloc"), Effects::ALLOCATION);
+        assert!(catalog.fingerprint().is_some());
+
+        let bare = ApiCatalog::from_json(r#"{"include_defaults": false, "functions": {"xQueueSend": ["io"]}}"#).unwrap();
+        assert_eq!(bare.lookup(b"printf"), Effects::NONE);
+        assert_ne!(bare.fingerprint(), catalog.fingerprint());
+
+        assert!(ApiCatalog::from_json(r#"{"functions": {"*": ["io"]}}"#).is_err());
+        assert!(ApiCatalog::from_json(r#"{"functions": {"f": ["network"]}}"#).is_err());
+    }
+}
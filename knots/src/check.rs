@@ -0,0 +1,168 @@
+// `knots check`: a threshold gate for hooks and CI that analyzes every file in one
+// process and prints only the functions that exceed a threshold
+
+use anyhow::Result;
+use std::path::PathBuf;
+
+use knots::analysis::FunctionMetrics;
+
+use crate::pipeline::{self, FileOutcome, PipelineConfig};
+
+/// Limits a function may reach; exceeding any one of them is a violation
+#[derive(Debug, Clone)]
+pub struct Thresholds {
+    pub mccabe: u32,
+    pub cognitive: u32,
+    pub nesting: u32,
+    pub sloc: u32,
+    pub abc: f64,
+    pub return_count: u32,
+}
+
+impl Thresholds {
+    /// Every metric of `func` over its threshold, in the order the hooks always reported them
+    pub fn violations(&self, func: &FunctionMetrics) -> Vec<Violation> {
+        let mut violations = Vec::new();
+        let mut check = |metric, over: bool, value: String, threshold: String| {
+            if over {
+                violations.push(Violation { metric, value, threshold });
+            }
+        };
+
+        check("McCabe Complexity", func.mccabe > self.mccabe, func.mccabe.to_string(), self.mccabe.to_string());
+        check("Cognitive Complexity", func.cognitive > self.cognitive, func.cognitive.to_string(), self.cognitive.to_string());
+        check("Nesting Depth", func.nesting > self.nesting, func.nesting.to_string(), self.nesting.to_string());
+        check("SLOC", func.sloc > self.sloc, func.sloc.to_string(), self.sloc.to_string());
+        check("ABC Magnitude", func.abc_magnitude > self.abc, format!("{:.2}", func.abc_magnitude), format!("{:.2}", self.abc));
+        check("Return Count", func.return_count > self.return_count, func.return_count.to_string(), self.return_count.to_string());
+
+        violations
+    }
+}
+
+/// One metric of one function over its threshold, formatted for display
+#[derive(Debug, PartialEq)]
+pub struct Violation {
+    pub metric: &'static str,
+    pub value: String,
+    pub threshold: String,
+}
+
+/// Totals of a check run
+#[derive(Debug, Default)]
+pub struct CheckSummary {
+    pub files: usize,
+    pub violations: usize,
+    /// Files that could not be read or parsed
+    pub failed_files: usize,
+}
+
+impl CheckSummary {
+    pub fn passed(&self) -> bool {
+        self.violations == 0 && self.failed_files == 0
+    }
+}
+
+/// Analyze `files` on `jobs` threads and print each file's violations in input order.
+/// With `verbose`, files without violations are listed too.
+pub fn run(
+    files: &[PathBuf],
+    thresholds: &Thresholds,
+    jobs: usize,
+    config: &PipelineConfig,
+    verbose: bool,
+) -> Result<CheckSummary> {
+    let mut summary = CheckSummary {
+        files: files.len(),
+        ..CheckSummary::default()
+    };
+
+    // Outcomes arrive in the same order as `files`
+    let mut next_file = files.iter();
+    pipeline::for_each_outcome(files, jobs, config, |outcome| {
+        let file = next_file.next().expect("one outcome per file");
+        match outcome {
+            FileOutcome::Analyzed(functions) => {
+                let mut file_has_violations = false;
+                for func in &functions {
+                    let violations = thresholds.violations(func);
+                    if violations.is_empty() {
+                        continue;
+                    }
+                    if !file_has_violations {
+                        println!("✗ {}", file.display());
+                        file_has_violations = true;
+                    }
+                    println!("  Function: {}", func.name);
+                    for violation in &violations {
+                        println!("    {}: {} (threshold: {})", violation.metric, violation.value, violation.threshold);
+                    }
+                    summary.violations += violations.len();
+                }
+
+                if verbose && !file_has_violations {
+                    println!("✓ {} ({} functions)", file.display(), functions.len());
+                }
+            }
+            FileOutcome::Skipped(warning) => {
+                println!("✗ {}", warning);
+                summary.failed_files += 1;
+            }
+            FileOutcome::Duplicate { original } => {
+                if verbose {
+                    println!("✓ {} (same as {})", file.display(), original.display());
+                }
+            }
+        }
+        Ok(())
+    })?;
+
+    if summary.violations > 0 {
+        println!();
+        println!("Found {} complexity violation(s)", summary.violations);
+    }
+    if summary.failed_files > 0 {
+        println!("Could not analyze {} file(s)", summary.failed_files);
+    }
+    if verbose && summary.passed() {
+        println!();
+        println!("✓ All complexity checks passed ({} files)", summary.files);
+    }
+
+    Ok(summary)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use knots::complexity::TestScoringMetric;
+
+    #[test]
+    fn test_violations_are_strictly_over_threshold() {
+        let thresholds = Thresholds {
+            mccabe: 15,
+            cognitive: 15,
+            nesting: 5,
+            sloc: 50,
+            abc: 10.0,
+            return_count: 3,
+        };
+        let func = FunctionMetrics {
+            name: "parse".to_string(),
+            file_path: String::new(),
+            mccabe: 16,
+            cognitive: 15,
+            nesting: 6,
+            sloc: 50,
+            abc_magnitude: 10.5,
+            return_count: 3,
+            test_scoring: TestScoringMetric::default(),
+        };
+
+        let violations = thresholds.violations(&func);
+        let metrics: Vec<_> = violations.iter().map(|v| v.metric).collect();
+        assert_eq!(metrics, vec!["McCabe Complexity", "Nesting Depth", "ABC Magnitude"]);
+        assert_eq!(violations[2].value, "10.50");
+        assert_eq!(violations[2].threshold, "10.00");
+    }
+}
@@ -0,0 +1,596 @@
+// Compact columnar binary results format for trend storage and dashboards
+//
+// Layout (all integers little-endian):
+//
+//   magic "KNOTSCOL" | version: u16 | section count: u16 | row count: u64
+//   directory, one entry per section:
+//       name length: u8 | name | kind: u8 | byte offset: u64 | byte length: u64
+//   section data
+//
+// Every metric is its own section of `row count` fixed-width values. Function names and
+// file paths are stored as u32 ids into the shared `strings` section, which holds the
+// string count, `count + 1` u32 end offsets and the UTF-8 bytes. Readers seek straight to
+// the sections they need and ignore names they do not know, so columns can be added
+// without a version bump; the version only changes when existing sections change.
+//
+// Partial results of a sharded run (`--shard`) add a `file_order` column, each row's
+// file position in the full run, and a `run` section of `Counts` holding the shard
+// index and count, the number of files in the full run and the number this shard
+// skipped.
+
+use anyhow::{bail, Context, Result};
+use std::collections::HashMap;
+use std::fs;
+use std::io::{BufReader, Read, Seek, SeekFrom, Write};
+use std::path::Path;
+
+use crate::complexity::TestScoringMetric;
+use crate::store::MetricsStore;
+
+pub const MAGIC: &[u8; 8] = b"KNOTSCOL";
+pub const FORMAT_VERSION: u16 = 1;
+
+/// Name of the interned string table section
+pub const STRINGS_SECTION: &str = "strings";
+/// Name of the partial results' run counts section
+pub const RUN_SECTION: &str = "run";
+/// Name of the partial results' column of file positions in the full run
+pub const FILE_ORDER_COLUMN: &str = "file_order";
+
+/// Element type of a section
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ColumnKind {
+    U32 = 0,
+    I32 = 1,
+    F64 = 2,
+    /// u32 ids into the string table
+    StrRef = 3,
+    Strings = 4,
+    /// Run-level u64 values rather than one value per row
+    Counts = 5,
+}
+
+impl ColumnKind {
+    fn from_tag(tag: u8) -> Option<Self> {
+        match tag {
+            0 => Some(ColumnKind::U32),
+            1 => Some(ColumnKind::I32),
+            2 => Some(ColumnKind::F64),
+            3 => Some(ColumnKind::StrRef),
+            4 => Some(ColumnKind::Strings),
+            5 => Some(ColumnKind::Counts),
+            _ => None,
+        }
+    }
+}
+
+/// Decoded values of one column
+#[derive(Debug, Clone, PartialEq)]
+pub enum Column {
+    U32(Vec<u32>),
+    I32(Vec<i32>),
+    F64(Vec<f64>),
+    StrRef(Vec<u32>),
+}
+
+/// One function's results, borrowed from whatever the caller keeps them in
+pub struct ColumnarRow<'a> {
+    pub name: &'a str,
+    pub file_path: &'a str,
+    pub mccabe: u32,
+    pub cognitive: u32,
+    pub nesting: u32,
+    pub sloc: u32,
+    pub abc_magnitude: f64,
+    pub return_count: u32,
+    pub test_scoring: TestScoringMetric,
+}
+
+impl ColumnarRow<'_> {
+    /// The larger of McCabe and cognitive complexity, used for ranking
+    pub fn max_complexity(&self) -> u32 {
+        std::cmp::max(self.mccabe, self.cognitive)
+    }
+}
+
+/// What a shard's partial results file records about its run
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct ShardCounts {
+    /// Zero-based shard index
+    pub shard: u64,
+    pub shard_count: u64,
+    /// Files in the full, unsharded run
+    pub total_files: u64,
+    /// Files of this shard that could not be analyzed
+    pub skipped_files: u64,
+}
+
+/// Accumulates rows for a columnar file. Rows are kept in a `MetricsStore`, so names
+/// and paths are interned as they arrive and memory grows with the number of distinct
+/// strings, not with the number of functions.
+#[derive(Default)]
+pub struct ColumnarWriter {
+    store: MetricsStore,
+}
+
+impl ColumnarWriter {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn len(&self) -> usize {
+        self.store.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.store.is_empty()
+    }
+
+    pub fn push(&mut self, row: &ColumnarRow) {
+        self.store.push(row);
+    }
+
+    /// Write the file to `path`
+    pub fn write_file(&self, path: &Path) -> Result<()> {
+        write_store_file(&self.store, path)
+    }
+
+    pub fn write_to(&self, out: &mut impl Write) -> Result<()> {
+        write_store(&self.store, out)
+    }
+}
+
+/// Write an already-collected store to `path` as a columnar file
+pub fn write_store_file(store: &MetricsStore, path: &Path) -> Result<()> {
+    let file = fs::File::create(path)
+        .with_context(|| format!("Failed to create {}", path.display()))?;
+    let mut out = std::io::BufWriter::new(file);
+    write_store(store, &mut out)
+        .and_then(|_| out.flush().map_err(Into::into))
+        .with_context(|| format!("Failed to write {}", path.display()))
+}
+
+/// Encode a store in the columnar format
+pub fn write_store(store: &MetricsStore, out: &mut impl Write) -> Result<()> {
+    write_sections(store.len(), &store_sections(store), out)
+}
+
+/// Write a shard's partial results: the store, each row's file position in the full
+/// run (`file_order`, one per row) and the shard's counts
+pub fn write_partial_file(store: &MetricsStore, file_order: &[u32], counts: ShardCounts, path: &Path) -> Result<()> {
+    assert_eq!(file_order.len(), store.len(), "one file position per row");
+
+    let mut sections = store_sections(store);
+    sections.push((FILE_ORDER_COLUMN, ColumnKind::U32, encode_u32(file_order)));
+    let run = [counts.shard, counts.shard_count, counts.total_files, counts.skipped_files];
+    sections.push((RUN_SECTION, ColumnKind::Counts, run.iter().flat_map(|v| v.to_le_bytes()).collect()));
+
+    let file = fs::File::create(path)
+        .with_context(|| format!("Failed to create {}", path.display()))?;
+    let mut out = std::io::BufWriter::new(file);
+    write_sections(store.len(), &sections, &mut out)
+        .and_then(|_| out.flush().map_err(Into::into))
+        .with_context(|| format!("Failed to write {}", path.display()))
+}
+
+type Section = (&'static str, ColumnKind, Vec<u8>);
+
+fn store_sections(store: &MetricsStore) -> Vec<Section> {
+    vec![
+        (STRINGS_SECTION, ColumnKind::Strings, encode_strings(store.strings.strings())),
+        ("name", ColumnKind::StrRef, encode_u32(&store.name)),
+        ("file_path", ColumnKind::StrRef, encode_u32(&store.file_path)),
+        ("mccabe", ColumnKind::U32, encode_u32(&store.mccabe)),
+        ("cognitive", ColumnKind::U32, encode_u32(&store.cognitive)),
+        ("nesting", ColumnKind::U32, encode_u32(&store.nesting)),
+        ("sloc", ColumnKind::U32, encode_u32(&store.sloc)),
+        ("abc_magnitude", ColumnKind::F64, encode_f64(&store.abc_magnitude)),
+        ("return_count", ColumnKind::U32, encode_u32(&store.return_count)),
+        ("signature_score", ColumnKind::U32, encode_u32(&store.signature_score)),
+        ("dependency_score", ColumnKind::U32, encode_u32(&store.dependency_score)),
+        ("observable_score", ColumnKind::U32, encode_u32(&store.observable_score)),
+        ("implementation_score", ColumnKind::U32, encode_u32(&store.implementation_score)),
+        ("documentation_score", ColumnKind::I32, encode_i32(&store.documentation_score)),
+        ("total_score", ColumnKind::I32, encode_i32(&store.total_score)),
+    ]
+}
+
+fn write_sections(row_count: usize, sections: &[Section], out: &mut impl Write) -> Result<()> {
+    let directory_len: usize = sections.iter().map(|(name, _, _)| 1 + name.len() + 1 + 8 + 8).sum();
+    let mut offset = (MAGIC.len() + 2 + 2 + 8 + directory_len) as u64;
+
+    out.write_all(MAGIC)?;
+    out.write_all(&FORMAT_VERSION.to_le_bytes())?;
+    out.write_all(&(sections.len() as u16).to_le_bytes())?;
+    out.write_all(&(row_count as u64).to_le_bytes())?;
+
+    for (name, kind, data) in sections {
+        out.write_all(&[name.len() as u8])?;
+        out.write_all(name.as_bytes())?;
+        out.write_all(&[*kind as u8])?;
+        out.write_all(&offset.to_le_bytes())?;
+        out.write_all(&(data.len() as u64).to_le_bytes())?;
+        offset += data.len() as u64;
+    }
+
+    for (_, _, data) in sections {
+        out.write_all(data)?;
+    }
+
+    Ok(())
+}
+
+fn encode_u32(values: &[u32]) -> Vec<u8> {
+    values.iter().flat_map(|v| v.to_le_bytes()).collect()
+}
+
+fn encode_i32(values: &[i32]) -> Vec<u8> {
+    values.iter().flat_map(|v| v.to_le_bytes()).collect()
+}
+
+fn encode_f64(values: &[f64]) -> Vec<u8> {
+    values.iter().flat_map(|v| v.to_le_bytes()).collect()
+}
+
+fn encode_strings(strings: &[impl AsRef<str>]) -> Vec<u8> {
+    let mut data = Vec::new();
+    data.extend((strings.len() as u32).to_le_bytes());
+
+    let mut end = 0u32;
+    data.extend(end.to_le_bytes());
+    for s in strings {
+        end += s.as_ref().len() as u32;
+        data.extend(end.to_le_bytes());
+    }
+    for s in strings {
+        data.extend(s.as_ref().as_bytes());
+    }
+    data
+}
+
+struct SectionEntry {
+    kind: ColumnKind,
+    offset: u64,
+    len: u64,
+}
+
+/// Reads a columnar results file section by section
+pub struct ColumnarReader<R> {
+    input: R,
+    version: u16,
+    row_count: u64,
+    sections: HashMap<String, SectionEntry>,
+}
+
+impl ColumnarReader<BufReader<fs::File>> {
+    pub fn open(path: &Path) -> Result<Self> {
+        let file = fs::File::open(path)
+            .with_context(|| format!("Failed to open {}", path.display()))?;
+        Self::new(BufReader::new(file)).with_context(|| format!("Failed to read {}", path.display()))
+    }
+}
+
+impl<R: Read + Seek> ColumnarReader<R> {
+    /// Read the header and section directory; no column data is loaded yet
+    pub fn new(mut input: R) -> Result<Self> {
+        let mut magic = [0u8; 8];
+        input.read_exact(&mut magic)?;
+        if &magic != MAGIC {
+            bail!("Not a knots columnar results file");
+        }
+
+        let version = read_u16(&mut input)?;
+        if version > FORMAT_VERSION {
+            bail!("Unsupported columnar format version {} (this build reads up to {})", version, FORMAT_VERSION);
+        }
+        let section_count = read_u16(&mut input)?;
+        let row_count = read_u64(&mut input)?;
+
+        let position = input.stream_position()?;
+        let file_len = input.seek(SeekFrom::End(0))?;
+        input.seek(SeekFrom::Start(position))?;
+
+        let mut sections = HashMap::new();
+        for _ in 0..section_count {
+            let mut name_len = [0u8; 1];
+            input.read_exact(&mut name_len)?;
+            let mut name = vec![0u8; name_len[0] as usize];
+            input.read_exact(&mut name)?;
+            let mut tag = [0u8; 1];
+            input.read_exact(&mut tag)?;
+            let offset = read_u64(&mut input)?;
+            let len = read_u64(&mut input)?;
+            // Checked here so a truncated or corrupt file fails before anything is allocated
+            if offset.checked_add(len).map_or(true, |end| end > file_len) {
+                bail!("Section '{}' runs past the end of the file", String::from_utf8_lossy(&name));
+            }
+
+            // Sections of kinds this build does not know are skipped like unknown names
+            if let Some(kind) = ColumnKind::from_tag(tag[0]) {
+                sections.insert(String::from_utf8_lossy(&name).into_owned(), SectionEntry { kind, offset, len });
+            }
+        }
+
+        Ok(Self {
+            input,
+            version,
+            row_count,
+            sections,
+        })
+    }
+
+    pub fn version(&self) -> u16 {
+        self.version
+    }
+
+    pub fn row_count(&self) -> u64 {
+        self.row_count
+    }
+
+    /// Names of the columns present in the file
+    pub fn column_names(&self) -> impl Iterator<Item = &str> {
+        self.sections
+            .iter()
+            .filter(|(_, entry)| !matches!(entry.kind, ColumnKind::Strings | ColumnKind::Counts))
+            .map(|(name, _)| name.as_str())
+    }
+
+    /// Load a single column
+    pub fn column(&mut self, name: &str) -> Result<Column> {
+        let (kind, data) = self.section(name)?;
+        let width = if kind == ColumnKind::F64 { 8 } else { 4 };
+        if self.row_count.checked_mul(width) != Some(data.len() as u64) {
+            bail!("Column '{}' has {} bytes, expected {} rows", name, data.len(), self.row_count);
+        }
+
+        Ok(match kind {
+            ColumnKind::U32 => Column::U32(data.chunks_exact(4).map(|c| u32::from_le_bytes(c.try_into().unwrap())).collect()),
+            ColumnKind::StrRef => Column::StrRef(data.chunks_exact(4).map(|c| u32::from_le_bytes(c.try_into().unwrap())).collect()),
+            ColumnKind::I32 => Column::I32(data.chunks_exact(4).map(|c| i32::from_le_bytes(c.try_into().unwrap())).collect()),
+            ColumnKind::F64 => Column::F64(data.chunks_exact(8).map(|c| f64::from_le_bytes(c.try_into().unwrap())).collect()),
+            ColumnKind::Strings | ColumnKind::Counts => bail!("'{}' is not a column", name),
+        })
+    }
+
+    /// The shard counts of a partial results file, or None for a complete run's file
+    pub fn shard_counts(&mut self) -> Result<Option<ShardCounts>> {
+        if !self.sections.contains_key(RUN_SECTION) {
+            return Ok(None);
+        }
+        let (_, data) = self.section(RUN_SECTION)?;
+        let values: Vec<u64> = data.chunks_exact(8).map(|c| u64::from_le_bytes(c.try_into().unwrap())).collect();
+        let [shard, shard_count, total_files, skipped_files] = values[..] else {
+            bail!("Malformed '{}' section", RUN_SECTION);
+        };
+        Ok(Some(ShardCounts {
+            shard,
+            shard_count,
+            total_files,
+            skipped_files,
+        }))
+    }
+
+    /// Load every row into a store, in row order
+    pub fn read_store(&mut self) -> Result<MetricsStore> {
+        let strings = self.strings()?;
+        let name = self.str_ref_column("name", &strings)?;
+        let file_path = self.str_ref_column("file_path", &strings)?;
+        let mccabe = self.u32_column("mccabe")?;
+        let cognitive = self.u32_column("cognitive")?;
+        let nesting = self.u32_column("nesting")?;
+        let sloc = self.u32_column("sloc")?;
+        let abc_magnitude = match self.column("abc_magnitude")? {
+            Column::F64(values) => values,
+            _ => bail!("Column 'abc_magnitude' is not f64"),
+        };
+        let return_count = self.u32_column("return_count")?;
+        let signature_score = self.u32_column("signature_score")?;
+        let dependency_score = self.u32_column("dependency_score")?;
+        let observable_score = self.u32_column("observable_score")?;
+        let implementation_score = self.u32_column("implementation_score")?;
+        let documentation_score = self.i32_column("documentation_score")?;
+        let total_score = self.i32_column("total_score")?;
+
+        let mut store = MetricsStore::new();
+        for i in 0..self.row_count as usize {
+            store.push(&ColumnarRow {
+                name: name[i],
+                file_path: file_path[i],
+                mccabe: mccabe[i],
+                cognitive: cognitive[i],
+                nesting: nesting[i],
+                sloc: sloc[i],
+                abc_magnitude: abc_magnitude[i],
+                return_count: return_count[i],
+                test_scoring: TestScoringMetric {
+                    signature_score: signature_score[i],
+                    dependency_score: dependency_score[i],
+                    observable_score: observable_score[i],
+                    implementation_score: implementation_score[i],
+                    documentation_score: documentation_score[i],
+                    total_score: total_score[i],
+                },
+            });
+        }
+        Ok(store)
+    }
+
+    pub fn u32_column(&mut self, name: &str) -> Result<Vec<u32>> {
+        match self.column(name)? {
+            Column::U32(values) => Ok(values),
+            _ => bail!("Column '{}' is not u32", name),
+        }
+    }
+
+    fn i32_column(&mut self, name: &str) -> Result<Vec<i32>> {
+        match self.column(name)? {
+            Column::I32(values) => Ok(values),
+            _ => bail!("Column '{}' is not i32", name),
+        }
+    }
+
+    /// A string column resolved against `strings`
+    fn str_ref_column<'s>(&mut self, name: &str, strings: &'s [String]) -> Result<Vec<&'s str>> {
+        let Column::StrRef(ids) = self.column(name)? else {
+            bail!("Column '{}' is not a string column", name);
+        };
+        ids.iter()
+            .map(|&id| strings.get(id as usize).map(String::as_str))
+            .collect::<Option<_>>()
+            .with_context(|| format!("Column '{}' refers past the string table", name))
+    }
+
+    /// Load the interned string table that `StrRef` columns index into
+    pub fn strings(&mut self) -> Result<Vec<String>> {
+        let (_, data) = self.section(STRINGS_SECTION)?;
+        let word = |i: usize| -> Result<u32> {
+            data.get(i * 4..i * 4 + 4)
+                .map(|b| u32::from_le_bytes(b.try_into().unwrap()))
+                .context("Truncated string table")
+        };
+
+        let count = word(0)? as usize;
+        if count > data.len() / 4 {
+            bail!("Truncated string table");
+        }
+        let blob_start = (count + 2) * 4;
+        let mut strings = Vec::with_capacity(count);
+        for i in 0..count {
+            let start = blob_start + word(1 + i)? as usize;
+            let end = blob_start + word(2 + i)? as usize;
+            let bytes = data.get(start..end).context("Truncated string table")?;
+            strings.push(String::from_utf8_lossy(bytes).into_owned());
+        }
+        Ok(strings)
+    }
+
+    fn section(&mut self, name: &str) -> Result<(ColumnKind, Vec<u8>)> {
+        let entry = self
+            .sections
+            .get(name)
+            .with_context(|| format!("No '{}' column in columnar file", name))?;
+        let (kind, offset, len) = (entry.kind, entry.offset, entry.len);
+
+        self.input.seek(SeekFrom::Start(offset))?;
+        let mut data = vec![0u8; len as usize];
+        self.input.read_exact(&mut data)?;
+        Ok((kind, data))
+    }
+}
+
+fn read_u16(input: &mut impl Read) -> Result<u16> {
+    let mut bytes = [0u8; 2];
+    input.read_exact(&mut bytes)?;
+    Ok(u16::from_le_bytes(bytes))
+}
+
+fn read_u64(input: &mut impl Read) -> Result<u64> {
+    let mut bytes = [0u8; 8];
+    input.read_exact(&mut bytes)?;
+    Ok(u64::from_le_bytes(bytes))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::io::Cursor;
+
+    #[test]
+    fn test_columnar_roundtrip() {
+        let scoring = TestScoringMetric {
+            signature_score: 4,
+            dependency_score: 2,
+            observable_score: 1,
+            implementation_score: 3,
+            documentation_score: -1,
+            total_score: 7,
+        };
+        let mut writer = ColumnarWriter::new();
+        for (name, mccabe) in [("parse", 3), ("emit", 8), ("parse", 5)] {
+            writer.push(&ColumnarRow {
+                name,
+                file_path: "src/a.c",
+                mccabe,
+                cognitive: mccabe + 1,
+                nesting: 2,
+                sloc: 10,
+                abc_magnitude: 4.25,
+                return_count: 1,
+                test_scoring: scoring,
+            });
+        }
+
+        let mut bytes = Vec::new();
+        writer.write_to(&mut bytes).unwrap();
+        let mut reader = ColumnarReader::new(Cursor::new(bytes.clone())).unwrap();
+
+        assert_eq!(reader.version(), FORMAT_VERSION);
+        assert_eq!(reader.row_count(), 3);
+        assert_eq!(reader.column("mccabe").unwrap(), Column::U32(vec![3, 8, 5]));
+        assert_eq!(reader.column("documentation_score").unwrap(), Column::I32(vec![-1, -1, -1]));
+        assert_eq!(reader.column("abc_magnitude").unwrap(), Column::F64(vec![4.25; 3]));
+
+        // Repeated names and paths share one string table entry
+        let strings = reader.strings().unwrap();
+        assert_eq!(strings, vec!["parse", "src/a.c", "emit"]);
+        assert_eq!(reader.column("name").unwrap(), Column::StrRef(vec![0, 2, 0]));
+        assert!(reader.column("missing").is_err());
+
+        // Sizes read from a truncated or corrupt file give errors, not huge allocations
+        assert!(ColumnarReader::new(Cursor::new(&bytes[..bytes.len() - 1])).is_err());
+        let mut corrupt = bytes.clone();
+        let strings_at = reader.sections[STRINGS_SECTION].offset as usize;
+        corrupt[strings_at..strings_at + 4].copy_from_slice(&u32::MAX.to_le_bytes());
+        corrupt[12..20].copy_from_slice(&u64::MAX.to_le_bytes());
+        let mut reader = ColumnarReader::new(Cursor::new(corrupt)).unwrap();
+        assert!(reader.strings().is_err());
+        assert!(reader.column("mccabe").is_err());
+    }
+
+    #[test]
+    fn test_partial_results_roundtrip() {
+        let scoring = TestScoringMetric {
+            signature_score: 1,
+            dependency_score: 0,
+            observable_score: 2,
+            implementation_score: 0,
+            documentation_score: 3,
+            total_score: 6,
+        };
+        let mut store = MetricsStore::new();
+        for (name, file_path) in [("init", "src/b.c"), ("run", "src/b.c"), ("main", "src/d.c")] {
+            store.push(&ColumnarRow {
+                name,
+                file_path,
+                mccabe: 2,
+                cognitive: 1,
+                nesting: 1,
+                sloc: 4,
+                abc_magnitude: 1.5,
+                return_count: 0,
+                test_scoring: scoring,
+            });
+        }
+        let counts = ShardCounts {
+            shard: 1,
+            shard_count: 3,
+            total_files: 9,
+            skipped_files: 1,
+        };
+
+        let path = std::env::temp_dir().join(format!("knots-partial-{}.col", std::process::id()));
+        write_partial_file(&store, &[1, 1, 3], counts, &path).unwrap();
+        let mut reader = ColumnarReader::open(&path).unwrap();
+        fs::remove_file(&path).unwrap();
+
+        assert_eq!(reader.shard_counts().unwrap(), Some(counts));
+        assert_eq!(reader.u32_column(FILE_ORDER_COLUMN).unwrap(), vec![1, 1, 3]);
+        // The run counts are not a per-row column
+        assert!(!reader.column_names().any(|name| name == RUN_SECTION));
+
+        let loaded = reader.read_store().unwrap();
+        let names: Vec<_> = loaded.rows().map(|row| (row.name, row.file_path)).collect();
+        assert_eq!(names, vec![("init", "src/b.c"), ("run", "src/b.c"), ("main", "src/d.c")]);
+        assert_eq!(loaded.totals(), store.totals());
+    }
+}
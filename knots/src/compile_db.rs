@@ -0,0 +1,185 @@
+// Streaming compile_commands.json loader with parallel path resolution and dedup
+
+use anyhow::{Context, Result};
+use serde::de::{SeqAccess, Visitor};
+use serde::{Deserialize, Deserializer};
+use std::borrow::Cow;
+use std::collections::HashSet;
+use std::fmt;
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::thread;
+
+use knots::filter::{should_process_file, FilterRules};
+use knots::source::SourceReader;
+
+/// The parts of a compilation database entry knots needs. Other fields (`command`,
+/// `arguments`, `output`) are skipped by the parser without being allocated.
+#[derive(Deserialize)]
+struct CompileCommand<'a> {
+    #[serde(default, borrow)]
+    directory: Cow<'a, str>,
+    #[serde(borrow)]
+    file: Cow<'a, str>,
+}
+
+/// A `.c` entry that passed the file filters and still needs resolving on disk
+struct Candidate {
+    directory: String,
+    file: String,
+}
+
+/// Load the `.c` files listed in a compilation database.
+///
+/// The database is parsed as a stream of entries straight from the (memory-mapped)
+/// file, so only the entries that survive filtering are kept. A translation unit
+/// compiled in several configurations appears once, at its first position: entries
+/// are deduplicated by (directory, file) while parsing and by canonical path after
+/// resolution. Resolution against the filesystem runs on `jobs` threads.
+pub fn load_compile_commands(
+    compile_commands_path: &Path,
+    include_rules: &Option<FilterRules>,
+    exclude_rules: &Option<FilterRules>,
+    jobs: usize,
+) -> Result<Vec<PathBuf>> {
+    let candidates = {
+        let mut reader = SourceReader::new();
+        let content = reader
+            .read(compile_commands_path)
+            .with_context(|| format!("Failed to read compile_commands.json: {}", compile_commands_path.display()))?;
+
+        let mut seen = HashSet::new();
+        let mut candidates = Vec::new();
+        parse_entries(&content, |cmd| {
+            // Only process C files
+            if Path::new(cmd.file.as_ref()).extension().map_or(true, |ext| ext != "c") {
+                return;
+            }
+            if !should_process_file(&cmd.file, include_rules, exclude_rules) {
+                return;
+            }
+            if seen.insert((cmd.directory.clone(), cmd.file.clone())) {
+                candidates.push(Candidate {
+                    directory: cmd.directory.into_owned(),
+                    file: cmd.file.into_owned(),
+                });
+            }
+        })
+        .with_context(|| format!("Failed to parse compile_commands.json: {}", compile_commands_path.display()))?;
+        candidates
+    };
+
+    let mut canonical_paths = HashSet::new();
+    let files: Vec<PathBuf> = resolve_all(&candidates, jobs)
+        .into_iter()
+        .flatten()
+        .filter(|(_, canonical)| canonical_paths.insert(canonical.clone()))
+        .map(|(path, _)| path)
+        .collect();
+
+    if files.is_empty() {
+        anyhow::bail!("No .c files found in compile_commands.json");
+    }
+
+    Ok(files)
+}
+
+/// Call `on_entry` for each element of the top-level JSON array without collecting them
+fn parse_entries<'de, F>(content: &'de [u8], on_entry: F) -> serde_json::Result<()>
+where
+    F: FnMut(CompileCommand<'de>),
+{
+    struct EntryVisitor<F>(F);
+
+    impl<'de, F: FnMut(CompileCommand<'de>)> Visitor<'de> for EntryVisitor<F> {
+        type Value = ();
+
+        fn expecting(&self, formatter: &mut fmt::Formatter) -> fmt::Result {
+            formatter.write_str("an array of compile commands")
+        }
+
+        fn visit_seq<A: SeqAccess<'de>>(mut self, mut seq: A) -> Result<(), A::Error> {
+            while let Some(cmd) = seq.next_element::<CompileCommand<'de>>()? {
+                (self.0)(cmd);
+            }
+            Ok(())
+        }
+    }
+
+    let mut deserializer = serde_json::Deserializer::from_slice(content);
+    deserializer.deserialize_seq(EntryVisitor(on_entry))?;
+    deserializer.end()
+}
+
+/// Resolve every candidate in parallel, keeping input order; see `resolve`
+fn resolve_all(candidates: &[Candidate], jobs: usize) -> Vec<Option<(PathBuf, PathBuf)>> {
+    let chunk_size = candidates.len().div_ceil(jobs.max(1)).max(1);
+
+    thread::scope(|scope| {
+        let handles: Vec<_> = candidates
+            .chunks(chunk_size)
+            .map(|chunk| scope.spawn(move || chunk.iter().map(resolve).collect::<Vec<_>>()))
+            .collect();
+
+        handles
+            .into_iter()
+            .flat_map(|handle| handle.join().expect("path resolution worker panicked"))
+            .collect()
+    })
+}
+
+/// The path to analyze for an entry and its canonical form for deduplication, or None
+/// if a relative entry exists neither under its directory nor relative to the cwd
+fn resolve(candidate: &Candidate) -> Option<(PathBuf, PathBuf)> {
+    let file_path = PathBuf::from(&candidate.file);
+
+    // Use absolute path if available, otherwise relative
+    if file_path.is_absolute() {
+        let canonical = fs::canonicalize(&file_path).unwrap_or_else(|_| file_path.clone());
+        return Some((file_path, canonical));
+    }
+
+    // Try to make it absolute using the directory from compile command
+    let abs_path = if !candidate.directory.is_empty() {
+        PathBuf::from(&candidate.directory).join(&file_path)
+    } else {
+        file_path.clone()
+    };
+
+    // canonicalize doubles as the existence check
+    [abs_path, file_path]
+        .into_iter()
+        .find_map(|path| fs::canonicalize(&path).ok().map(|canonical| (path, canonical)))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_compile_commands_dedup() {
+        let dir = std::env::temp_dir().join(format!("knots-compile-db-test-{}", std::process::id()));
+        fs::create_dir_all(dir.join("src")).unwrap();
+        fs::write(dir.join("src/a.c"), "int a(void) { return 0; }").unwrap();
+        fs::write(dir.join("src/b.c"), "int b(void) { return 0; }").unwrap();
+
+        let d = dir.display();
+        let db = format!(
+            r#"[
+                {{"directory": "{d}", "command": "cc -DDEBUG -c src/a.c", "file": "src/a.c"}},
+                {{"directory": "{d}", "arguments": ["cc", "-c", "src/b.c"], "file": "src/b.c"}},
+                {{"directory": "{d}/src", "command": "cc -DRELEASE -c a.c", "file": "a.c"}},
+                {{"directory": "{d}", "command": "cc -c src/a.c", "file": "src/a.c"}},
+                {{"directory": "{d}", "file": "src/missing.c"}},
+                {{"directory": "{d}", "file": "include/a.h"}}
+            ]"#
+        );
+        let db_path = dir.join("compile_commands.json");
+        fs::write(&db_path, db).unwrap();
+
+        let files = load_compile_commands(&db_path, &None, &None, 2).unwrap();
+        assert_eq!(files, vec![dir.join("src/a.c"), dir.join("src/b.c")]);
+
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -1,193 +1,287 @@
+use serde::{Deserialize, Serialize};
+use std::borrow::Cow;
+use std::cell::RefCell;
 use tree_sitter::Node;
 
-/// Calculates McCabe cyclomatic complexity for a function
-/// Formula: M = E - N + 2P where E = edges, N = nodes, P = connected components
-/// Simplified: Count decision points + 1
-pub fn calculate_mccabe_complexity(node: Node, source_code: &[u8]) -> u32 {
-    let mut complexity = 1; // Base complexity
+use crate::catalog::{ApiCatalog, Effects};
+use crate::syntax::{walk_preorder, CSyntax, KindClass};
 
-    visit_node_mccabe(node, source_code, &mut complexity);
-
-    complexity
+/// All per-function metrics, computed together by `calculate_all_metrics`
+#[derive(Debug, Clone, Copy)]
+pub struct FunctionComplexity {
+    pub mccabe: u32,
+    pub cognitive: u32,
+    pub nesting: u32,
+    pub sloc: u32,
+    pub abc: AbcComplexity,
+    pub return_count: u32,
+    pub test_scoring: TestScoringMetric,
 }
 
-fn visit_node_mccabe(node: Node, source_code: &[u8], complexity: &mut u32) {
-    // Decision points that increase cyclomatic complexity
-    match node.kind() {
-        // Conditional statements
-        "if_statement" => *complexity += 1,
-        "while_statement" => *complexity += 1,
-        "do_statement" => *complexity += 1,
-        "for_statement" => *complexity += 1,
+/// Calculates every metric for a function with a single traversal of its subtree
+pub fn calculate_all_metrics(node: Node, source_code: &[u8]) -> FunctionComplexity {
+    let walk = MetricsWalk::run(node, Some(source_code));
 
-        // Switch statement: pmccabe compatibility - count as +1 regardless of cases
-        // This matches pmccabe's simpler approach 
-        "switch_statement" => {
-            *complexity += 1;
-        }
+    FunctionComplexity {
+        mccabe: walk.mccabe,
+        cognitive: walk.cognitive,
+        nesting: walk.max_depth,
+        sloc: calculate_sloc(node, source_code),
+        abc: walk.abc(),
+        return_count: walk.return_count,
+        test_scoring: assemble_test_scoring(node, source_code, &walk),
+    }
+}
 
-        // Don't count individual case statements - handled by switch above
-        // "case_statement" => *complexity += 1,
+/// Calculates McCabe cyclomatic complexity for a function
+/// Formula: M = E - N + 2P where E = edges, N = nodes, P = connected components
+/// Simplified: Count decision points + 1
+pub fn calculate_mccabe_complexity(node: Node, source_code: &[u8]) -> u32 {
+    MetricsWalk::run(node, Some(source_code)).mccabe
+}
 
-        // Logical operators (each adds a path)
-        "binary_expression" => {
-            if let Some(op) = node.child_by_field_name("operator") {
-                if let Ok(op_text) = op.utf8_text(source_code) {
-                    if op_text == "&&" || op_text == "||" {
-                        *complexity += 1;
-                    }
-                }
-            }
-        }
+/// Calculates cognitive complexity for a function
+/// Based on the Cognitive Complexity specification by SonarSource
+pub fn calculate_cognitive_complexity(node: Node, source_code: &[u8]) -> u32 {
+    MetricsWalk::run(node, Some(source_code)).cognitive
+}
 
-        // Ternary operator
-        "conditional_expression" => *complexity += 1,
+/// Calculates maximum nesting depth of control structures
+pub fn calculate_nesting_depth(node: Node) -> u32 {
+    MetricsWalk::run(node, None).max_depth
+}
 
-        // goto/continue/break can create additional paths
-        "goto_statement" => *complexity += 1,
+/// Logical operators that add decision points
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum LogicalOp {
+    And,
+    Or,
+}
 
-        _ => {}
-    }
+/// State a node hands down to its children during the fused walk
+#[derive(Debug, Clone, Copy, Default)]
+struct VisitContext {
+    /// Nesting depth of the enclosing control structures (nesting metric)
+    depth: u32,
+    /// Cognitive nesting level
+    cognitive_nesting: u32,
+    /// Logical operator of the enclosing binary expression sequence (cognitive)
+    logical_op: Option<LogicalOp>,
+    /// This is an else clause whose if_statement child, if any, is an `else if` and adds
+    /// no cognitive increment itself
+    else_if_pending: bool,
+}
 
-    // Recursively visit children
-    let mut cursor = node.walk();
-    for child in node.children(&mut cursor) {
-        visit_node_mccabe(child, source_code, complexity);
-    }
+thread_local! {
+    /// Ancestor stack of the metric walk, reused by every function measured on the thread
+    static WALK_STACK: RefCell<Vec<VisitContext>> = const { RefCell::new(Vec::new()) };
 }
 
+/// Accumulators for every AST-based metric, filled in by one TreeCursor pass
+#[derive(Debug, Default)]
+struct MetricsWalk {
+    mccabe: u32,
+    cognitive: u32,
+    max_depth: u32,
+    assignments: u32,
+    branches: u32,
+    conditions: u32,
+    return_count: u32,
+    /// Side effects of the calls, for the dependency and observable behavior scores
+    effects: Effects,
+    modifies_globals: bool,
+}
 
+impl MetricsWalk {
+    /// Walks `node` and its subtree once. Without `source_code` the text-based checks
+    /// (callee names, global assignments) are skipped; only the dependency and
+    /// observable behavior scores depend on them.
+    fn run(node: Node, source_code: Option<&[u8]>) -> Self {
+        let mut walk = MetricsWalk {
+            mccabe: 1, // Base complexity
+            ..Default::default()
+        };
+        let syntax = CSyntax::get();
+        let catalog = ApiCatalog::get();
+        let mut cursor = node.walk();
+        let mut root = VisitContext::default();
+
+        WALK_STACK.with(|scratch| {
+            let mut stack = scratch.take();
+            walk_preorder(&mut cursor, &mut root, &mut stack, |cursor, parent| {
+                walk.visit(cursor.node(), syntax, catalog, source_code, parent)
+            });
+            *scratch.borrow_mut() = stack;
+        });
+        walk
+    }
+
+    fn abc(&self) -> AbcComplexity {
+        AbcComplexity {
+            assignments: self.assignments,
+            branches: self.branches,
+            conditions: self.conditions,
+        }
+    }
+
+    /// Adds one node's contributions, given its parent's context, and returns the
+    /// context its children inherit
+    fn visit(
+        &mut self,
+        node: Node,
+        syntax: &CSyntax,
+        catalog: &ApiCatalog,
+        source_code: Option<&[u8]>,
+        parent: &mut VisitContext,
+    ) -> VisitContext {
+        let class = syntax.class(node.kind_id());
+
+        // Only the first if_statement under an else clause is an `else if`
+        let else_if = parent.else_if_pending && class.contains(KindClass::IF_STATEMENT);
+        if else_if {
+            parent.else_if_pending = false;
+        }
+        let ctx = *parent;
+
+        let logical_op = if class.contains(KindClass::BINARY_EXPRESSION) {
+            logical_operator(node, syntax)
+        } else {
+            None
+        };
+
+        // McCabe: decision points. Switch counts +1 regardless of cases (pmccabe
+        // compatibility) and goto can create additional paths.
+        if class.contains(KindClass::DECISION) {
+            self.mccabe += 1;
+        }
+
+        // Nesting depth
+        let depth = if class.contains(KindClass::NESTING) {
+            let depth = ctx.depth + 1;
+            self.max_depth = self.max_depth.max(depth);
+            depth
+        } else {
+            ctx.depth
+        };
 
-/// Calculates cognitive complexity for a function
-/// Based on the Cognitive Complexity specification by SonarSource
-pub fn calculate_cognitive_complexity(node: Node, source_code: &[u8]) -> u32 {
-    let mut complexity = 0;
-    visit_node_cognitive(node, source_code, 0, &mut complexity, None);
-    complexity
-}
+        // ABC: assignments (including ++/--), branches (calls) and conditions
+        if class.contains(KindClass::ASSIGNMENT) {
+            self.assignments += 1;
+        }
+        if class.contains(KindClass::CALL) {
+            self.branches += 1;
+        }
+        if class.contains(KindClass::CONDITION) {
+            self.conditions += 1;
+        }
 
-fn visit_node_cognitive(node: Node, source_code: &[u8], nesting_level: u32, complexity: &mut u32, parent_binary_op: Option<&str>) {
-    match node.kind() {
-        // Control flow structures that increase complexity
-        "if_statement" => {
-            *complexity += 1 + nesting_level;
-            visit_children_cognitive(node, source_code, nesting_level + 1, complexity, None);
-            return;
+        // Logical operators add a path and a condition
+        if logical_op.is_some() {
+            self.mccabe += 1;
+            self.conditions += 1;
         }
 
-        // Else clause handling
-        "else_clause" => {
-            // Check if this is an "else if" by looking for if_statement as direct child
-            let mut cursor = node.walk();
+        if class.contains(KindClass::RETURN) {
+            self.return_count += 1;
+        }
 
-            for child in node.children(&mut cursor) {
-                if child.kind() == "if_statement" {
-                    // For else-if, only add +1 total (not +1 for else and +1+nesting for if)
-                    // Process the if with current nesting level, not increased
-                    *complexity += 1;
-                    visit_children_cognitive(child, source_code, nesting_level, complexity, None);
-                    return;
-                }
+        if let Some(source) = source_code {
+            if class.contains(KindClass::CALL) {
+                self.record_call(node, syntax, catalog, source);
+            } else if class.contains(KindClass::ASSIGNMENT_EXPRESSION) {
+                self.record_assignment(node, syntax, source);
             }
-
-            // Regular else clause adds +1 without nesting increment
-            *complexity += 1;
-            visit_children_cognitive(node, source_code, nesting_level, complexity, None);
-            return;
         }
 
-        "while_statement" | "do_statement" | "for_statement" => {
-            *complexity += 1 + nesting_level;
-            visit_children_cognitive(node, source_code, nesting_level + 1, complexity, None);
-            return;
-        }
+        let (cognitive_nesting, logical_op, else_if_pending) = self.score_cognitive(class, ctx, else_if, logical_op);
 
-        "switch_statement" => {
-            *complexity += 1 + nesting_level;
-            visit_children_cognitive(node, source_code, nesting_level + 1, complexity, None);
-            return;
+        VisitContext {
+            depth,
+            cognitive_nesting,
+            logical_op,
+            else_if_pending,
         }
+    }
 
-        // Case statements do NOT add complexity in cognitive complexity
-        // (only the switch itself does)
+    /// Adds this node's cognitive increment and returns the nesting level and logical
+    /// operator its children inherit, plus whether its first if_statement child is an
+    /// `else if`
+    fn score_cognitive(
+        &mut self,
+        class: KindClass,
+        ctx: VisitContext,
+        else_if: bool,
+        logical_op: Option<LogicalOp>,
+    ) -> (u32, Option<LogicalOp>, bool) {
+        let nesting_level = ctx.cognitive_nesting;
 
-        // Catch blocks
-        "catch_clause" => {
-            *complexity += 1 + nesting_level;
-            visit_children_cognitive(node, source_code, nesting_level + 1, complexity, None);
-            return;
+        // For else-if, only the else clause adds +1 (not +1 for else and +1+nesting for if),
+        // and the if's children stay at the current nesting level
+        if else_if {
+            return (nesting_level, None, false);
         }
 
-        // Jump statements: only goto (not break/continue in switches)
-        "goto_statement" => {
-            *complexity += 1;
-        }
-
-        // Binary logical operators - only count if not same as parent operator
-        "binary_expression" => {
-            if let Some(op) = node.child_by_field_name("operator") {
-                if let Ok(op_text) = op.utf8_text(source_code) {
-                    if op_text == "&&" || op_text == "||" {
-                        // Only add complexity if this operator is different from parent
-                        // This ensures we only count once per sequence of same operators
-                        if parent_binary_op != Some(op_text) {
-                            *complexity += 1;
-                        }
-                        // Pass this operator as parent to children
-                        visit_children_cognitive_with_op(node, source_code, nesting_level, complexity, Some(op_text));
-                        return;
-                    }
-                }
-            }
+        // Control flow structures that increase complexity
+        if class.contains(KindClass::COGNITIVE_STRUCTURE) {
+            self.cognitive += 1 + nesting_level;
+            return (nesting_level + 1, None, false);
         }
 
-        // Recursive calls (identified by looking for function calls)
-        // This is a simplified heuristic - in practice, you'd need to track function names
+        // Else clause adds +1 without nesting increment
+        if class.contains(KindClass::ELSE_CLAUSE) {
+            self.cognitive += 1;
+            return (nesting_level, None, true);
+        }
 
-        _ => {}
-    }
+        // Jump statements: only goto (not break/continue in switches)
+        if class.contains(KindClass::GOTO) {
+            self.cognitive += 1;
+            return (nesting_level, ctx.logical_op, false);
+        }
 
-    // Visit children with current nesting level for non-control-flow nodes
-    visit_children_cognitive(node, source_code, nesting_level, complexity, parent_binary_op);
-}
+        // Binary logical operators - only count once per sequence of the same operator
+        if logical_op.is_some() {
+            if ctx.logical_op != logical_op {
+                self.cognitive += 1;
+            }
+            return (nesting_level, logical_op, false);
+        }
 
-fn visit_children_cognitive(node: Node, source_code: &[u8], nesting_level: u32, complexity: &mut u32, parent_binary_op: Option<&str>) {
-    let mut cursor = node.walk();
-    for child in node.children(&mut cursor) {
-        visit_node_cognitive(child, source_code, nesting_level, complexity, parent_binary_op);
+        (nesting_level, ctx.logical_op, false)
     }
-}
 
-fn visit_children_cognitive_with_op(node: Node, source_code: &[u8], nesting_level: u32, complexity: &mut u32, parent_binary_op: Option<&str>) {
-    let mut cursor = node.walk();
-    for child in node.children(&mut cursor) {
-        visit_node_cognitive(child, source_code, nesting_level, complexity, parent_binary_op);
+    fn record_call(&mut self, node: Node, syntax: &CSyntax, catalog: &ApiCatalog, source_code: &[u8]) {
+        let Some(function) = node.child_by_field_id(syntax.field_function) else {
+            return;
+        };
+        // Callee names are looked up as bytes; no need to validate them as UTF-8
+        let func_name = &source_code[function.byte_range()];
+        self.effects = self.effects.union(catalog.lookup(func_name));
     }
-}
 
-/// Calculates maximum nesting depth of control structures
-pub fn calculate_nesting_depth(node: Node) -> u32 {
-    let mut max_depth = 0;
-    visit_node_nesting(node, 0, &mut max_depth);
-    max_depth
-}
-
-fn visit_node_nesting(node: Node, current_depth: u32, max_depth: &mut u32) {
-    let new_depth = match node.kind() {
-        "if_statement" | "while_statement" | "do_statement" | "for_statement"
-        | "switch_statement" | "compound_statement" => {
-            let depth = current_depth + 1;
-            if depth > *max_depth {
-                *max_depth = depth;
+    /// Global variable modifications (simplified - looks for assignments to identifiers)
+    fn record_assignment(&mut self, node: Node, syntax: &CSyntax, source_code: &[u8]) {
+        if let Some(left) = node.child_by_field_id(syntax.field_left) {
+            if syntax.class(left.kind_id()).contains(KindClass::IDENTIFIER) {
+                // Heuristic: if identifier doesn't start with lowercase, might be global
+                if let Ok(name) = left.utf8_text(source_code) {
+                    if !name.is_empty() && name.chars().next().unwrap().is_uppercase() {
+                        self.modifies_globals = true;
+                    }
+                }
             }
-            depth
         }
-        _ => current_depth
-    };
+    }
+}
 
-    let mut cursor = node.walk();
-    for child in node.children(&mut cursor) {
-        visit_node_nesting(child, new_depth, max_depth);
+fn logical_operator(node: Node, syntax: &CSyntax) -> Option<LogicalOp> {
+    let op = node.child_by_field_id(syntax.field_operator)?.kind_id();
+    if op == syntax.and_operator {
+        Some(LogicalOp::And)
+    } else if op == syntax.or_operator {
+        Some(LogicalOp::Or)
+    } else {
+        None
     }
 }
 
@@ -200,56 +294,72 @@ pub fn calculate_sloc(node: Node, source_code: &[u8]) -> u32 {
         return 0;
     }
 
-    let function_text = &source_code[start_byte..end_byte];
+    count_sloc(&source_code[start_byte..end_byte])
+}
+
+/// SLOC of a whole file, counted with the same rules as a function's
+pub fn calculate_file_sloc(source_code: &[u8]) -> u32 {
+    count_sloc(source_code)
+}
+
+/// Counts the non-blank lines of `text` that are not entirely comment.
+///
+/// Comments are recognized textually, line by line (so a `/*` inside a string literal
+/// also opens one), which the reported counts have always been based on; the comment
+/// nodes of the tree would give different counts. Line ends and comment delimiters are
+/// found with memchr, and a line outside a comment without any `/` is code without
+/// being searched further, which covers most lines.
+fn count_sloc(text: &[u8]) -> u32 {
     let mut sloc = 0;
     let mut in_multiline_comment = false;
+    let mut start = 0;
 
-    for line in function_text.split(|&b| b == b'\n') {
-        let trimmed = trim_bytes(line);
-
-        if trimmed.is_empty() {
-            continue;
+    loop {
+        let end = memchr::memchr(b'\n', &text[start..]).map_or(text.len(), |i| start + i);
+        let trimmed = trim_bytes(&text[start..end]);
+        if !trimmed.is_empty() && is_code_line(trimmed, &mut in_multiline_comment) {
+            sloc += 1;
         }
 
-        // Handle multi-line comments
-        if in_multiline_comment {
-            if let Some(pos) = find_bytes(trimmed, b"*/") {
-                in_multiline_comment = false;
-                let after_comment = &trimmed[pos + 2..];
-                if !trim_bytes(after_comment).is_empty() {
-                    sloc += 1;
-                }
-            }
-            continue;
+        if end == text.len() {
+            return sloc;
         }
+        start = end + 1;
+    }
+}
 
-        // Check for start of multi-line comment
-        if let Some(pos) = find_bytes(trimmed, b"/*") {
-            // Check if it ends on the same line
-            if let Some(end_pos) = find_bytes(&trimmed[pos..], b"*/") {
-                let before = &trimmed[..pos];
-                let after = &trimmed[pos + end_pos + 2..];
-                if !trim_bytes(before).is_empty() || !trim_bytes(after).is_empty() {
-                    sloc += 1;
-                }
-            } else {
-                in_multiline_comment = true;
-                if !trim_bytes(&trimmed[..pos]).is_empty() {
-                    sloc += 1;
-                }
+/// Whether a trimmed, non-empty line counts towards SLOC, tracking whether a block
+/// comment is still open after it
+fn is_code_line(trimmed: &[u8], in_multiline_comment: &mut bool) -> bool {
+    // Handle multi-line comments
+    if *in_multiline_comment {
+        let Some(pos) = find_pair(trimmed, *b"*/") else {
+            return false;
+        };
+        *in_multiline_comment = false;
+        return !trim_bytes(&trimmed[pos + 2..]).is_empty();
+    }
+
+    // No comment can start on a line without a slash
+    if memchr::memchr(b'/', trimmed).is_none() {
+        return true;
+    }
+
+    // Check for start of multi-line comment
+    if let Some(pos) = find_pair(trimmed, *b"/*") {
+        let before = &trimmed[..pos];
+        // Check if it ends on the same line
+        return match find_pair(&trimmed[pos..], *b"*/") {
+            Some(end_pos) => !trim_bytes(before).is_empty() || !trim_bytes(&trimmed[pos + end_pos + 2..]).is_empty(),
+            None => {
+                *in_multiline_comment = true;
+                !trim_bytes(before).is_empty()
             }
-            continue;
-        }
-
-        // Check for single-line comment
-        if trimmed.starts_with(b"//") {
-            continue;
-        }
-
-        sloc += 1;
+        };
     }
 
-    sloc
+    // Check for single-line comment
+    !trimmed.starts_with(b"//")
 }
 
 fn trim_bytes(bytes: &[u8]) -> &[u8] {
@@ -267,18 +377,9 @@ fn trim_bytes(bytes: &[u8]) -> &[u8] {
     &bytes[start..end]
 }
 
-fn find_bytes(haystack: &[u8], needle: &[u8]) -> Option<usize> {
-    if needle.is_empty() || haystack.len() < needle.len() {
-        return None;
-    }
-
-    for i in 0..=(haystack.len() - needle.len()) {
-        if &haystack[i..i + needle.len()] == needle {
-            return Some(i);
-        }
-    }
-
-    None
+/// Position of the two-byte `needle` in `haystack`, scanning for its first byte with memchr
+fn find_pair(haystack: &[u8], needle: [u8; 2]) -> Option<usize> {
+    memchr::memchr_iter(needle[0], haystack).find(|&i| haystack.get(i + 1) == Some(&needle[1]))
 }
 
 /// Represents ABC complexity components
@@ -303,82 +404,17 @@ impl AbcComplexity {
 /// B = Branches (function/method calls)
 /// C = Conditions (conditional logic)
 pub fn calculate_abc_complexity(node: Node, source_code: &[u8]) -> AbcComplexity {
-    let mut assignments = 0;
-    let mut branches = 0;
-    let mut conditions = 0;
-
-    visit_node_abc(node, source_code, &mut assignments, &mut branches, &mut conditions);
-
-    AbcComplexity {
-        assignments,
-        branches,
-        conditions,
-    }
-}
-
-fn visit_node_abc(node: Node, source_code: &[u8], assignments: &mut u32, branches: &mut u32, conditions: &mut u32) {
-    match node.kind() {
-        // Assignments
-        "assignment_expression" => {
-            *assignments += 1;
-        }
-        "update_expression" => {
-            // ++ and -- operators
-            *assignments += 1;
-        }
-
-        // Branches (function calls)
-        "call_expression" => {
-            *branches += 1;
-        }
-
-        // Conditions
-        "if_statement" | "while_statement" | "do_statement" | "for_statement"
-        | "switch_statement" | "conditional_expression" => {
-            *conditions += 1;
-        }
-
-        // Logical operators
-        "binary_expression" => {
-            if let Some(op) = node.child_by_field_name("operator") {
-                if let Ok(op_text) = op.utf8_text(source_code) {
-                    if op_text == "&&" || op_text == "||" {
-                        *conditions += 1;
-                    }
-                }
-            }
-        }
-
-        _ => {}
-    }
-
-    let mut cursor = node.walk();
-    for child in node.children(&mut cursor) {
-        visit_node_abc(child, source_code, assignments, branches, conditions);
-    }
+    MetricsWalk::run(node, Some(source_code)).abc()
 }
 
 /// Calculates the number of return statements in a function
 pub fn calculate_return_count(node: Node) -> u32 {
-    let mut count = 0;
-    visit_node_returns(node, &mut count);
-    count
-}
-
-fn visit_node_returns(node: Node, count: &mut u32) {
-    if node.kind() == "return_statement" {
-        *count += 1;
-    }
-
-    let mut cursor = node.walk();
-    for child in node.children(&mut cursor) {
-        visit_node_returns(child, count);
-    }
+    MetricsWalk::run(node, None).return_count
 }
 
 /// Represents test scoring metric components
 /// Based on automated test generation difficulty assessment
-#[derive(Debug, Clone, Copy)]
+#[derive(Debug, Clone, Copy, Default, Serialize, Deserialize)]
 pub struct TestScoringMetric {
     pub signature_score: u32,
     pub dependency_score: u32,
@@ -416,13 +452,17 @@ impl TestScoringMetric {
 /// Calculates test scoring metric for assessing test generation difficulty
 /// Score components: signature, dependency, observable behavior, implementation, documentation
 pub fn calculate_test_scoring(node: Node, source_code: &[u8]) -> TestScoringMetric {
+    let walk = MetricsWalk::run(node, Some(source_code));
+    assemble_test_scoring(node, source_code, &walk)
+}
+
+fn assemble_test_scoring(node: Node, source_code: &[u8], walk: &MetricsWalk) -> TestScoringMetric {
     let signature = calculate_signature_complexity(node, source_code);
-    let dependency = calculate_dependency_score(node, source_code);
-    let observable = calculate_observable_behavior_score(node, source_code);
+    let dependency = calculate_dependency_score(walk);
+    let observable = calculate_observable_behavior_score(node, source_code, walk);
 
     // Use existing cyclomatic complexity for implementation score
-    let mccabe = calculate_mccabe_complexity(node, source_code);
-    let implementation = map_cyclomatic_to_implementation_score(mccabe);
+    let implementation = map_cyclomatic_to_implementation_score(walk.mccabe);
 
     let documentation = calculate_documentation_score(node, source_code);
 
@@ -498,7 +538,7 @@ fn analyze_parameters(declarator: Node, source_code: &[u8]) -> u32 {
                     param_count += 1;
 
                     // Check for pointers, function pointers, void*
-                    let param_text = param.utf8_text(source_code).unwrap_or("");
+                    let param_text = node_text(param, source_code);
                     if param_text.contains("void*") || param_text.contains("void *") {
                         has_void_ptr = true;
                     } else if param_text.contains("(*") || param_text.contains("* )") {
@@ -530,7 +570,7 @@ fn analyze_parameters(declarator: Node, source_code: &[u8]) -> u32 {
 }
 
 fn analyze_return_type(type_node: Node, source_code: &[u8]) -> u32 {
-    let type_text = type_node.utf8_text(source_code).unwrap_or("");
+    let type_text = node_text(type_node, source_code);
 
     if type_text.contains("void") && !type_text.contains('*') {
         0
@@ -546,100 +586,42 @@ fn analyze_return_type(type_node: Node, source_code: &[u8]) -> u32 {
 }
 
 /// Calculates dependency and side effect score
-fn calculate_dependency_score(node: Node, source_code: &[u8]) -> u32 {
+fn calculate_dependency_score(walk: &MetricsWalk) -> u32 {
     let mut score = 0;
-    let mut has_io = false;
-    let mut has_allocation = false;
-    let mut has_system_calls = false;
-    let mut modifies_globals = false;
-
-    visit_node_dependencies(node, source_code, &mut has_io, &mut has_allocation,
-                           &mut has_system_calls, &mut modifies_globals);
 
     // Check for global state access (simplified heuristic)
-    if modifies_globals {
+    if walk.modifies_globals {
         score += 6;
     }
 
     // I/O operations
-    if has_io {
+    if walk.effects.contains(Effects::IO) {
         score += 2;
     }
 
     // Memory allocation
-    if has_allocation {
+    if walk.effects.contains(Effects::ALLOCATION) {
         score += 3;
     }
 
     // System calls
-    if has_system_calls {
+    if walk.effects.contains(Effects::SYSTEM_CALL) {
         score += 2;
     }
 
     score.min(10)
 }
 
-fn visit_node_dependencies(node: Node, source_code: &[u8], has_io: &mut bool,
-                          has_allocation: &mut bool, has_system_calls: &mut bool,
-                          modifies_globals: &mut bool) {
-    if node.kind() == "call_expression" {
-        if let Some(function) = node.child_by_field_name("function") {
-            if let Ok(func_name) = function.utf8_text(source_code) {
-                // File I/O functions
-                if matches!(func_name, "fopen" | "fclose" | "fread" | "fwrite" | "fprintf" |
-                           "fscanf" | "fgets" | "fputs" | "fseek" | "ftell" | "rewind" |
-                           "printf" | "scanf" | "puts" | "getc" | "putc") {
-                    *has_io = true;
-                }
-
-                // Memory allocation
-                if matches!(func_name, "malloc" | "calloc" | "realloc" | "free" | "aligned_alloc") {
-                    *has_allocation = true;
-                }
-
-                // System calls
-                if matches!(func_name, "time" | "clock" | "rand" | "srand" | "getpid" |
-                           "fork" | "exec" | "system" | "signal" | "kill" | "wait" | "pipe") {
-                    *has_system_calls = true;
-                }
-            }
-        }
-    }
-
-    // Check for global variable modifications (simplified - looks for assignments to identifiers)
-    if node.kind() == "assignment_expression" {
-        if let Some(left) = node.child_by_field_name("left") {
-            if left.kind() == "identifier" {
-                // Heuristic: if identifier doesn't start with lowercase, might be global
-                if let Ok(name) = left.utf8_text(source_code) {
-                    if !name.is_empty() && name.chars().next().unwrap().is_uppercase() {
-                        *modifies_globals = true;
-                    }
-                }
-            }
-        }
-    }
-
-    let mut cursor = node.walk();
-    for child in node.children(&mut cursor) {
-        visit_node_dependencies(child, source_code, has_io, has_allocation,
-                               has_system_calls, modifies_globals);
-    }
-}
-
 /// Calculates observable behavior score (how easy to verify correctness)
-fn calculate_observable_behavior_score(node: Node, source_code: &[u8]) -> u32 {
+fn calculate_observable_behavior_score(node: Node, source_code: &[u8], walk: &MetricsWalk) -> u32 {
     let mut score = 0;
-    let mut has_io = false;
-    let mut has_random = false;
-    let mut has_time = false;
 
     // Check return type
     let mut cursor = node.walk();
     for child in node.children(&mut cursor) {
         if child.kind() == "function_definition" {
             if let Some(type_node) = child.child_by_field_name("type") {
-                let type_text = type_node.utf8_text(source_code).unwrap_or("");
+                let type_text = node_text(type_node, source_code);
                 if type_text.contains("void") && !type_text.contains('*') {
                     score += 4;
                 }
@@ -648,44 +630,23 @@ fn calculate_observable_behavior_score(node: Node, source_code: &[u8]) -> u32 {
     }
 
     // Check for I/O, randomness, time dependencies
-    visit_node_observability(node, source_code, &mut has_io, &mut has_random, &mut has_time);
-
-    if has_io {
+    if walk.effects.contains(Effects::OBSERVABLE_IO) {
         score += 2;
     }
-    if has_random {
+    if walk.effects.contains(Effects::RANDOM) {
         score += 3;
     }
-    if has_time {
+    if walk.effects.contains(Effects::TIME) {
         score += 2;
     }
 
     score.min(10)
 }
 
-fn visit_node_observability(node: Node, source_code: &[u8], has_io: &mut bool,
-                            has_random: &mut bool, has_time: &mut bool) {
-    if node.kind() == "call_expression" {
-        if let Some(function) = node.child_by_field_name("function") {
-            if let Ok(func_name) = function.utf8_text(source_code) {
-                if matches!(func_name, "fopen" | "fclose" | "fread" | "fwrite" | "fprintf" |
-                           "printf" | "scanf" | "puts") {
-                    *has_io = true;
-                }
-                if matches!(func_name, "rand" | "srand" | "random") {
-                    *has_random = true;
-                }
-                if matches!(func_name, "time" | "clock" | "gettimeofday") {
-                    *has_time = true;
-                }
-            }
-        }
-    }
-
-    let mut cursor = node.walk();
-    for child in node.children(&mut cursor) {
-        visit_node_observability(child, source_code, has_io, has_random, has_time);
-    }
+/// Node text for the substring heuristics below; invalid UTF-8 is replaced rather than
+/// discarding the whole node
+fn node_text<'a>(node: Node, source_code: &'a [u8]) -> Cow<'a, str> {
+    String::from_utf8_lossy(&source_code[node.byte_range()])
 }
 
 /// Calculates documentation quality score (higher is better, reduces total difficulty)
@@ -695,7 +656,8 @@ fn calculate_documentation_score(node: Node, source_code: &[u8]) -> i32 {
     // Look for comment before the function
     if let Some(prev_sibling) = node.prev_sibling() {
         if prev_sibling.kind() == "comment" {
-            if let Ok(comment_text) = prev_sibling.utf8_text(source_code) {
+            let comment_text = node_text(prev_sibling, source_code);
+            {
                 // Check for Doxygen-style documentation
                 if comment_text.contains("/**") || comment_text.contains("///") {
                     score += 4; // Base documentation
@@ -806,4 +768,107 @@ mod tests {
         // Outer if: +1, inner if: +1 (base) +1 (nesting) = 3
         assert_eq!(calculate_cognitive_complexity(node, code.as_bytes()), 3);
     }
+
+    #[test]
+    fn test_all_metrics_single_pass() {
+        let code = r#"
+        void chain(int a, int b) {
+            if (a && b) {
+                return;
+            } else if (a || b) {
+                a = 1;
+            } else {
+                b = 2;
+            }
+        }
+        "#;
+        let tree = parse_c_function(code);
+        let function = tree.root_node().named_child(0).unwrap();
+        let metrics = calculate_all_metrics(function, code.as_bytes());
+
+        // if, &&, else-if, || -> 4 decision points + 1
+        assert_eq!(metrics.mccabe, 5);
+        assert_eq!(metrics.mccabe, calculate_mccabe_complexity(function, code.as_bytes()));
+        // if +1, && +1, else-if +1, || +1, else +1
+        assert_eq!(metrics.cognitive, 5);
+        // body, if, else-if, inner block
+        assert_eq!(metrics.nesting, 4);
+        assert_eq!(metrics.return_count, 1);
+        assert_eq!(metrics.abc.assignments, 2);
+        assert_eq!(metrics.abc.conditions, 4);
+        assert_eq!(metrics.sloc, calculate_sloc(function, code.as_bytes()));
+    }
+
+    #[test]
+    fn test_deeply_nested_blocks_do_not_overflow() {
+        // Deep enough to overflow a recursive walk on a test thread's stack
+        const DEPTH: usize = 20_000;
+        let code = format!("void deep(void) {{ {}{} }}", "{".repeat(DEPTH), "}".repeat(DEPTH));
+        let tree = parse_c_function(&code);
+        let function = tree.root_node().named_child(0).unwrap();
+        let metrics = calculate_all_metrics(function, code.as_bytes());
+
+        assert_eq!(metrics.nesting, DEPTH as u32 + 1);
+        assert_eq!(metrics.mccabe, 1);
+    }
+
+    /// The line-by-line SLOC counter `count_sloc` replaced, kept to check it exactly
+    fn reference_sloc(text: &[u8]) -> u32 {
+        fn find(haystack: &[u8], needle: &[u8]) -> Option<usize> {
+            haystack.windows(needle.len()).position(|window| window == needle)
+        }
+
+        let mut sloc = 0;
+        let mut in_multiline_comment = false;
+        for line in text.split(|&b| b == b'\n') {
+            let trimmed = trim_bytes(line);
+            if trimmed.is_empty() {
+                continue;
+            }
+            if in_multiline_comment {
+                if let Some(pos) = find(trimmed, b"*/") {
+                    in_multiline_comment = false;
+                    if !trim_bytes(&trimmed[pos + 2..]).is_empty() {
+                        sloc += 1;
+                    }
+                }
+                continue;
+            }
+            if let Some(pos) = find(trimmed, b"/*") {
+                if let Some(end_pos) = find(&trimmed[pos..], b"*/") {
+                    if !trim_bytes(&trimmed[..pos]).is_empty() || !trim_bytes(&trimmed[pos + end_pos + 2..]).is_empty() {
+                        sloc += 1;
+                    }
+                } else {
+                    in_multiline_comment = true;
+                    if !trim_bytes(&trimmed[..pos]).is_empty() {
+                        sloc += 1;
+                    }
+                }
+                continue;
+            }
+            if !trimmed.starts_with(b"//") {
+                sloc += 1;
+            }
+        }
+        sloc
+    }
+
+    #[test]
+    fn test_sloc_matches_reference_counter() {
+        let cases: &[&[u8]] = &[
+            b"",
+            b"int f(void)\n{\n    return 1;\n}",
+            b"int f(void) {\r\n\r\n  // note\r\n  return 1; // trailing\r\n}\r\n",
+            b"{\n  /* one */\n  x = 1; /* two */\n  /* three */ y = 2;\n  /*\n   * four\n   */ z = 3;\n}",
+            b"{\n  /*/ odd */\n  a /* open\n  still */ /* reopened\n  b;\n}",
+            b"{\n  s = \"/* not a comment\";\n  t;\n  */\n  // x /* y\n  u;\n}",
+            b"{ a / b; c /= 2; d = e/ *f; }\n\t\n/",
+            b"  \n\n*/\n/*\n",
+        ];
+        for (i, case) in cases.iter().enumerate() {
+            assert_eq!(count_sloc(case), reference_sloc(case), "case {}", i);
+        }
+        assert_eq!(calculate_file_sloc(cases[1]), 4);
+    }
 }
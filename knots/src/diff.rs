@@ -0,0 +1,529 @@
+// Diff-aware analysis: measure only the functions a git change touches, with deltas
+
+use anyhow::{Context, Result};
+use std::collections::{HashMap, HashSet};
+use std::fs;
+use std::ops::RangeInclusive;
+use std::path::PathBuf;
+use std::process::Command;
+use tree_sitter::{Node, Tree};
+
+use knots::analysis::{function_name, measure_function, visit_functions, FunctionMetrics};
+use knots::filter::{should_process_file, should_process_function, FilterRules};
+
+use crate::get_complexity_emoji;
+
+/// Which two versions of the tree to compare
+pub enum DiffSource {
+    /// The index against HEAD (what `git commit` would record)
+    Staged,
+    /// A revision or range as accepted by `git diff`: `REV` compares REV against the
+    /// working tree, `A..B` compares A with B and `A...B` compares B with the merge base
+    Revisions(String),
+}
+
+pub struct DiffConfig<'a> {
+    pub source: DiffSource,
+    /// Restrict the diff to this path; defaults to all `.c` and `.h` files
+    pub path: Option<&'a PathBuf>,
+    pub verbose: bool,
+    pub include_rules: &'a Option<FilterRules>,
+    pub exclude_rules: &'a Option<FilterRules>,
+}
+
+/// Where one side of the comparison reads file contents from
+enum Side {
+    Revision(String),
+    Index,
+    WorkingTree,
+}
+
+/// Changed line numbers (1-based) of one file, on each side of the diff
+#[derive(Default)]
+struct FileChanges {
+    old_lines: Vec<RangeInclusive<usize>>,
+    new_lines: Vec<RangeInclusive<usize>>,
+}
+
+/// A function the change touched, as it was before and is after
+struct FunctionChange {
+    name: String,
+    before: Option<FunctionMetrics>,
+    after: Option<FunctionMetrics>,
+}
+
+/// A named function definition and the lines it spans, found without measuring it
+struct LocatedFunction {
+    name: String,
+    lines: RangeInclusive<usize>,
+}
+
+/// One version of a file, parsed, with its functions in tree order
+struct ParsedSide {
+    source_code: Vec<u8>,
+    tree: Tree,
+    functions: Vec<LocatedFunction>,
+}
+
+/// A touched function by its index on each side
+struct TouchedFunction {
+    before: Option<usize>,
+    after: Option<usize>,
+}
+
+/// Print the touched functions with their deltas, and return how many became more
+/// complex
+pub fn run(config: &DiffConfig) -> Result<usize> {
+    let (old_side, new_side, diff_args) = resolve_sides(&config.source)?;
+
+    let mut args = vec!["diff", "-U0", "--no-color", "--no-ext-diff", "--no-renames", "--no-prefix", "--relative", "--diff-filter=AMD"];
+    args.extend(diff_args.iter().map(String::as_str));
+    args.push("--");
+    let path_arg = config.path.map(|path| path.to_string_lossy().into_owned());
+    match &path_arg {
+        Some(path) => args.push(path),
+        None => args.extend(["*.c", "*.h"]),
+    }
+
+    let diff = git(&args)?.context("git diff failed")?;
+    let changed_files = parse_unified_diff(&String::from_utf8_lossy(&diff));
+
+    let mut changes_by_file = Vec::new();
+    for (path, changes) in &changed_files {
+        if !should_process_file(path, config.include_rules, config.exclude_rules) {
+            continue;
+        }
+
+        let (before, after) = match (parse_side(&old_side, path)?, parse_side(&new_side, path)?) {
+            (Ok(before), Ok(after)) => (before, after),
+            (Err(version), _) | (_, Err(version)) => {
+                eprintln!("Warning: Skipping {}: failed to parse the {} version", path, version);
+                continue;
+            }
+        };
+        let changes = measure_touched(changes, before.as_ref(), after.as_ref())
+            .into_iter()
+            .filter(|change| {
+                let metrics = change.after.as_ref().or(change.before.as_ref()).expect("change has a side");
+                should_process_function(&change.name, metrics.max_complexity(), config.include_rules, config.exclude_rules)
+            })
+            .collect::<Vec<_>>();
+
+        if !changes.is_empty() {
+            changes_by_file.push((path.clone(), changes));
+        }
+    }
+
+    Ok(display_changes(&changes_by_file, config.verbose))
+}
+
+/// Work out the sides to read contents from and the revision arguments for `git diff`
+fn resolve_sides(source: &DiffSource) -> Result<(Side, Side, Vec<String>)> {
+    match source {
+        DiffSource::Staged => Ok((Side::Revision("HEAD".to_string()), Side::Index, vec!["--cached".to_string()])),
+        DiffSource::Revisions(range) => {
+            if let Some((from, to)) = range.split_once("...") {
+                let to = if to.is_empty() { "HEAD" } else { to };
+                let from = if from.is_empty() { "HEAD" } else { from };
+                let base = git(&["merge-base", from, to])?
+                    .with_context(|| format!("No merge base for {}", range))?;
+                let base = String::from_utf8_lossy(&base).trim().to_string();
+                Ok((Side::Revision(base.clone()), Side::Revision(to.to_string()), vec![base, to.to_string()]))
+            } else if let Some((from, to)) = range.split_once("..") {
+                let from = if from.is_empty() { "HEAD" } else { from };
+                let to = if to.is_empty() { "HEAD" } else { to };
+                Ok((Side::Revision(from.to_string()), Side::Revision(to.to_string()), vec![from.to_string(), to.to_string()]))
+            } else {
+                Ok((Side::Revision(range.clone()), Side::WorkingTree, vec![range.clone()]))
+            }
+        }
+    }
+}
+
+/// Run git, returning its stdout, or None if it exited unsuccessfully
+fn git(args: &[&str]) -> Result<Option<Vec<u8>>> {
+    // Non-ASCII paths come through as they are, so only rarer bytes are C-quoted
+    let output = Command::new("git")
+        .args(["-c", "core.quotePath=false"])
+        .args(args)
+        .output()
+        .context("Failed to run git")?;
+
+    if !output.status.success() {
+        let stderr = String::from_utf8_lossy(&output.stderr);
+        if args[0] == "diff" {
+            anyhow::bail!("git {} failed: {}", args.join(" "), stderr.trim());
+        }
+        return Ok(None);
+    }
+
+    Ok(Some(output.stdout))
+}
+
+/// Contents of `path` on one side of the diff, or None if it does not exist there
+fn read_side(side: &Side, path: &str) -> Result<Option<Vec<u8>>> {
+    match side {
+        Side::WorkingTree => match fs::read(path) {
+            Ok(source) => Ok(Some(source)),
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => Ok(None),
+            Err(e) => Err(e).with_context(|| format!("Failed to read file: {}", path)),
+        },
+        Side::Index => git(&["show", &format!(":./{}", path)]),
+        Side::Revision(rev) => git(&["show", &format!("{}:./{}", rev, path)]),
+    }
+}
+
+/// Changed line ranges per file from `git diff -U0 --no-prefix` output, in diff order
+fn parse_unified_diff(diff: &str) -> Vec<(String, FileChanges)> {
+    let mut files: Vec<(String, FileChanges)> = Vec::new();
+    let mut old_path: Option<String> = None;
+    // File headers sit between "diff --git" and the first hunk; afterwards a line like
+    // "--- x" is a removed line of code
+    let mut in_header = false;
+
+    for line in diff.lines() {
+        if line.starts_with("diff --git ") {
+            in_header = true;
+        } else if !in_header && !line.starts_with("@@ ") {
+            continue;
+        } else if let Some(path) = line.strip_prefix("--- ") {
+            old_path = (path != "/dev/null").then(|| unquote(path));
+        } else if let Some(path) = line.strip_prefix("+++ ") {
+            // Deleted files only have an old path
+            let path = if path == "/dev/null" { old_path.take() } else { Some(unquote(path)) };
+            if let Some(path) = path {
+                files.push((path, FileChanges::default()));
+            }
+        } else if let Some(hunk) = line.strip_prefix("@@ ") {
+            in_header = false;
+            let Some((_, changes)) = files.last_mut() else { continue };
+            let mut ranges = hunk.split(' ');
+            let (Some(old), Some(new)) = (ranges.next(), ranges.next()) else { continue };
+
+            if let Some((start, count)) = old.strip_prefix('-').and_then(parse_hunk_range) {
+                if count > 0 {
+                    changes.old_lines.push(start..=start + count - 1);
+                }
+            }
+            if let Some((start, count)) = new.strip_prefix('+').and_then(parse_hunk_range) {
+                if count > 0 {
+                    changes.new_lines.push(start..=start + count - 1);
+                } else {
+                    // Pure deletion after line `start`: the lines on either side were touched
+                    changes.new_lines.push(start.max(1)..=start + 1);
+                }
+            }
+        }
+    }
+
+    files
+}
+
+/// `start[,count]` from a hunk header; count defaults to 1
+fn parse_hunk_range(range: &str) -> Option<(usize, usize)> {
+    match range.split_once(',') {
+        Some((start, count)) => Some((start.parse().ok()?, count.parse().ok()?)),
+        None => Some((range.parse().ok()?, 1)),
+    }
+}
+
+/// A path from a `---`/`+++` line. Git C-quotes paths holding `"`, `\` or control
+/// characters, and ends one holding a space with a tab.
+fn unquote(path: &str) -> String {
+    let path = path.strip_suffix('\t').unwrap_or(path);
+    let Some(quoted) = path.strip_prefix('"').and_then(|rest| rest.strip_suffix('"')) else {
+        return path.to_string();
+    };
+
+    let mut bytes = Vec::with_capacity(quoted.len());
+    let mut rest = quoted.as_bytes();
+    while let Some((&byte, tail)) = rest.split_first() {
+        rest = tail;
+        if byte != b'\\' {
+            bytes.push(byte);
+            continue;
+        }
+        let Some((&escape, tail)) = rest.split_first() else { break };
+        rest = tail;
+        bytes.push(match escape {
+            b'a' => 0x07,
+            b'b' => 0x08,
+            b't' => b'\t',
+            b'n' => b'\n',
+            b'v' => 0x0b,
+            b'f' => 0x0c,
+            b'r' => b'\r',
+            // Three octal digits: one byte of a (possibly multi-byte) character
+            b'0'..=b'3' if rest.len() >= 2 && rest[..2].iter().all(|b| (b'0'..=b'7').contains(b)) => {
+                let value = (escape - b'0') << 6 | (rest[0] - b'0') << 3 | (rest[1] - b'0');
+                rest = &rest[2..];
+                value
+            }
+            other => other,
+        });
+    }
+    String::from_utf8_lossy(&bytes).into_owned()
+}
+
+/// Read and parse one side of `path`: `Ok(None)` if the file does not exist on that
+/// side, `Err` naming the side if it does not parse
+fn parse_side(side: &Side, path: &str) -> Result<Result<Option<ParsedSide>, &'static str>> {
+    let Some(source_code) = read_side(side, path)? else {
+        return Ok(Ok(None));
+    };
+    let Some(tree) = knots::parser::parse_c(&source_code)? else {
+        return Ok(Err(match side {
+            Side::WorkingTree => "working tree",
+            Side::Index => "staged",
+            Side::Revision(_) => "committed",
+        }));
+    };
+    let functions = locate_functions(&tree, &source_code);
+    Ok(Ok(Some(ParsedSide {
+        source_code,
+        tree,
+        functions,
+    })))
+}
+
+/// Every named function definition, in the order `visit_functions` reaches them
+fn locate_functions(tree: &Tree, source_code: &[u8]) -> Vec<LocatedFunction> {
+    let mut functions = Vec::new();
+    let mut cursor = tree.root_node().walk();
+
+    visit_functions(&mut cursor, source_code, &mut |node: Node, src| {
+        if let Some(name) = function_name(node, src) {
+            let lines = node.start_position().row + 1..=node.end_position().row + 1;
+            functions.push(LocatedFunction { name, lines });
+        }
+    });
+
+    functions
+}
+
+/// Metrics of the functions of `side` at `indices` (positions in `side.functions`)
+fn measure_at(side: &ParsedSide, indices: &HashSet<usize>) -> HashMap<usize, FunctionMetrics> {
+    let mut measured = HashMap::new();
+    if indices.is_empty() {
+        return measured;
+    }
+
+    let mut index = 0;
+    let mut cursor = side.tree.root_node().walk();
+    visit_functions(&mut cursor, &side.source_code, &mut |node: Node, src| {
+        if function_name(node, src).is_none() {
+            return;
+        }
+        if indices.contains(&index) {
+            measured.extend(measure_function(node, src).map(|metrics| (index, metrics)));
+        }
+        index += 1;
+    });
+    measured
+}
+
+/// Measure only the functions the change touched, on both sides, paired by name
+fn measure_touched(changes: &FileChanges, before: Option<&ParsedSide>, after: Option<&ParsedSide>) -> Vec<FunctionChange> {
+    let touched = touched_functions(
+        changes,
+        before.map_or(&[], |side| &side.functions),
+        after.map_or(&[], |side| &side.functions),
+    );
+
+    let measure = |side: Option<&ParsedSide>, indices: HashSet<usize>| {
+        side.map(|side| measure_at(side, &indices)).unwrap_or_default()
+    };
+    let mut before_metrics = measure(before, touched.iter().filter_map(|t| t.before).collect());
+    let mut after_metrics = measure(after, touched.iter().filter_map(|t| t.after).collect());
+
+    touched
+        .into_iter()
+        .filter_map(|touched| {
+            let before = touched.before.and_then(|index| before_metrics.remove(&index));
+            let after = touched.after.and_then(|index| after_metrics.remove(&index));
+            let name = after.as_ref().or(before.as_ref())?.name.clone();
+            Some(FunctionChange { name, before, after })
+        })
+        .collect()
+}
+
+/// Functions whose lines intersect the change, paired with their other version by name.
+/// Touched functions that no longer exist are reported as removed, after the rest.
+fn touched_functions(changes: &FileChanges, before: &[LocatedFunction], after: &[LocatedFunction]) -> Vec<TouchedFunction> {
+    let intersects = |lines: &RangeInclusive<usize>, changed: &[RangeInclusive<usize>]| {
+        changed.iter().any(|range| range.start() <= lines.end() && lines.start() <= range.end())
+    };
+
+    let after_names: HashSet<&str> = after.iter().map(|f| f.name.as_str()).collect();
+    let mut before_by_name: HashMap<&str, usize> = HashMap::new();
+    let mut removed = Vec::new();
+    for (index, function) in before.iter().enumerate() {
+        if after_names.contains(function.name.as_str()) {
+            before_by_name.entry(&function.name).or_insert(index);
+        } else if intersects(&function.lines, &changes.old_lines) {
+            removed.push(TouchedFunction {
+                before: Some(index),
+                after: None,
+            });
+        }
+    }
+
+    let mut result: Vec<TouchedFunction> = after
+        .iter()
+        .enumerate()
+        .filter(|(_, function)| intersects(&function.lines, &changes.new_lines))
+        .map(|(index, function)| TouchedFunction {
+            before: before_by_name.remove(function.name.as_str()),
+            after: Some(index),
+        })
+        .collect();
+    result.extend(removed);
+    result
+}
+
+/// " (+3)" style change annotation; empty for functions without a previous version
+fn delta<T: Into<f64> + Copy>(after: T, before: Option<T>, precision: usize) -> String {
+    match before {
+        Some(before) => format!(" ({:+.*})", precision, after.into() - before.into()),
+        None => String::new(),
+    }
+}
+
+/// Print the changes and a summary; returns the number of functions that got more complex
+fn display_changes(changes_by_file: &[(String, Vec<FunctionChange>)], verbose: bool) -> usize {
+    let (mut total, mut new, mut removed, mut more_complex, mut less_complex) = (0, 0, 0, 0, 0);
+
+    for (path, changes) in changes_by_file {
+        if verbose {
+            println!("File: {}", path);
+            println!();
+        }
+
+        for change in changes {
+            total += 1;
+            let Some(after) = &change.after else {
+                removed += 1;
+                let before = change.before.as_ref().expect("removed functions have a previous version");
+                if verbose {
+                    println!("Function: {} (removed)", change.name);
+                    println!("  Status: removed");
+                    println!();
+                } else {
+                    println!(
+                        "   {} [{}] removed (was McCabe: {}, Cognitive: {})",
+                        change.name, path, before.mccabe, before.cognitive
+                    );
+                }
+                continue;
+            };
+
+            let before = change.before.as_ref();
+            match before.map(|b| after.max_complexity().cmp(&b.max_complexity())) {
+                None => new += 1,
+                Some(std::cmp::Ordering::Greater) => more_complex += 1,
+                Some(std::cmp::Ordering::Less) => less_complex += 1,
+                Some(std::cmp::Ordering::Equal) => {}
+            }
+
+            let emoji = get_complexity_emoji(after.max_complexity());
+            let mccabe = delta(after.mccabe, before.map(|b| b.mccabe), 0);
+            let cognitive = delta(after.cognitive, before.map(|b| b.cognitive), 0);
+            let nesting = delta(after.nesting, before.map(|b| b.nesting), 0);
+            let sloc = delta(after.sloc, before.map(|b| b.sloc), 0);
+            let abc = delta(after.abc_magnitude, before.map(|b| b.abc_magnitude), 2);
+            let returns = delta(after.return_count, before.map(|b| b.return_count), 0);
+            let test_score = delta(after.test_scoring.total_score, before.map(|b| b.test_scoring.total_score), 0);
+
+            if verbose {
+                println!("Function: {} {}", change.name, emoji);
+                println!("  Status: {}", if before.is_some() { "changed" } else { "new" });
+                println!("  McCabe Complexity: {}{}", after.mccabe, mccabe);
+                println!("  Cognitive Complexity: {}{}", after.cognitive, cognitive);
+                println!("  Nesting Depth: {}{}", after.nesting, nesting);
+                println!("  SLOC: {}{}", after.sloc, sloc);
+                println!("  ABC Magnitude: {:.2}{}", after.abc_magnitude, abc);
+                println!("  Return Count: {}{}", after.return_count, returns);
+                println!("  Test Scoring: {} ({}){}", after.test_scoring.total_score, after.test_scoring.classification(), test_score);
+                println!("  Max Complexity: {}", after.max_complexity());
+                println!();
+            } else {
+                println!(
+                    "{} {} [{}]{} (McCabe: {}{}, Cognitive: {}{}, Nesting: {}{}, SLOC: {}{}, ABC: {:.2}{}, Returns: {}{}, TestScore: {}{})",
+                    emoji, change.name, path, if before.is_some() { "" } else { " new" },
+                    after.mccabe, mccabe, after.cognitive, cognitive, after.nesting, nesting, after.sloc, sloc,
+                    after.abc_magnitude, abc, after.return_count, returns, after.test_scoring.total_score, test_score
+                );
+            }
+        }
+    }
+
+    println!();
+    println!("Summary:");
+    println!("  Changed Functions: {} ({} new, {} removed)", total, new, removed);
+    println!("  More Complex: {}", more_complex);
+    println!("  Less Complex: {}", less_complex);
+    more_complex
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_unified_diff_line_ranges() {
+        let diff = "\
+diff --git src/a.c src/a.c
+index 1111111..2222222 100644
+--- src/a.c
++++ src/a.c
+@@ -10,2 +10,3 @@ int parse(void)
+--- removed;
+@@ -40 +41,0 @@ int emit(void)
+diff --git src/old.c src/old.c
+deleted file mode 100644
+--- src/old.c
++++ /dev/null
+@@ -1,20 +0,0 @@
+";
+        let files = parse_unified_diff(diff);
+        assert_eq!(files.len(), 2);
+
+        let (path, changes) = &files[0];
+        assert_eq!(path, "src/a.c");
+        assert_eq!(changes.old_lines, vec![10..=11, 40..=40]);
+        assert_eq!(changes.new_lines, vec![10..=12, 41..=42]);
+
+        let (path, changes) = &files[1];
+        assert_eq!(path, "src/old.c");
+        assert_eq!(changes.old_lines, vec![1..=20]);
+
+        // Quoted and space-holding paths as git writes them
+        assert_eq!(unquote("src/my file.c\t"), "src/my file.c");
+        assert_eq!(unquote(r#""src/say \"hi\".c""#), r#"src/say "hi".c"#);
+        assert_eq!(unquote(r#""src/back\\slash\ttab.c""#), "src/back\\slash\ttab.c");
+        assert_eq!(unquote(r#""src/caf\303\251.c""#), "src/café.c");
+    }
+
+    #[test]
+    fn test_only_touched_functions_are_selected() {
+        let located = |functions: &[(&str, usize, usize)]| -> Vec<LocatedFunction> {
+            functions
+                .iter()
+                .map(|&(name, start, end)| LocatedFunction { name: name.to_string(), lines: start..=end })
+                .collect()
+        };
+        let before = located(&[("parse", 1, 10), ("emit", 12, 20), ("gone", 22, 30)]);
+        let after = located(&[("parse", 1, 12), ("emit", 14, 22), ("added", 24, 28)]);
+        let changes = FileChanges {
+            old_lines: vec![5..=5, 25..=30],
+            new_lines: vec![5..=7, 24..=28],
+        };
+
+        let touched: Vec<_> = touched_functions(&changes, &before, &after)
+            .into_iter()
+            .map(|t| (t.before, t.after))
+            .collect();
+        // emit is untouched on both sides, so neither version is measured
+        assert_eq!(touched, vec![(Some(0), Some(0)), (None, Some(2)), (Some(2), None)]);
+    }
+}
@@ -0,0 +1,77 @@
+// Parallel, ignore-aware discovery of C files for recursive mode
+
+use ignore::{WalkBuilder, WalkState};
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+
+use knots::filter::{should_process_file, FilterRules};
+
+/// Per-directory ignore file with .gitignore syntax, read in addition to .gitignore
+pub const IGNORE_FILENAME: &str = ".knotsignore";
+
+/// How recursive mode walks directories
+#[derive(Debug, Clone, Copy)]
+pub struct WalkOptions {
+    pub jobs: usize,
+    /// Honour .gitignore, .git/info/exclude, the global git excludes and .knotsignore
+    pub use_ignore_files: bool,
+}
+
+/// Find every `.c` file under `root` that passes the filters, sorted by path.
+///
+/// Directories are read on `options.jobs` threads. `.git` is never entered, ignored
+/// directories are not descended into, and a directory is pruned outright when an
+/// exclude rule such as `"build/**"` rules out everything beneath it. Symlinks are
+/// followed; symlink loops are detected and skipped.
+pub fn find_c_files(
+    root: &Path,
+    include_rules: &Option<FilterRules>,
+    exclude_rules: &Option<FilterRules>,
+    options: WalkOptions,
+) -> Vec<PathBuf> {
+    let mut builder = WalkBuilder::new(root);
+    builder
+        .follow_links(true)
+        .threads(options.jobs)
+        .standard_filters(options.use_ignore_files)
+        .hidden(false);
+    if options.use_ignore_files {
+        builder.add_custom_ignore_filename(IGNORE_FILENAME);
+    }
+
+    let prune_rules = exclude_rules.clone();
+    builder.filter_entry(move |entry| {
+        if !entry.file_type().is_some_and(|t| t.is_dir()) || entry.depth() == 0 {
+            return true;
+        }
+        if entry.file_name() == ".git" {
+            return false;
+        }
+        match &prune_rules {
+            Some(rules) => !rules.excludes_directory(&entry.path().to_string_lossy()),
+            None => true,
+        }
+    });
+
+    let files = Mutex::new(Vec::new());
+    builder.build_parallel().run(|| {
+        let files = &files;
+        Box::new(move |entry| {
+            // Unreadable directories and symlink loops are skipped, as before
+            let Ok(entry) = entry else { return WalkState::Continue };
+            let path = entry.path();
+            if entry.file_type().is_some_and(|t| t.is_file()) && path.extension().is_some_and(|ext| ext == "c") {
+                let file_str = path.to_string_lossy();
+                if should_process_file(&file_str, include_rules, exclude_rules) {
+                    files.lock().unwrap().push(path.to_path_buf());
+                }
+            }
+            WalkState::Continue
+        })
+    });
+
+    // Threads finish in any order; sort so every run visits files identically
+    let mut files = files.into_inner().unwrap();
+    files.sort();
+    files
+}
@@ -0,0 +1,287 @@
+// Include/exclude filter rules for files and functions, loaded from JSON
+
+use anyhow::{Context, Result};
+use regex::{Regex, RegexSet};
+use serde::{Deserialize, Serialize};
+use std::fs;
+use std::path::Path;
+
+/// Filter rules for including/excluding files and functions
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields)]
+pub struct FilterRules {
+    /// File path patterns (glob-style, supports negation with !)
+    #[serde(default)]
+    pub file_patterns: Vec<String>,
+
+    /// Function name patterns (regex)
+    #[serde(default)]
+    pub function_patterns: Vec<String>,
+
+    /// Minimum complexity threshold (inclusive)
+    #[serde(default)]
+    pub min_complexity: Option<u32>,
+
+    /// Maximum complexity threshold (inclusive)
+    #[serde(default)]
+    pub max_complexity: Option<u32>,
+
+    /// Patterns compiled once at load time
+    #[serde(skip)]
+    compiled: CompiledPatterns,
+}
+
+/// Set-based matchers for a rule file's patterns, so each path or function name is
+/// checked against all patterns in a single pass
+#[derive(Debug, Clone)]
+struct CompiledPatterns {
+    include_files: RegexSet,
+    exclude_files: RegexSet,
+    functions: RegexSet,
+    /// Directories whose entire contents the file patterns match (from `dir/**` patterns)
+    whole_dirs: RegexSet,
+}
+
+impl Default for CompiledPatterns {
+    fn default() -> Self {
+        Self {
+            include_files: RegexSet::empty(),
+            exclude_files: RegexSet::empty(),
+            functions: RegexSet::empty(),
+            whole_dirs: RegexSet::empty(),
+        }
+    }
+}
+
+impl FilterRules {
+    /// Load filter rules from a JSON file
+    pub fn from_file(path: &Path) -> Result<Self> {
+        let content = fs::read_to_string(path)
+            .with_context(|| format!("Failed to read filter file: {}", path.display()))?;
+        let mut rules: FilterRules = serde_json::from_str(&content)
+            .with_context(|| format!("Failed to parse filter JSON: {}", path.display()))?;
+        rules
+            .compile()
+            .with_context(|| format!("Invalid filter rules in {}", path.display()))?;
+        Ok(rules)
+    }
+
+    /// Compile the file and function patterns, rejecting invalid ones. `from_file` does
+    /// this already; rules built any other way must be compiled before use.
+    pub fn compile(&mut self) -> Result<()> {
+        let mut include_files = Vec::new();
+        let mut exclude_files = Vec::new();
+        for pattern in &self.file_patterns {
+            let (target, glob) = match pattern.strip_prefix('!') {
+                Some(neg_pattern) => (&mut exclude_files, neg_pattern),
+                None => (&mut include_files, pattern.as_str()),
+            };
+            let regex = glob_to_regex(glob);
+            Regex::new(&regex).with_context(|| format!("Invalid file pattern '{}'", pattern))?;
+            target.push(regex);
+        }
+
+        for pattern in &self.function_patterns {
+            Regex::new(pattern).with_context(|| format!("Invalid function pattern '{}'", pattern))?;
+        }
+
+        // A negated pattern can carve files back out of a `dir/**` match, so only
+        // claim whole directories when there are none
+        let whole_dirs: Vec<String> = if exclude_files.is_empty() {
+            self.file_patterns
+                .iter()
+                .filter_map(|pattern| pattern.strip_suffix("/**"))
+                .map(glob_to_regex)
+                .collect()
+        } else {
+            Vec::new()
+        };
+
+        self.compiled = CompiledPatterns {
+            include_files: RegexSet::new(&include_files)?,
+            exclude_files: RegexSet::new(&exclude_files)?,
+            functions: RegexSet::new(&self.function_patterns)?,
+            whole_dirs: RegexSet::new(&whole_dirs)?,
+        };
+        Ok(())
+    }
+
+    /// Check if a file path matches the patterns
+    pub fn matches_file(&self, file_path: &str) -> bool {
+        if self.file_patterns.is_empty() {
+            return true;
+        }
+
+        let excluded = self.compiled.exclude_files.is_match(file_path);
+
+        // If we have include patterns, file must match at least one
+        // Then check if it's explicitly excluded
+        if self.compiled.include_files.is_empty() {
+            // No positive patterns, only negative ones
+            !excluded
+        } else {
+            self.compiled.include_files.is_match(file_path) && !excluded
+        }
+    }
+
+    /// Check if the file patterns match every path under `dir`, so an exclude rule can
+    /// prune the directory without visiting it
+    pub fn excludes_directory(&self, dir: &str) -> bool {
+        self.compiled.whole_dirs.is_match(dir)
+    }
+
+    /// Check if a function name matches the patterns
+    pub fn matches_function(&self, function_name: &str) -> bool {
+        if self.function_patterns.is_empty() {
+            return true;
+        }
+
+        self.compiled.functions.is_match(function_name)
+    }
+
+    /// Check if complexity is within bounds
+    pub fn matches_complexity(&self, complexity: u32) -> bool {
+        if let Some(min) = self.min_complexity {
+            if complexity < min {
+                return false;
+            }
+        }
+        if let Some(max) = self.max_complexity {
+            if complexity > max {
+                return false;
+            }
+        }
+        true
+    }
+}
+
+/// Translate a simple glob (supports * and **) into an anchored regex
+fn glob_to_regex(pattern: &str) -> String {
+    let pattern_regex = pattern
+        .replace(".", "\\.")
+        .replace("**", "<!DOUBLESTAR!>")
+        .replace("*", "[^/]*")
+        .replace("<!DOUBLESTAR!>", ".*");
+
+    format!("^{}$", pattern_regex)
+}
+
+/// Check if a file should be processed based on include/exclude rules
+pub fn should_process_file(
+    file_path: &str,
+    include_rules: &Option<FilterRules>,
+    exclude_rules: &Option<FilterRules>,
+) -> bool {
+    // Check include rules first (whitelist)
+    if let Some(rules) = include_rules {
+        if !rules.matches_file(file_path) {
+            return false;
+        }
+    }
+
+    // Check exclude rules (blacklist) - if it matches exclude, DON'T process
+    if let Some(rules) = exclude_rules {
+        if rules.matches_file(file_path) {
+            return false;
+        }
+    }
+
+    true
+}
+
+/// Check if a function should be processed based on include/exclude rules
+pub fn should_process_function(
+    function_name: &str,
+    complexity: u32,
+    include_rules: &Option<FilterRules>,
+    exclude_rules: &Option<FilterRules>,
+) -> bool {
+    // Check include rules first (whitelist)
+    if let Some(rules) = include_rules {
+        if !rules.matches_function(function_name) {
+            return false;
+        }
+        if !rules.matches_complexity(complexity) {
+            return false;
+        }
+    }
+
+    // Check exclude rules (blacklist) - if it matches exclude, DON'T process
+    // Only apply function/complexity filters if they're actually specified
+    if let Some(rules) = exclude_rules {
+        let matches_func = !rules.function_patterns.is_empty() && rules.matches_function(function_name);
+        let matches_complexity = (rules.min_complexity.is_some() || rules.max_complexity.is_some()) && rules.matches_complexity(complexity);
+
+        // If no function patterns specified, only check complexity
+        // If no complexity bounds specified, only check function patterns
+        // If both specified, require both to match
+        let should_exclude = if rules.function_patterns.is_empty() && rules.min_complexity.is_none() && rules.max_complexity.is_none() {
+            // No function-level filters, don't exclude based on function criteria
+            false
+        } else if rules.function_patterns.is_empty() {
+            // Only complexity filter
+            matches_complexity
+        } else if rules.min_complexity.is_none() && rules.max_complexity.is_none() {
+            // Only function pattern filter
+            matches_func
+        } else {
+            // Both specified, require both
+            matches_func && matches_complexity
+        };
+
+        if should_exclude {
+            return false;
+        }
+    }
+
+    true
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn rules(json: &str) -> Result<FilterRules> {
+        let mut rules: FilterRules = serde_json::from_str(json)?;
+        rules.compile()?;
+        Ok(rules)
+    }
+
+    #[test]
+    fn test_compiled_filter_rules() {
+        let filter = rules(r#"{
+            "file_patterns": ["src/**/*.c", "!**/test_*.c"],
+            "function_patterns": ["^parse_", "_init$"]
+        }"#)
+        .unwrap();
+
+        assert!(filter.matches_file("src/core/parser.c"));
+        assert!(!filter.matches_file("src/core/test_parser.c"));
+        assert!(!filter.matches_file("vendor/lib.c"));
+        assert!(filter.matches_function("parse_header"));
+        assert!(filter.matches_function("uart_init"));
+        assert!(!filter.matches_function("main"));
+
+        let negation_only = rules(r#"{"file_patterns": ["!vendor/**"]}"#).unwrap();
+        assert!(negation_only.matches_file("src/main.c"));
+        assert!(!negation_only.matches_file("vendor/lib.c"));
+    }
+
+    #[test]
+    fn test_exclude_prunes_whole_directories() {
+        let filter = rules(r#"{"file_patterns": ["**/build/**", "third_party/**", "**/*_test.c"]}"#).unwrap();
+        assert!(filter.excludes_directory("src/build"));
+        assert!(filter.excludes_directory("third_party"));
+        assert!(!filter.excludes_directory("src"));
+
+        // A negated pattern may re-include files, so nothing is pruned
+        let filter = rules(r#"{"file_patterns": ["third_party/**", "!third_party/keep/*.c"]}"#).unwrap();
+        assert!(!filter.excludes_directory("third_party"));
+    }
+
+    #[test]
+    fn test_invalid_patterns_rejected_at_load() {
+        assert!(rules(r#"{"function_patterns": ["foo("]}"#).is_err());
+        assert!(rules(r#"{"file_patterns": ["src/(*.c"]}"#).is_err());
+    }
+}
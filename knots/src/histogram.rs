@@ -0,0 +1,273 @@
+// Fixed-size log-linear histograms of per-function metrics, overall and per directory,
+// for percentile summaries that take constant memory however many functions a run has
+//
+// Values below 16 get a bucket each. Above that, every power of two is split into 8
+// equal buckets, so a reported percentile is within 12.5% of the exact one (and exact
+// for the small values most functions have). A u32 needs at most 240 buckets, and
+// histograms merge by adding counts, so partial results from threads or shards combine
+// into exactly the histogram a single pass would have built.
+
+use std::collections::BTreeMap;
+use std::path::Path;
+
+use crate::columnar::ColumnarRow;
+
+/// Values below this are counted exactly
+const EXACT_LIMIT: u32 = 16;
+/// Buckets per power of two above `EXACT_LIMIT`, as a power of two
+const SUB_BUCKET_BITS: u32 = 3;
+const SUB_BUCKETS: usize = 1 << SUB_BUCKET_BITS;
+/// log2 of `EXACT_LIMIT`: the first power of two that is split into sub-buckets
+const FIRST_SPLIT_EXPONENT: u32 = 4;
+
+/// Counts of u32 values in log-linear buckets
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct Histogram {
+    /// Grown only as far as the largest bucket used, so small metrics stay small
+    counts: Vec<u64>,
+    total: u64,
+    max: u32,
+}
+
+impl Histogram {
+    pub fn record(&mut self, value: u32) {
+        let index = bucket_index(value);
+        if index >= self.counts.len() {
+            self.counts.resize(index + 1, 0);
+        }
+        self.counts[index] += 1;
+        self.total += 1;
+        self.max = self.max.max(value);
+    }
+
+    /// Add every value recorded in `other`
+    pub fn merge(&mut self, other: &Histogram) {
+        if other.counts.len() > self.counts.len() {
+            self.counts.resize(other.counts.len(), 0);
+        }
+        for (count, &other_count) in self.counts.iter_mut().zip(&other.counts) {
+            *count += other_count;
+        }
+        self.total += other.total;
+        self.max = self.max.max(other.max);
+    }
+
+    pub fn count(&self) -> u64 {
+        self.total
+    }
+
+    pub fn max(&self) -> u32 {
+        self.max
+    }
+
+    /// The value at quantile `q` (0.0 to 1.0): the top of the bucket holding it, capped
+    /// at the largest value recorded. 0 for an empty histogram.
+    pub fn quantile(&self, q: f64) -> u32 {
+        let rank = ((q.clamp(0.0, 1.0) * self.total as f64).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (index, &count) in self.counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return bucket_upper_bound(index).min(self.max);
+            }
+        }
+        0
+    }
+}
+
+fn bucket_index(value: u32) -> usize {
+    if value < EXACT_LIMIT {
+        return value as usize;
+    }
+    let exponent = 31 - value.leading_zeros();
+    let sub_bucket = (value >> (exponent - SUB_BUCKET_BITS)) as usize & (SUB_BUCKETS - 1);
+    EXACT_LIMIT as usize + (exponent - FIRST_SPLIT_EXPONENT) as usize * SUB_BUCKETS + sub_bucket
+}
+
+/// The largest value that falls in bucket `index`
+fn bucket_upper_bound(index: usize) -> u32 {
+    if index < EXACT_LIMIT as usize {
+        return index as u32;
+    }
+    let split = index - EXACT_LIMIT as usize;
+    let exponent = FIRST_SPLIT_EXPONENT + (split / SUB_BUCKETS) as u32;
+    let width_bits = exponent - SUB_BUCKET_BITS;
+    let lower = ((SUB_BUCKETS + split % SUB_BUCKETS) as u64) << width_bits;
+    (lower + (1u64 << width_bits) - 1).min(u32::MAX as u64) as u32
+}
+
+/// Metrics with a distribution. Negative test scores count as 0.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DistributionMetric {
+    McCabe,
+    Cognitive,
+    Nesting,
+    Sloc,
+    ReturnCount,
+    TestScore,
+}
+
+impl DistributionMetric {
+    pub const ALL: [DistributionMetric; 6] = [
+        DistributionMetric::McCabe,
+        DistributionMetric::Cognitive,
+        DistributionMetric::Nesting,
+        DistributionMetric::Sloc,
+        DistributionMetric::ReturnCount,
+        DistributionMetric::TestScore,
+    ];
+
+    pub fn label(self) -> &'static str {
+        match self {
+            DistributionMetric::McCabe => "McCabe",
+            DistributionMetric::Cognitive => "Cognitive",
+            DistributionMetric::Nesting => "Nesting",
+            DistributionMetric::Sloc => "SLOC",
+            DistributionMetric::ReturnCount => "Returns",
+            DistributionMetric::TestScore => "TestScore",
+        }
+    }
+
+    fn value(self, row: &ColumnarRow) -> u32 {
+        match self {
+            DistributionMetric::McCabe => row.mccabe,
+            DistributionMetric::Cognitive => row.cognitive,
+            DistributionMetric::Nesting => row.nesting,
+            DistributionMetric::Sloc => row.sloc,
+            DistributionMetric::ReturnCount => row.return_count,
+            DistributionMetric::TestScore => row.test_scoring.total_score.max(0) as u32,
+        }
+    }
+}
+
+/// One histogram per `DistributionMetric` over a set of functions
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct Distribution {
+    histograms: [Histogram; DistributionMetric::ALL.len()],
+}
+
+impl Distribution {
+    pub fn add(&mut self, row: &ColumnarRow) {
+        for (histogram, metric) in self.histograms.iter_mut().zip(DistributionMetric::ALL) {
+            histogram.record(metric.value(row));
+        }
+    }
+
+    pub fn merge(&mut self, other: &Distribution) {
+        for (histogram, other) in self.histograms.iter_mut().zip(&other.histograms) {
+            histogram.merge(other);
+        }
+    }
+
+    pub fn histogram(&self, metric: DistributionMetric) -> &Histogram {
+        &self.histograms[metric as usize]
+    }
+
+    pub fn function_count(&self) -> u64 {
+        self.histograms[0].count()
+    }
+}
+
+/// Distributions of a whole run and of each directory's functions (not counting
+/// subdirectories), keyed by the directory part of each function's file path
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct DirectoryDistributions {
+    pub overall: Distribution,
+    pub by_directory: BTreeMap<String, Distribution>,
+}
+
+impl DirectoryDistributions {
+    pub fn add(&mut self, row: &ColumnarRow) {
+        self.overall.add(row);
+
+        let directory = Path::new(row.file_path).parent().and_then(Path::to_str).unwrap_or("");
+        let directory = if directory.is_empty() { "." } else { directory };
+        match self.by_directory.get_mut(directory) {
+            Some(distribution) => distribution.add(row),
+            None => self.by_directory.entry(directory.to_string()).or_default().add(row),
+        }
+    }
+
+    pub fn merge(&mut self, other: &DirectoryDistributions) {
+        self.overall.merge(&other.overall);
+        for (directory, distribution) in &other.by_directory {
+            self.by_directory.entry(directory.clone()).or_default().merge(distribution);
+        }
+    }
+
+    /// Up to `count` directories, worst first by `metric`'s p90, then its p99 and then
+    /// the number of functions; ties keep directory order
+    pub fn hot_spots(&self, metric: DistributionMetric, count: usize) -> Vec<(&str, &Distribution)> {
+        let mut directories: Vec<_> = self.by_directory.iter().map(|(name, dist)| (name.as_str(), dist)).collect();
+        directories.sort_by_key(|(_, dist)| {
+            let histogram = dist.histogram(metric);
+            std::cmp::Reverse((histogram.quantile(0.9), histogram.quantile(0.99), histogram.count()))
+        });
+        directories.truncate(count);
+        directories
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::complexity::TestScoringMetric;
+
+    #[test]
+    fn test_quantiles_within_bucket_error_and_merge_exactly() {
+        // Every bucket's bounds line up with its neighbours'
+        for index in 1..bucket_index(u32::MAX) {
+            assert_eq!(bucket_index(bucket_upper_bound(index)), index);
+            assert_eq!(bucket_index(bucket_upper_bound(index - 1) + 1), index);
+        }
+        assert_eq!(bucket_upper_bound(bucket_index(u32::MAX)), u32::MAX);
+
+        let mut low = Histogram::default();
+        let mut high = Histogram::default();
+        for value in 1..=1000 {
+            let half = if value <= 500 { &mut low } else { &mut high };
+            half.record(value);
+        }
+        let mut all = low.clone();
+        all.merge(&high);
+        assert_eq!(all.count(), 1000);
+        assert_eq!(all.max(), 1000);
+        for (q, exact) in [(0.5, 500.0), (0.9, 900.0), (0.99, 990.0)] {
+            let estimate = all.quantile(q) as f64;
+            assert!(estimate >= exact && estimate <= exact * 1.125, "p{} = {}", q * 100.0, estimate);
+        }
+        assert_eq!(all.quantile(1.0), 1000);
+
+        // Small values are exact
+        let mut small = Histogram::default();
+        [1, 1, 2, 3, 9].into_iter().for_each(|value| small.record(value));
+        assert_eq!((small.quantile(0.5), small.quantile(0.9), small.quantile(0.0)), (2, 9, 1));
+        assert_eq!(Histogram::default().quantile(0.5), 0);
+
+        // Per-directory distributions merge into what one pass builds
+        let row = |file_path, mccabe| ColumnarRow {
+            name: "f",
+            file_path,
+            mccabe,
+            cognitive: 0,
+            nesting: 0,
+            sloc: 1,
+            abc_magnitude: 0.0,
+            return_count: 0,
+            test_scoring: TestScoringMetric { total_score: -3, ..Default::default() },
+        };
+        let rows = [row("src/a.c", 2), row("src/net/b.c", 30), row("main.c", 1), row("src/c.c", 4)];
+        let mut single = DirectoryDistributions::default();
+        rows.iter().for_each(|r| single.add(r));
+        let (mut first, mut second) = (DirectoryDistributions::default(), DirectoryDistributions::default());
+        rows[..2].iter().for_each(|r| first.add(r));
+        rows[2..].iter().for_each(|r| second.add(r));
+        first.merge(&second);
+        assert_eq!(first, single);
+
+        let hot: Vec<_> = single.hot_spots(DistributionMetric::McCabe, 2).into_iter().map(|(dir, _)| dir).collect();
+        assert_eq!(hot, vec!["src/net", "src"]);
+        assert_eq!(single.by_directory["."].function_count(), 1);
+        assert_eq!(single.overall.histogram(DistributionMetric::TestScore).max(), 0);
+    }
+}
@@ -1,9 +1,26 @@
 // knots library - shared complexity calculation functions
 
+pub mod analysis;
+pub mod catalog;
+pub mod columnar;
 pub mod complexity;
+pub mod filter;
+pub mod histogram;
+pub mod limits;
+pub mod parser;
+pub mod source;
+pub mod store;
+pub mod syntax;
+
+pub use analysis::{AnalysisSession, FunctionMetrics};
+pub use filter::FilterRules;
+pub use store::MetricsStore;
 
 // Re-export complexity functions for use by workspace members
-pub use complexity::{calculate_mccabe_complexity, calculate_cognitive_complexity};
+pub use complexity::{
+    calculate_all_metrics, calculate_cognitive_complexity, calculate_mccabe_complexity,
+    FunctionComplexity,
+};
 
 // Re-export tree-sitter for convenience
 pub use tree_sitter;
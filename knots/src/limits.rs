@@ -0,0 +1,359 @@
+// Resource limits for pathological input: file size caps, parse timeouts, a run-wide
+// deadline and declaration-at-a-time analysis of oversized files
+
+use anyhow::Result;
+use std::fmt;
+use std::ops::Range;
+use std::time::{Duration, Instant};
+use tree_sitter::Tree;
+
+use crate::analysis::{measure_functions, FunctionMetrics};
+use crate::parser::{parse_c, parse_c_with_timeout};
+
+/// Limits applied to every file of a run. The default imposes none.
+#[derive(Debug, Clone, Default)]
+pub struct FileLimits {
+    /// Files larger than this many bytes are skipped, or split when `split_large_files` is set
+    pub max_file_size: Option<u64>,
+    /// Wall-clock budget for parsing one file
+    pub parse_timeout: Option<Duration>,
+    /// Once this passes, parses in progress give up and later files are skipped
+    pub deadline: Option<Instant>,
+    /// Analyze files over `max_file_size` in pieces of about that size, each a run of
+    /// whole top-level declarations, instead of skipping them
+    pub split_large_files: bool,
+}
+
+/// Why a file was not analyzed
+#[derive(Debug, Clone, PartialEq)]
+pub enum SkipReason {
+    TooLarge { size: u64, limit: u64 },
+    ParseTimeout(Duration),
+    DeadlinePassed,
+    ParseFailed,
+}
+
+impl fmt::Display for SkipReason {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            SkipReason::TooLarge { size, limit } => write!(f, "file is {} bytes, over the {} byte limit", size, limit),
+            SkipReason::ParseTimeout(timeout) => write!(f, "parsing took longer than {} ms", timeout.as_millis()),
+            SkipReason::DeadlinePassed => write!(f, "run deadline passed"),
+            SkipReason::ParseFailed => write!(f, "failed to parse"),
+        }
+    }
+}
+
+/// A step of `FileLimits::measure`, reported as it finishes for each piece so callers
+/// can time parsing and measurement separately
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Stage {
+    Parsed,
+    Measured,
+}
+
+impl FileLimits {
+    /// Why a file of `size` bytes is skipped without being read any further, if it is
+    pub fn check_size(&self, size: u64) -> Option<SkipReason> {
+        match self.max_file_size {
+            Some(limit) if size > limit && !self.split_large_files => Some(SkipReason::TooLarge { size, limit }),
+            _ => None,
+        }
+    }
+
+    /// Parse and measure one file's source within the limits, before filtering. The
+    /// outer error is fatal to the run; the inner one skips just this file.
+    pub fn measure(
+        &self,
+        source_code: &[u8],
+        mut on_stage: impl FnMut(Stage),
+    ) -> Result<Result<Vec<FunctionMetrics>, SkipReason>> {
+        let mut functions = Vec::new();
+        let parsed = self.visit_trees(source_code, |tree, piece| {
+            on_stage(Stage::Parsed);
+            functions.extend(measure_functions(tree, piece));
+            on_stage(Stage::Measured);
+        })?;
+        Ok(parsed.map(|()| functions))
+    }
+
+    /// Parse one file's source within the limits and call `visit` with each tree and the
+    /// source it was parsed from: the whole file, or each piece of a split file in turn.
+    /// Errors are as for `measure`; a skip may come after some pieces were visited.
+    pub fn visit_trees(
+        &self,
+        source_code: &[u8],
+        mut visit: impl FnMut(&Tree, &[u8]),
+    ) -> Result<Result<(), SkipReason>> {
+        let started = Instant::now();
+        let size = source_code.len() as u64;
+
+        match self.max_file_size {
+            Some(limit) if size > limit && self.split_large_files => {
+                for piece in split_top_level(source_code, limit as usize) {
+                    // Each piece's tree is dropped before the next is parsed, so memory
+                    // tracks the piece size rather than the file size
+                    if let Err(reason) = self.visit_piece(&source_code[piece], started, &mut visit)? {
+                        return Ok(Err(reason));
+                    }
+                }
+                Ok(Ok(()))
+            }
+            _ => match self.check_size(size) {
+                Some(reason) => Ok(Err(reason)),
+                None => self.visit_piece(source_code, started, &mut visit),
+            },
+        }
+    }
+
+    /// Parse one piece and visit its tree, charging the parse to the file started at
+    /// `started`
+    fn visit_piece(
+        &self,
+        source_code: &[u8],
+        started: Instant,
+        visit: &mut impl FnMut(&Tree, &[u8]),
+    ) -> Result<Result<(), SkipReason>> {
+        let now = Instant::now();
+        let timeout_left = self.parse_timeout.map(|timeout| timeout.saturating_sub(now - started));
+        let deadline_left = self.deadline.map(|deadline| deadline.saturating_duration_since(now));
+
+        let tree = match (timeout_left, deadline_left) {
+            (_, Some(left)) if left.is_zero() => return Ok(Err(SkipReason::DeadlinePassed)),
+            (Some(left), _) if left.is_zero() => {
+                return Ok(Err(SkipReason::ParseTimeout(self.parse_timeout.unwrap_or_default())))
+            }
+            (None, None) => parse_c(source_code)?,
+            (Some(timeout), None) | (None, Some(timeout)) => parse_c_with_timeout(source_code, timeout)?,
+            (Some(a), Some(b)) => parse_c_with_timeout(source_code, a.min(b))?,
+        };
+
+        let Some(tree) = tree else {
+            // Tree-sitter only gives up on a budget; report whichever one ran out
+            let reason = if self.deadline.is_some_and(|deadline| Instant::now() >= deadline) {
+                SkipReason::DeadlinePassed
+            } else if let Some(timeout) = self.parse_timeout {
+                SkipReason::ParseTimeout(timeout)
+            } else {
+                SkipReason::ParseFailed
+            };
+            return Ok(Err(reason));
+        };
+        visit(&tree, source_code);
+        Ok(Ok(()))
+    }
+}
+
+/// Split C source into consecutive pieces of at least `target` bytes (except the last),
+/// each ending after a top-level declaration, so every function lies within one piece.
+///
+/// The scan tracks braces, parentheses and `#if` nesting, skipping comments, string and
+/// character literals and the rest of preprocessor lines. A top-level `}` ends a
+/// declaration only when its `{` followed a `)` (a function body) or a string literal
+/// (`extern "C"`); other braces (struct, union and enum bodies, initializers) end at the
+/// next top-level `;`, after their declarators. A name right after a top-level `)`
+/// starts the parameter declarations of an old-style (K&R) definition, whose `;`s end
+/// nothing until the body's `{`. A single declaration longer than `target` stays whole.
+/// Macros with unbalanced braces can defeat the scan; the pieces are still parsed, just
+/// with the error recovery tree-sitter applies to any broken code.
+pub fn split_top_level(source: &[u8], target: usize) -> Vec<Range<usize>> {
+    let mut pieces = Vec::new();
+    let mut start = 0;
+    let mut braces = 0usize;
+    let mut parens = 0usize;
+    let mut conditionals = 0usize;
+    let mut line_start = true;
+    // The last byte that was not whitespace or part of a comment
+    let mut previous = b';';
+    // Whether the open top-level brace was a function body or `extern "C"` block
+    let mut body_block = false;
+    // Inside the parameter declarations between a K&R definition's `)` and its body
+    let mut knr_parameters = false;
+    let mut i = 0;
+
+    while i < source.len() {
+        let byte = source[i];
+        let mut next = i + 1;
+        let mut boundary = false;
+        let comment = byte == b'/' && matches!(source.get(next), Some(b'/' | b'*'));
+        let significant = !byte.is_ascii_whitespace() && !comment;
+
+        if significant && braces == 0 && parens == 0 && previous == b')' {
+            knr_parameters = byte.is_ascii_alphabetic() || byte == b'_';
+        }
+
+        match byte {
+            b'/' if source.get(next) == Some(&b'/') => next = skip_line(source, i),
+            b'/' if source.get(next) == Some(&b'*') => {
+                next = find(source, i + 2, b"*/").map_or(source.len(), |end| end + 2);
+            }
+            b'"' | b'\'' => next = skip_literal(source, i),
+            b'#' if line_start => {
+                let directive = directive_name(source, next);
+                if directive.starts_with(b"if") {
+                    conditionals += 1;
+                } else if directive == b"endif" {
+                    conditionals = conditionals.saturating_sub(1);
+                }
+                next = skip_line(source, i);
+                boundary = braces == 0 && parens == 0;
+            }
+            b'{' => {
+                if braces == 0 && parens == 0 {
+                    body_block = matches!(previous, b')' | b'"') || (knr_parameters && previous == b';');
+                    knr_parameters = false;
+                }
+                braces += 1;
+            }
+            b'}' => {
+                braces = braces.saturating_sub(1);
+                boundary = braces == 0 && parens == 0 && body_block;
+            }
+            b'(' => parens += 1,
+            b')' => parens = parens.saturating_sub(1),
+            b';' => boundary = braces == 0 && parens == 0 && !knr_parameters,
+            _ => {}
+        }
+
+        if significant {
+            previous = byte;
+        }
+        i = next.min(source.len());
+        // A directive starts a line, possibly after indentation
+        line_start = source[i - 1] == b'\n' || (line_start && byte.is_ascii_whitespace());
+
+        if boundary && conditionals == 0 && i - start >= target {
+            pieces.push(start..i);
+            start = i;
+        }
+    }
+
+    // Trailing blank lines join the last piece
+    match pieces.last_mut() {
+        Some(last) if source[start..].iter().all(u8::is_ascii_whitespace) => last.end = source.len(),
+        _ => pieces.push(start..source.len()),
+    }
+    pieces
+}
+
+/// Index just past the end of the (possibly backslash-continued) line containing `i`
+fn skip_line(source: &[u8], mut i: usize) -> usize {
+    while i < source.len() {
+        match source[i] {
+            b'\\' => i += 2,
+            b'\n' => return i + 1,
+            _ => i += 1,
+        }
+    }
+    source.len()
+}
+
+/// Index just past the string or character literal starting at `i`. An unterminated
+/// literal ends at the end of its line, as the compiler would report it.
+fn skip_literal(source: &[u8], i: usize) -> usize {
+    let quote = source[i];
+    let mut j = i + 1;
+    while j < source.len() {
+        match source[j] {
+            b'\\' => j += 2,
+            b'\n' => return j,
+            byte if byte == quote => return j + 1,
+            _ => j += 1,
+        }
+    }
+    source.len()
+}
+
+/// The directive word after a `#`, e.g. `ifdef`
+fn directive_name(source: &[u8], i: usize) -> &[u8] {
+    let rest = &source[i.min(source.len())..];
+    let start = rest.iter().position(|b| *b != b' ' && *b != b'\t').unwrap_or(rest.len());
+    let rest = &rest[start..];
+    let len = rest.iter().position(|b| !b.is_ascii_alphabetic()).unwrap_or(rest.len());
+    &rest[..len]
+}
+
+fn find(source: &[u8], from: usize, needle: &[u8]) -> Option<usize> {
+    source
+        .get(from..)?
+        .windows(needle.len())
+        .position(|window| window == needle)
+        .map(|offset| from + offset)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_spent_limits_skip_without_parsing() {
+        let mut limits = FileLimits {
+            max_file_size: Some(8),
+            ..FileLimits::default()
+        };
+        let mut visited = 0;
+        let skipped = limits.visit_trees(b"int f(void) { return 0; }", |_, _| visited += 1).unwrap();
+        assert_eq!(skipped, Err(SkipReason::TooLarge { size: 25, limit: 8 }));
+
+        limits.max_file_size = None;
+        limits.deadline = Some(Instant::now());
+        let skipped = limits.visit_trees(b"int x;", |_, _| visited += 1).unwrap();
+        assert_eq!(skipped, Err(SkipReason::DeadlinePassed));
+        assert_eq!(visited, 0);
+    }
+
+    #[test]
+    fn test_split_keeps_declarations_whole() {
+        let source = b"int a(void) { if (x) { return '}'; } return 0; }\n\
+#ifdef DEBUG\nvoid b(void) { /* } */ }\n#endif\n\
+static const char *s = \"};\";\n\
+void c(void) { for (;;) {} }\n";
+        let text = |range: &Range<usize>| std::str::from_utf8(&source[range.clone()]).unwrap().trim();
+
+        let pieces = split_top_level(source, 1);
+        let texts: Vec<_> = pieces.iter().map(text).collect();
+        assert_eq!(
+            texts,
+            vec![
+                "int a(void) { if (x) { return '}'; } return 0; }",
+                "#ifdef DEBUG\nvoid b(void) { /* } */ }\n#endif",
+                "static const char *s = \"};\";",
+                "void c(void) { for (;;) {} }",
+            ]
+        );
+
+        // Pieces cover the source without gaps and grow to the target size
+        assert_eq!(pieces.first().unwrap().start, 0);
+        assert!(pieces.windows(2).all(|pair| pair[0].end == pair[1].start));
+        assert_eq!(pieces.last().unwrap().end, source.len());
+        assert_eq!(split_top_level(source, source.len()), vec![0..source.len()]);
+        assert_eq!(split_top_level(source, 60).len(), 2);
+    }
+
+    #[test]
+    fn test_split_waits_for_declarators_after_braces() {
+        let source = b"typedef struct {\n    int x;\n} point_t;\n\
+struct S { int y; } s, *p;\n\
+static const int table[] = { 1, 2, 3 };\n\
+int f(void) /* body */ { return 0; }\n\
+enum color { RED, GREEN };\n\
+int knr(a, b) int a; char *b; /* old style */\n{ return a; }\n\
+int after;\n";
+        let pieces: Vec<_> = split_top_level(source, 1)
+            .into_iter()
+            .map(|range| std::str::from_utf8(&source[range]).unwrap().trim())
+            .collect();
+        assert_eq!(
+            pieces,
+            vec![
+                "typedef struct {\n    int x;\n} point_t;",
+                "struct S { int y; } s, *p;",
+                "static const int table[] = { 1, 2, 3 };",
+                "int f(void) /* body */ { return 0; }",
+                "enum color { RED, GREEN };",
+                "int knr(a, b) int a; char *b; /* old style */\n{ return a; }",
+                "int after;",
+            ]
+        );
+    }
+}
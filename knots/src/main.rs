@@ -1,19 +1,35 @@
 use anyhow::{Context, Result};
-use clap::Parser;
-use regex::Regex;
-use serde::{Deserialize, Serialize};
-use std::fs;
-use std::io::Write;
-use std::path::{Path, PathBuf};
-use tree_sitter::{Node, Tree, TreeCursor};
-use walkdir::WalkDir;
-
-mod complexity;
-use complexity::{
-    calculate_abc_complexity, calculate_cognitive_complexity, calculate_mccabe_complexity,
-    calculate_nesting_depth, calculate_return_count, calculate_sloc, calculate_test_scoring,
-    TestScoringMetric,
-};
+use clap::{Parser, Subcommand};
+use std::path::PathBuf;
+use std::time::{Duration, Instant};
+
+use cache::MetricsCache;
+use discover::WalkOptions;
+use knots::analysis::{filter_function_metrics, FunctionMetrics};
+use knots::catalog::ApiCatalog;
+use knots::columnar::{self, ColumnarRow, ColumnarWriter};
+use knots::filter::{should_process_file, FilterRules};
+use knots::histogram::{DirectoryDistributions, DistributionMetric};
+use knots::limits::{FileLimits, Stage};
+use knots::source::SourceReader;
+use knots::store::{MetricTotals, MetricsStore};
+use pipeline::{DedupMode, FileCounts, PipelineConfig};
+use report::{ReportWriter, SummaryStats};
+use timings::{Phase, Timings};
+
+mod baseline;
+mod cache;
+mod check;
+mod compile_db;
+mod diff;
+mod discover;
+mod pipeline;
+mod report;
+#[cfg(unix)]
+mod serve;
+mod shard;
+mod timings;
+mod watch;
 
 fn get_complexity_emoji(complexity: u32) -> &'static str {
     match complexity {
@@ -24,156 +40,247 @@ fn get_complexity_emoji(complexity: u32) -> &'static str {
     }
 }
 
-/// Compilation database entry from compile_commands.json
-#[derive(Debug, Clone, Deserialize)]
-struct CompileCommand {
-    #[serde(default)]
-    directory: String,
-    #[serde(default)]
-    _command: String,
-    file: String,
-    #[serde(default)]
-    #[serde(rename = "arguments")]
-    _arguments: Vec<String>,
-}
+#[derive(Parser, Debug)]
+#[command(name = "knots")]
+#[command(version = env!("CARGO_PKG_VERSION"))]
+#[command(about = "Analyzes C code complexity with visual indicators: 😊 (1-10), 😐 (11-20), 😠 (21-49), 😢 (50+)", long_about = None)]
+#[command(args_conflicts_with_subcommands = true, subcommand_negates_reqs = true)]
+struct Args {
+    #[command(subcommand)]
+    command: Option<Command>,
 
-/// Filter rules for including/excluding files and functions
-#[derive(Debug, Clone, Serialize, Deserialize)]
-#[serde(deny_unknown_fields)]
-pub struct FilterRules {
-    /// File path patterns (glob-style, supports negation with !)
-    #[serde(default)]
-    pub file_patterns: Vec<String>,
-
-    /// Function name patterns (regex)
-    #[serde(default)]
-    pub function_patterns: Vec<String>,
-
-    /// Minimum complexity threshold (inclusive)
-    #[serde(default)]
-    pub min_complexity: Option<u32>,
-
-    /// Maximum complexity threshold (inclusive)
-    #[serde(default)]
-    pub max_complexity: Option<u32>,
-}
+    /// Path to the C file or directory to analyze
+    #[arg(value_name = "FILE", required_unless_present_any = ["compile_commands", "diff", "staged"])]
+    file: Option<PathBuf>,
 
-impl FilterRules {
-    /// Load filter rules from a JSON file
-    fn from_file(path: &Path) -> Result<Self> {
-        let content = fs::read_to_string(path)
-            .with_context(|| format!("Failed to read filter file: {}", path.display()))?;
-        let rules: FilterRules = serde_json::from_str(&content)
-            .with_context(|| format!("Failed to parse filter JSON: {}", path.display()))?;
-        Ok(rules)
-    }
+    /// Recursively process all C files in directories
+    #[arg(short, long)]
+    recursive: bool,
 
-    /// Check if a file path matches the patterns
-    fn matches_file(&self, file_path: &str) -> bool {
-        if self.file_patterns.is_empty() {
-            return true;
-        }
+    /// Use compile_commands.json to get list of files to analyze
+    #[arg(long, value_name = "FILE", conflicts_with = "file")]
+    compile_commands: Option<PathBuf>,
 
-        let mut included = false;
-        let mut excluded = false;
+    /// Show detailed per-function analysis
+    #[arg(short, long)]
+    verbose: bool,
 
-        for pattern in &self.file_patterns {
-            if let Some(neg_pattern) = pattern.strip_prefix('!') {
-                // Negation pattern - exclude
-                if glob_match(neg_pattern, file_path) {
-                    excluded = true;
-                }
-            } else {
-                // Include pattern
-                if glob_match(pattern, file_path) {
-                    included = true;
-                }
-            }
-        }
+    /// Show testability matrix categorization
+    #[arg(short, long)]
+    matrix: bool,
 
-        // If we have include patterns, file must match at least one
-        // Then check if it's explicitly excluded
-        if !self.file_patterns.iter().any(|p| !p.starts_with('!')) {
-            // No positive patterns, only negative ones
-            !excluded
-        } else {
-            included && !excluded
-        }
-    }
+    /// Do not skip files matched by .gitignore or .knotsignore when scanning directories
+    #[arg(long)]
+    no_ignore: bool,
 
-    /// Check if a function name matches the patterns
-    fn matches_function(&self, function_name: &str) -> bool {
-        if self.function_patterns.is_empty() {
-            return true;
-        }
+    /// Keep running and refresh the summary (or matrix) whenever a file under FILE changes
+    #[arg(short, long, requires = "file", conflicts_with_all = ["max_file_size", "split_large_files", "parse_timeout_ms", "deadline_secs"])]
+    watch: bool,
 
-        for pattern in &self.function_patterns {
-            if let Ok(re) = Regex::new(pattern) {
-                if re.is_match(function_name) {
-                    return true;
-                }
-            }
-        }
+    /// Measure only functions changed by a git revision or range (REV, A..B or A...B),
+    /// with before/after deltas; FILE optionally limits the diff to one path
+    #[arg(long, value_name = "REV", conflicts_with_all = ["staged", "watch", "matrix", "compile_commands", "max_file_size", "split_large_files", "parse_timeout_ms", "deadline_secs"])]
+    diff: Option<String>,
 
-        false
-    }
+    /// Measure only functions changed by the staged diff, with before/after deltas
+    #[arg(long, conflicts_with_all = ["watch", "matrix", "compile_commands", "max_file_size", "split_large_files", "parse_timeout_ms", "deadline_secs"])]
+    staged: bool,
 
-    /// Check if complexity is within bounds
-    fn matches_complexity(&self, complexity: u32) -> bool {
-        if let Some(min) = self.min_complexity {
-            if complexity < min {
-                return false;
-            }
-        }
-        if let Some(max) = self.max_complexity {
-            if complexity > max {
-                return false;
-            }
-        }
-        true
-    }
+    /// Include filter rules from JSON file (whitelist files/functions)
+    #[arg(long, value_name = "FILE")]
+    include: Option<PathBuf>,
+
+    /// Exclude filter rules from JSON file (blacklist files/functions)
+    #[arg(long, value_name = "FILE")]
+    exclude: Option<PathBuf>,
+
+    /// API catalog JSON mapping function names to side effects for the test scores
+    #[arg(long, value_name = "FILE")]
+    api_catalog: Option<PathBuf>,
+
+    /// Maximum number of worker threads for multi-file analysis (0 = one per CPU)
+    #[arg(short, long, value_name = "N", default_value_t = 0)]
+    jobs: usize,
+
+    /// Cache per-file metrics in DIR, keyed by content hash, to skip unchanged files on re-runs
+    #[arg(long, value_name = "DIR")]
+    cache_dir: Option<PathBuf>,
+
+    /// Also write all function metrics to FILE in the compact columnar binary format
+    #[arg(long, value_name = "FILE")]
+    columnar: Option<PathBuf>,
+
+    /// Print time spent per phase, the slowest files and peak memory to stderr
+    #[arg(long, conflicts_with_all = ["watch", "diff", "staged"])]
+    timings: bool,
+
+    /// Write the same timings as JSON to FILE, for charting in CI
+    #[arg(long, value_name = "FILE", conflicts_with_all = ["watch", "diff", "staged"])]
+    timings_json: Option<PathBuf>,
+
+    /// Analyze only shard I of N (a fixed subset of the files, chosen by path hash) and
+    /// write partial results for `knots merge` instead of the normal output
+    #[arg(long, value_name = "I/N", requires = "shard_output", conflicts_with_all = ["watch", "diff", "staged", "matrix", "columnar"])]
+    shard: Option<shard::Shard>,
+
+    /// Where --shard writes its partial results
+    #[arg(long, value_name = "FILE", requires = "shard")]
+    shard_output: Option<PathBuf>,
+
+    /// Save every function's metrics and a hash of its normalized text to FILE as a
+    /// baseline for --compare-baseline
+    #[arg(long, value_name = "FILE", conflicts_with_all = ["watch", "diff", "staged", "matrix", "shard", "compare_baseline", "cache_dir"])]
+    save_baseline: Option<PathBuf>,
+
+    /// Report only functions whose McCabe, cognitive or test score got worse since the
+    /// baseline in FILE; exits with status 1 if any did
+    #[arg(long, value_name = "FILE", conflicts_with_all = ["watch", "diff", "staged", "matrix", "shard", "cache_dir"])]
+    compare_baseline: Option<PathBuf>,
+
+    /// Also print p50/p90/p99 of each metric and the directories with the worst McCabe
+    /// distributions
+    #[arg(long, conflicts_with_all = ["watch", "diff", "staged", "shard", "save_baseline", "compare_baseline"])]
+    distribution: bool,
+
+    /// Measure files with identical contents (e.g. vendored copies) once: `collapse`
+    /// reports the first and counts the rest as copies, `expand` reports every copy
+    #[arg(long, value_name = "MODE", conflicts_with_all = ["watch", "diff", "staged", "shard", "save_baseline", "compare_baseline"])]
+    dedup: Option<DedupMode>,
+
+    #[command(flatten)]
+    limits: LimitArgs,
 }
 
-/// Simple glob matching (supports * and **)
-fn glob_match(pattern: &str, path: &str) -> bool {
-    let pattern_regex = pattern
-        .replace(".", "\\.")
-        .replace("**", "<!DOUBLESTAR!>")
-        .replace("*", "[^/]*")
-        .replace("<!DOUBLESTAR!>", ".*");
+/// Limits that keep pathological files (e.g. generated register maps) from stalling a run
+#[derive(clap::Args, Debug)]
+struct LimitArgs {
+    /// Skip files larger than BYTES
+    #[arg(long, value_name = "BYTES")]
+    max_file_size: Option<u64>,
+
+    /// Analyze files over --max-file-size in pieces of whole top-level declarations
+    /// instead of skipping them, keeping memory bounded
+    #[arg(long, requires = "max_file_size")]
+    split_large_files: bool,
+
+    /// Skip a file whose parse takes longer than MS milliseconds
+    #[arg(long, value_name = "MS")]
+    parse_timeout_ms: Option<u64>,
+
+    /// Give up on parsing SECS seconds after the run starts; files not analyzed by then
+    /// are skipped
+    #[arg(long, value_name = "SECS")]
+    deadline_secs: Option<u64>,
+}
 
-    if let Ok(re) = Regex::new(&format!("^{}$", pattern_regex)) {
-        re.is_match(path)
-    } else {
-        false
+impl LimitArgs {
+    /// The limits for a run starting now
+    fn file_limits(&self) -> FileLimits {
+        FileLimits {
+            max_file_size: self.max_file_size,
+            parse_timeout: self.parse_timeout_ms.map(Duration::from_millis),
+            deadline: self.deadline_secs.map(|secs| Instant::now() + Duration::from_secs(secs)),
+            split_large_files: self.split_large_files,
+        }
     }
 }
 
-#[derive(Parser, Debug)]
-#[command(name = "knots")]
-#[command(version = env!("CARGO_PKG_VERSION"))]
-#[command(about = "Analyzes C code complexity with visual indicators: 😊 (1-10), 😐 (11-20), 😠 (21-49), 😢 (50+)", long_about = None)]
-struct Args {
-    /// Path to the C file or directory to analyze
-    #[arg(value_name = "FILE", required_unless_present = "compile_commands")]
-    file: Option<PathBuf>,
+#[derive(Subcommand, Debug)]
+enum Command {
+    /// Run a daemon that answers analysis requests over a Unix socket with warm caches
+    Serve(ServeArgs),
+    /// Check files against complexity thresholds, printing only violations; exits with
+    /// status 1 if any function exceeds a threshold or a file cannot be analyzed
+    Check(CheckArgs),
+    /// Combine the partial results of every --shard of a run into the report, summary
+    /// or matrix a single-node run would print
+    Merge(MergeArgs),
+}
 
-    /// Recursively process all C files in directories
-    #[arg(short, long)]
-    recursive: bool,
+#[derive(clap::Args, Debug)]
+struct CheckArgs {
+    /// C files to check; paths that are not files (e.g. deleted in the commit) are ignored
+    #[arg(value_name = "FILE")]
+    files: Vec<PathBuf>,
 
-    /// Use compile_commands.json to get list of files to analyze
-    #[arg(long, value_name = "FILE", conflicts_with = "file")]
-    compile_commands: Option<PathBuf>,
+    /// Maximum McCabe complexity per function
+    #[arg(long, value_name = "N", default_value_t = 15)]
+    mccabe_threshold: u32,
 
-    /// Show detailed per-function analysis
+    /// Maximum cognitive complexity per function
+    #[arg(long, value_name = "N", default_value_t = 15)]
+    cognitive_threshold: u32,
+
+    /// Maximum nesting depth per function
+    #[arg(long, value_name = "N", default_value_t = 5)]
+    nesting_threshold: u32,
+
+    /// Maximum source lines of code per function
+    #[arg(long, value_name = "N", default_value_t = 50)]
+    sloc_threshold: u32,
+
+    /// Maximum ABC magnitude per function
+    #[arg(long, value_name = "X", default_value_t = 10.0)]
+    abc_threshold: f64,
+
+    /// Maximum number of return statements per function
+    #[arg(long, value_name = "N", default_value_t = 3)]
+    return_threshold: u32,
+
+    /// Also list files that pass
     #[arg(short, long)]
     verbose: bool,
 
+    /// Include filter rules from JSON file (whitelist files/functions)
+    #[arg(long, value_name = "FILE")]
+    include: Option<PathBuf>,
+
+    /// Exclude filter rules from JSON file (blacklist files/functions)
+    #[arg(long, value_name = "FILE")]
+    exclude: Option<PathBuf>,
+
+    /// API catalog JSON mapping function names to side effects for the test scores
+    #[arg(long, value_name = "FILE")]
+    api_catalog: Option<PathBuf>,
+
+    /// Maximum number of worker threads (0 = one per CPU)
+    #[arg(short, long, value_name = "N", default_value_t = 0)]
+    jobs: usize,
+
+    #[command(flatten)]
+    limits: LimitArgs,
+}
+
+#[derive(clap::Args, Debug)]
+struct MergeArgs {
+    /// Partial results files written by --shard-output, one per shard, in any order
+    #[arg(value_name = "PARTIAL", required = true)]
+    partials: Vec<PathBuf>,
+
     /// Show testability matrix categorization
     #[arg(short, long)]
     matrix: bool,
 
+    /// Write detailed per-function entries to report.txt
+    #[arg(short, long)]
+    verbose: bool,
+
+    /// Also write all function metrics to FILE in the compact columnar binary format
+    #[arg(long, value_name = "FILE")]
+    columnar: Option<PathBuf>,
+
+    /// Also print p50/p90/p99 of each metric and the directories with the worst McCabe
+    /// distributions
+    #[arg(long)]
+    distribution: bool,
+}
+
+#[derive(clap::Args, Debug)]
+struct ServeArgs {
+    /// Unix socket to listen on
+    #[arg(long, value_name = "PATH", default_value = ".knots.sock")]
+    socket: PathBuf,
+
     /// Include filter rules from JSON file (whitelist files/functions)
     #[arg(long, value_name = "FILE")]
     include: Option<PathBuf>,
@@ -181,10 +288,29 @@ struct Args {
     /// Exclude filter rules from JSON file (blacklist files/functions)
     #[arg(long, value_name = "FILE")]
     exclude: Option<PathBuf>,
+
+    /// API catalog JSON mapping function names to side effects for the test scores
+    #[arg(long, value_name = "FILE")]
+    api_catalog: Option<PathBuf>,
+
+    /// Number of worker threads serving clients (0 = one per CPU)
+    #[arg(short, long, value_name = "N", default_value_t = 0)]
+    jobs: usize,
 }
 
 fn main() -> Result<()> {
     let args = Args::parse();
+    // The deadline counts from here, before any files are discovered
+    let limits = args.limits.file_limits();
+
+    match &args.command {
+        Some(Command::Serve(serve_args)) => return run_serve(serve_args),
+        Some(Command::Check(check_args)) => return run_check(check_args),
+        Some(Command::Merge(merge_args)) => return run_merge(merge_args),
+        None => {}
+    }
+
+    install_api_catalog(&args.api_catalog)?;
 
     // Load filter rules
     let include_rules = if let Some(path) = &args.include {
@@ -199,171 +325,310 @@ fn main() -> Result<()> {
         None
     };
 
+    if args.diff.is_some() || args.staged {
+        let config = diff::DiffConfig {
+            source: match &args.diff {
+                Some(range) => diff::DiffSource::Revisions(range.clone()),
+                None => diff::DiffSource::Staged,
+            },
+            path: args.file.as_ref(),
+            verbose: args.verbose,
+            include_rules: &include_rules,
+            exclude_rules: &exclude_rules,
+        };
+        if diff::run(&config)? > 0 {
+            std::process::exit(1);
+        }
+        return Ok(());
+    }
+
+    let jobs = pipeline::resolve_jobs(args.jobs);
+    let walk_options = WalkOptions {
+        jobs,
+        use_ignore_files: !args.no_ignore,
+    };
+
+    if args.watch {
+        let config = watch::WatchConfig {
+            path: args.file.as_ref().expect("--watch requires FILE"),
+            matrix: args.matrix,
+            verbose: args.verbose,
+            include_rules: &include_rules,
+            exclude_rules: &exclude_rules,
+            walk: walk_options,
+        };
+        return watch::run(&config);
+    }
+
+    let timings = Timings::new(args.timings || args.timings_json.is_some());
+    run_analysis(&args, &include_rules, &exclude_rules, jobs, walk_options, &limits, &timings)?;
+
+    if args.timings {
+        timings.print();
+    }
+    if let Some(path) = &args.timings_json {
+        timings.write_json(path)?;
+    }
+
+    Ok(())
+}
+
+/// Load the --api-catalog file, if given, before anything is measured
+fn install_api_catalog(path: &Option<PathBuf>) -> Result<()> {
+    match path {
+        Some(path) => ApiCatalog::from_file(path)?.install(),
+        None => Ok(()),
+    }
+}
+
+/// Analyze a single file, a directory or a compilation database and print the results
+fn run_analysis(
+    args: &Args,
+    include_rules: &Option<FilterRules>,
+    exclude_rules: &Option<FilterRules>,
+    jobs: usize,
+    walk_options: WalkOptions,
+    limits: &FileLimits,
+    timings: &Timings,
+) -> Result<()> {
     // Collect files to process
-    let files = if let Some(compile_commands_path) = &args.compile_commands {
-        // Load files from compile_commands.json
-        load_compile_commands(compile_commands_path, &include_rules, &exclude_rules)?
-    } else if let Some(file_path) = &args.file {
-        // Use regular file/directory path
-        collect_files(file_path, args.recursive, &include_rules, &exclude_rules)?
-    } else {
-        anyhow::bail!("Either FILE or --compile-commands must be specified");
+    let files = timings.time(Phase::Discover, || {
+        if let Some(compile_commands_path) = &args.compile_commands {
+            // Load files from compile_commands.json
+            compile_db::load_compile_commands(compile_commands_path, include_rules, exclude_rules, jobs)
+        } else if let Some(file_path) = &args.file {
+            // Use regular file/directory path
+            collect_files(file_path, args.recursive, include_rules, exclude_rules, walk_options)
+        } else {
+            anyhow::bail!("Either FILE or --compile-commands must be specified");
+        }
+    })?;
+
+    let cache = match &args.cache_dir {
+        Some(dir) => Some(MetricsCache::open(dir)?),
+        None => None,
     };
 
+    let config = PipelineConfig {
+        include_rules,
+        exclude_rules,
+        cache: cache.as_ref(),
+        timings,
+        limits,
+        dedup: args.dedup,
+    };
+
+    if let (Some(shard), Some(output)) = (args.shard, &args.shard_output) {
+        shard::run(&files, shard, output, jobs, &config)?;
+        return Ok(());
+    }
+
+    if let Some(path) = &args.save_baseline {
+        return baseline::save(&files, path, jobs, &config);
+    }
+    if let Some(path) = &args.compare_baseline {
+        let summary = baseline::compare(&files, path, jobs, &config, args.verbose)?;
+        if summary.regressed > 0 {
+            std::process::exit(1);
+        }
+        return Ok(());
+    }
+
     // For matrix mode
     if args.matrix {
-        let mut all_metrics = Vec::new();
-        let mut skipped_files = 0;
-
-        for file in &files {
-            let source_code = match fs::read_to_string(file) {
-                Ok(code) => code,
-                Err(e) => {
-                    eprintln!("Warning: Skipping {}: {}", file.display(), e);
-                    skipped_files += 1;
-                    continue;
-                }
-            };
-
-            let mut parser = tree_sitter::Parser::new();
-            parser
-                .set_language(&tree_sitter_c::language())
-                .context("Failed to set C language")?;
-
-            let tree = match parser.parse(&source_code, None) {
-                Some(t) => t,
-                None => {
-                    eprintln!("Warning: Failed to parse {}", file.display());
-                    skipped_files += 1;
-                    continue;
-                }
-            };
+        let (store, counts) = pipeline::collect_metrics(&files, jobs, &config)?;
 
-            let metrics = collect_function_metrics(&tree, &source_code, file.to_str().unwrap_or(""), &include_rules, &exclude_rules);
-            all_metrics.extend(metrics);
+        if store.is_empty() {
+            anyhow::bail!("No functions found in any files (skipped {} files)", counts.skipped);
         }
 
-        if all_metrics.is_empty() {
-            anyhow::bail!("No functions found in any files (skipped {} files)", skipped_files);
-        }
+        return timings.time(Phase::Report, || {
+            if let Some(path) = &args.columnar {
+                columnar::write_store_file(&store, path)?;
+            }
 
-        display_testability_matrix(&all_metrics, files.len(), skipped_files);
-        return Ok(());
+            display_testability_matrix(&store, &counts);
+            if args.distribution {
+                display_distribution(&store_distributions(&store));
+            }
+            Ok(())
+        });
     }
 
     // For single file mode, use traditional output
     if files.len() == 1 {
         let file = &files[0];
-        let source_code = fs::read_to_string(file)
+        let mut reader = SourceReader::new();
+        let mut timer = timings.file_timer();
+        let source_code = reader
+            .read(file)
             .with_context(|| format!("Failed to read file: {}", file.display()))?;
+        timer.bytes = source_code.len() as u64;
+        timer.lap(Phase::Read);
+
+        let functions = limits
+            .measure(&source_code, |stage| match stage {
+                Stage::Parsed => timer.lap(Phase::Parse),
+                Stage::Measured => timer.lap(Phase::Metrics),
+            })?
+            .map_err(|reason| anyhow::anyhow!("Could not analyze {}: {}", file.display(), reason))?;
+        timer.functions = functions.len();
+
+        let metrics = filter_function_metrics(functions, "", include_rules, exclude_rules);
+        timer.lap(Phase::Filter);
+        timings.record_file(file, timer);
+
+        return timings.time(Phase::Report, || {
+            print_file_metrics(&metrics, args.verbose);
+
+            if let Some(path) = &args.columnar {
+                let file_path = file.to_string_lossy();
+                let mut columns = ColumnarWriter::new();
+                for func in &metrics {
+                    columns.push(&ColumnarRow { file_path: &file_path, ..func.columnar_row() });
+                }
+                columns.write_file(path)?;
+            }
+            Ok(())
+        });
+    }
+
+    // For recursive mode with multiple files: stream each file's functions into
+    // report.txt as it completes, keeping only running totals for the summary
+    let mut report = ReportWriter::new(args.verbose);
+    let mut stats = SummaryStats::default();
+    let mut columns = args.columnar.as_ref().map(|_| ColumnarWriter::new());
+    let mut distributions = args.distribution.then(DirectoryDistributions::default);
+    let mut counts = FileCounts::new(files.len());
+
+    pipeline::for_each_outcome(&files, jobs, &config, |outcome| {
+        timings.time(Phase::Report, || {
+            if let Some(functions) = counts.record(outcome) {
+                functions.iter().for_each(|func| stats.add(func));
+                if let Some(columns) = &mut columns {
+                    functions.iter().for_each(|func| columns.push(&func.columnar_row()));
+                }
+                if let Some(distributions) = &mut distributions {
+                    functions.iter().for_each(|func| distributions.add(&func.columnar_row()));
+                }
+                report.write_functions(&functions)?;
+            }
+            Ok(())
+        })
+    })?;
 
-        let mut parser = tree_sitter::Parser::new();
-        parser
-            .set_language(&tree_sitter_c::language())
-            .context("Failed to set C language")?;
-
-        let tree = parser
-            .parse(&source_code, None)
-            .with_context(|| format!("Failed to parse C code in {}", file.display()))?;
+    timings.time(Phase::Report, || {
+        report.finish()?;
 
-        analyze_code(&tree, &source_code, args.verbose, &include_rules, &exclude_rules)?;
-        return Ok(());
-    }
+        if let (Some(path), Some(columns)) = (&args.columnar, &columns) {
+            columns.write_file(path)?;
+        }
 
-    // For recursive mode with multiple files: collect all metrics, write report, show summary
-    let mut all_metrics = Vec::new();
-    let mut skipped_files = 0;
-
-    for file in &files {
-        let source_code = match fs::read_to_string(file) {
-            Ok(code) => code,
-            Err(e) => {
-                eprintln!("Warning: Skipping {}: {}", file.display(), e);
-                skipped_files += 1;
-                continue;
-            }
-        };
+        if stats.totals.function_count == 0 {
+            anyhow::bail!("No functions found in any files (skipped {} files)", counts.skipped);
+        }
 
-        let mut parser = tree_sitter::Parser::new();
-        parser
-            .set_language(&tree_sitter_c::language())
-            .context("Failed to set C language")?;
-
-        let tree = match parser.parse(&source_code, None) {
-            Some(t) => t,
-            None => {
-                eprintln!("Warning: Failed to parse {}", file.display());
-                skipped_files += 1;
-                continue;
-            }
-        };
+        // Display summary with top 5 worst functions and totals/averages
+        display_recursive_summary(&stats.totals, &stats.worst_functions(), &counts);
+        if let Some(distributions) = &distributions {
+            display_distribution(distributions);
+        }
+        Ok(())
+    })
+}
 
-        let metrics = collect_function_metrics(&tree, &source_code, file.to_str().unwrap_or(""), &include_rules, &exclude_rules);
-        all_metrics.extend(metrics);
-    }
+/// Gate files on the complexity thresholds, exiting with status 1 on any violation
+fn run_check(args: &CheckArgs) -> Result<()> {
+    install_api_catalog(&args.api_catalog)?;
+    let include_rules = args.include.as_deref().map(FilterRules::from_file).transpose()?;
+    let exclude_rules = args.exclude.as_deref().map(FilterRules::from_file).transpose()?;
+
+    let files: Vec<PathBuf> = args
+        .files
+        .iter()
+        .filter(|path| path.is_file())
+        .filter(|path| should_process_file(&path.to_string_lossy(), &include_rules, &exclude_rules))
+        .cloned()
+        .collect();
+
+    let thresholds = check::Thresholds {
+        mccabe: args.mccabe_threshold,
+        cognitive: args.cognitive_threshold,
+        nesting: args.nesting_threshold,
+        sloc: args.sloc_threshold,
+        abc: args.abc_threshold,
+        return_count: args.return_threshold,
+    };
+    let timings = Timings::new(false);
+    let limits = args.limits.file_limits();
+    let config = PipelineConfig {
+        include_rules: &include_rules,
+        exclude_rules: &exclude_rules,
+        cache: None,
+        timings: &timings,
+        limits: &limits,
+        dedup: None,
+    };
 
-    if all_metrics.is_empty() {
-        anyhow::bail!("No functions found in any files (skipped {} files)", skipped_files);
+    let summary = check::run(&files, &thresholds, pipeline::resolve_jobs(args.jobs), &config, args.verbose)?;
+    if !summary.passed() {
+        std::process::exit(1);
     }
 
-    // Write detailed report to file
-    write_detailed_report(&all_metrics, args.verbose)?;
-
-    // Display summary with top 5 worst functions and totals/averages
-    display_recursive_summary(&all_metrics, files.len(), skipped_files);
-
     Ok(())
 }
 
-/// Load file paths from compile_commands.json
-fn load_compile_commands(
-    compile_commands_path: &Path,
-    include_rules: &Option<FilterRules>,
-    exclude_rules: &Option<FilterRules>,
-) -> Result<Vec<PathBuf>> {
-    let content = fs::read_to_string(compile_commands_path)
-        .with_context(|| format!("Failed to read compile_commands.json: {}", compile_commands_path.display()))?;
-
-    let commands: Vec<CompileCommand> = serde_json::from_str(&content)
-        .with_context(|| format!("Failed to parse compile_commands.json: {}", compile_commands_path.display()))?;
+/// Print a sharded run's combined results, as the unsharded run would have
+fn run_merge(args: &MergeArgs) -> Result<()> {
+    let merged = shard::merge(&args.partials)?;
+    let store = &merged.store;
+    let counts = FileCounts {
+        skipped: merged.skipped_files,
+        ..FileCounts::new(merged.total_files)
+    };
+    if store.is_empty() {
+        anyhow::bail!("No functions found in any files (skipped {} files)", merged.skipped_files);
+    }
 
-    let mut files = Vec::new();
+    if let Some(path) = &args.columnar {
+        columnar::write_store_file(store, path)?;
+    }
 
-    for cmd in commands {
-        let file_path = PathBuf::from(&cmd.file);
-
-        // Only process C files
-        if let Some(ext) = file_path.extension() {
-            if ext == "c" {
-                let file_str = file_path.to_string_lossy();
-                if should_process_file(&file_str, include_rules, exclude_rules) {
-                    // Use absolute path if available, otherwise relative
-                    if file_path.is_absolute() {
-                        files.push(file_path);
-                    } else {
-                        // Try to make it absolute using the directory from compile command
-                        let abs_path = if !cmd.directory.is_empty() {
-                            PathBuf::from(&cmd.directory).join(&file_path)
-                        } else {
-                            file_path.clone()
-                        };
-
-                        if abs_path.exists() {
-                            files.push(abs_path);
-                        } else if file_path.exists() {
-                            files.push(file_path);
-                        }
-                    }
-                }
-            }
+    if args.matrix {
+        display_testability_matrix(store, &counts);
+        if args.distribution {
+            display_distribution(&store_distributions(store));
         }
+        return Ok(());
     }
 
-    if files.is_empty() {
-        anyhow::bail!("No .c files found in compile_commands.json");
+    let mut report = ReportWriter::new(args.verbose);
+    report.write_rows(store.rows())?;
+    report.finish()?;
+
+    let worst: Vec<ColumnarRow> = store.worst(report::TOP_FUNCTIONS).into_iter().map(|row| store.row(row)).collect();
+    display_recursive_summary(&store.totals(), &worst, &counts);
+    if args.distribution {
+        display_distribution(&store_distributions(store));
     }
+    Ok(())
+}
 
-    Ok(files)
+#[cfg(unix)]
+fn run_serve(args: &ServeArgs) -> Result<()> {
+    install_api_catalog(&args.api_catalog)?;
+    let config = serve::ServeConfig {
+        socket: args.socket.clone(),
+        include_rules: args.include.as_deref().map(FilterRules::from_file).transpose()?,
+        exclude_rules: args.exclude.as_deref().map(FilterRules::from_file).transpose()?,
+        workers: pipeline::resolve_jobs(args.jobs),
+    };
+    serve::run(config)
+}
+
+#[cfg(not(unix))]
+fn run_serve(_args: &ServeArgs) -> Result<()> {
+    anyhow::bail!("knots serve requires Unix domain sockets, which this platform does not support")
 }
 
 /// Collect files to process based on the path and recursive flag
@@ -372,6 +637,7 @@ fn collect_files(
     recursive: bool,
     include_rules: &Option<FilterRules>,
     exclude_rules: &Option<FilterRules>,
+    walk: WalkOptions,
 ) -> Result<Vec<PathBuf>> {
     let mut files = Vec::new();
 
@@ -391,23 +657,7 @@ fn collect_files(
 
         // Recursive directory mode - only scan .c files by default
         // (headers often contain inline/vendor code)
-        for entry in WalkDir::new(path)
-            .follow_links(true)
-            .into_iter()
-            .filter_map(|e| e.ok())
-        {
-            let file_path = entry.path();
-            if file_path.is_file() {
-                if let Some(ext) = file_path.extension() {
-                    if ext == "c" {
-                        let file_str = file_path.to_string_lossy();
-                        if should_process_file(&file_str, include_rules, exclude_rules) {
-                            files.push(file_path.to_path_buf());
-                        }
-                    }
-                }
-            }
-        }
+        files = discover::find_c_files(path, include_rules, exclude_rules, walk);
 
         if files.is_empty() {
             anyhow::bail!("No .c files found in directory: {}", path.display());
@@ -419,131 +669,8 @@ fn collect_files(
     Ok(files)
 }
 
-/// Check if a file should be processed based on include/exclude rules
-fn should_process_file(
-    file_path: &str,
-    include_rules: &Option<FilterRules>,
-    exclude_rules: &Option<FilterRules>,
-) -> bool {
-    // Check include rules first (whitelist)
-    if let Some(rules) = include_rules {
-        if !rules.matches_file(file_path) {
-            return false;
-        }
-    }
-
-    // Check exclude rules (blacklist) - if it matches exclude, DON'T process
-    if let Some(rules) = exclude_rules {
-        if rules.matches_file(file_path) {
-            return false;
-        }
-    }
-
-    true
-}
-
-/// Collect function metrics from a file
-fn collect_function_metrics(
-    tree: &Tree,
-    source_code: &str,
-    file_path: &str,
-    include_rules: &Option<FilterRules>,
-    exclude_rules: &Option<FilterRules>,
-) -> Vec<FunctionMetrics> {
-    let root_node = tree.root_node();
-    let mut cursor = root_node.walk();
-    let mut metrics = Vec::new();
-
-    visit_functions(&mut cursor, source_code, &mut |node, src| {
-        if let Some(name) = get_function_name(node, src) {
-            let mccabe = calculate_mccabe_complexity(node, src.as_bytes());
-            let cognitive = calculate_cognitive_complexity(node, src.as_bytes());
-            let nesting = calculate_nesting_depth(node);
-            let sloc = calculate_sloc(node, src.as_bytes());
-            let abc = calculate_abc_complexity(node, src.as_bytes());
-            let abc_magnitude = abc.magnitude();
-            let return_count = calculate_return_count(node);
-            let test_scoring = calculate_test_scoring(node, src.as_bytes());
-
-            let max_complexity = std::cmp::max(mccabe, cognitive);
-
-            // Apply filter rules
-            if should_process_function(&name, max_complexity, include_rules, exclude_rules) {
-                metrics.push(FunctionMetrics {
-                    name,
-                    file_path: file_path.to_string(),
-                    mccabe,
-                    cognitive,
-                    nesting,
-                    sloc,
-                    abc_magnitude,
-                    return_count,
-                    test_scoring,
-                });
-            }
-        }
-    });
-
-    metrics
-}
-
-/// Check if a function should be processed based on include/exclude rules
-fn should_process_function(
-    function_name: &str,
-    complexity: u32,
-    include_rules: &Option<FilterRules>,
-    exclude_rules: &Option<FilterRules>,
-) -> bool {
-    // Check include rules first (whitelist)
-    if let Some(rules) = include_rules {
-        if !rules.matches_function(function_name) {
-            return false;
-        }
-        if !rules.matches_complexity(complexity) {
-            return false;
-        }
-    }
-
-    // Check exclude rules (blacklist) - if it matches exclude, DON'T process
-    // Only apply function/complexity filters if they're actually specified
-    if let Some(rules) = exclude_rules {
-        let matches_func = !rules.function_patterns.is_empty() && rules.matches_function(function_name);
-        let matches_complexity = (rules.min_complexity.is_some() || rules.max_complexity.is_some()) && rules.matches_complexity(complexity);
-
-        // If no function patterns specified, only check complexity
-        // If no complexity bounds specified, only check function patterns
-        // If both specified, require both to match
-        let should_exclude = if rules.function_patterns.is_empty() && rules.min_complexity.is_none() && rules.max_complexity.is_none() {
-            // No function-level filters, don't exclude based on function criteria
-            false
-        } else if rules.function_patterns.is_empty() {
-            // Only complexity filter
-            matches_complexity
-        } else if rules.min_complexity.is_none() && rules.max_complexity.is_none() {
-            // Only function pattern filter
-            matches_func
-        } else {
-            // Both specified, require both
-            matches_func && matches_complexity
-        };
-
-        if should_exclude {
-            return false;
-        }
-    }
-
-    true
-}
-
-fn analyze_code(
-    tree: &Tree,
-    source_code: &str,
-    verbose: bool,
-    include_rules: &Option<FilterRules>,
-    exclude_rules: &Option<FilterRules>,
-) -> Result<()> {
-    let metrics = collect_function_metrics(tree, source_code, "", include_rules, exclude_rules);
-
+/// Print one file's (already filtered) functions and the file summary
+fn print_file_metrics(metrics: &[FunctionMetrics], verbose: bool) {
     let mut total_mccabe = 0;
     let mut total_cognitive = 0;
     let mut total_nesting = 0;
@@ -552,7 +679,7 @@ fn analyze_code(
     let mut total_return_count = 0;
     let mut total_test_score: i64 = 0;
 
-    for func in &metrics {
+    for func in metrics {
         total_mccabe += func.mccabe;
         total_cognitive += func.cognitive;
         total_nesting += func.nesting;
@@ -610,54 +737,13 @@ fn analyze_code(
         println!("  Average Return Count: {:.2}", total_return_count as f64 / function_count as f64);
         println!("  Average Test Score: {:.2}", total_test_score as f64 / function_count as f64);
     }
-
-    Ok(())
-}
-
-/// Write detailed report to report.txt for recursive analysis
-fn write_detailed_report(all_metrics: &[FunctionMetrics], verbose: bool) -> Result<()> {
-    let mut file = fs::File::create("report.txt")
-        .context("Failed to create report.txt")?;
-
-    for func in all_metrics {
-        let emoji = get_complexity_emoji(func.max_complexity());
-
-        if verbose {
-            writeln!(file, "Function: {} {} [{}]", func.name, emoji, func.file_path)?;
-            writeln!(file, "  McCabe Complexity: {}", func.mccabe)?;
-            writeln!(file, "  Cognitive Complexity: {}", func.cognitive)?;
-            writeln!(file, "  Nesting Depth: {}", func.nesting)?;
-            writeln!(file, "  SLOC: {}", func.sloc)?;
-            writeln!(file, "  ABC Magnitude: {:.2}", func.abc_magnitude)?;
-            writeln!(file, "  Return Count: {}", func.return_count)?;
-            writeln!(file, "  Test Scoring: {} ({})", func.test_scoring.total_score, func.test_scoring.classification())?;
-            writeln!(file, "    - Signature: {}", func.test_scoring.signature_score)?;
-            writeln!(file, "    - Dependency: {}", func.test_scoring.dependency_score)?;
-            writeln!(file, "    - Observable: {}", func.test_scoring.observable_score)?;
-            writeln!(file, "    - Implementation: {}", func.test_scoring.implementation_score)?;
-            writeln!(file, "    - Documentation: {}", func.test_scoring.documentation_score)?;
-            writeln!(file, "  Max Complexity: {}", func.max_complexity())?;
-            writeln!(file)?;
-        } else {
-            writeln!(
-                file,
-                "{} {} [{}] (McCabe: {}, Cognitive: {}, Nesting: {}, SLOC: {}, ABC: {:.2}, Returns: {}, TestScore: {})",
-                emoji, func.name, func.file_path, func.mccabe, func.cognitive, func.nesting, func.sloc, func.abc_magnitude, func.return_count, func.test_scoring.total_score
-            )?;
-        }
-    }
-
-    Ok(())
 }
 
 /// Display summary with top 5 worst functions and totals/averages
-fn display_recursive_summary(all_metrics: &[FunctionMetrics], total_files: usize, skipped_files: usize) {
-    // Sort by worst complexity (max of McCabe and Cognitive)
-    let mut sorted = all_metrics.to_vec();
-    sorted.sort_by(|a, b| b.max_complexity().cmp(&a.max_complexity()));
-
+fn display_recursive_summary(totals: &MetricTotals, worst: &[ColumnarRow], counts: &FileCounts) {
+    // Worst complexity is the max of McCabe and Cognitive
     println!("\n=== TOP 5 WORST FUNCTIONS ===\n");
-    for (i, func) in sorted.iter().take(5).enumerate() {
+    for (i, func) in worst.iter().enumerate() {
         let emoji = get_complexity_emoji(func.max_complexity());
         println!(
             "{}. {} {} [{}]",
@@ -671,26 +757,16 @@ fn display_recursive_summary(all_metrics: &[FunctionMetrics], total_files: usize
         );
     }
 
-    // Calculate totals and averages
-    let mut total_mccabe: u64 = 0;
-    let mut total_cognitive: u64 = 0;
-    let mut total_nesting: u64 = 0;
-    let mut total_sloc: u64 = 0;
-    let mut total_abc_magnitude = 0.0;
-    let mut total_return_count: u64 = 0;
-    let mut total_test_score: i64 = 0;
-
-    for func in all_metrics {
-        total_mccabe += func.mccabe as u64;
-        total_cognitive += func.cognitive as u64;
-        total_nesting += func.nesting as u64;
-        total_sloc += func.sloc as u64;
-        total_abc_magnitude += func.abc_magnitude;
-        total_return_count += func.return_count as u64;
-        total_test_score += func.test_scoring.total_score as i64;
-    }
-
-    let function_count = all_metrics.len();
+    let MetricTotals {
+        function_count,
+        total_mccabe,
+        total_cognitive,
+        total_nesting,
+        total_sloc,
+        total_abc_magnitude,
+        total_return_count,
+        total_test_score,
+    } = *totals;
 
     println!("\n=== TOTALS & AVERAGES ===\n");
     println!("  Total Functions: {}", function_count);
@@ -715,200 +791,129 @@ fn display_recursive_summary(all_metrics: &[FunctionMetrics], total_files: usize
 
     println!("\nDetailed per-function output written to report.txt");
     println!("\n=== FILES PROCESSED ===\n");
-    println!("  Total files found: {}", total_files);
-    println!("  Successfully processed: {}", total_files - skipped_files);
-    if skipped_files > 0 {
-        println!("  Skipped (encoding/parse errors): {}", skipped_files);
-    }
-}
-
-#[derive(Debug, Clone)]
-struct FunctionMetrics {
-    name: String,
-    file_path: String,
-    mccabe: u32,
-    cognitive: u32,
-    nesting: u32,
-    sloc: u32,
-    abc_magnitude: f64,
-    return_count: u32,
-    test_scoring: TestScoringMetric,
-}
-
-impl FunctionMetrics {
-    fn max_complexity(&self) -> u32 {
-        std::cmp::max(self.mccabe, self.cognitive)
-    }
+    display_file_counts(counts);
 }
 
 /// Display testability matrix for all functions
-fn display_testability_matrix(all_metrics: &[FunctionMetrics], total_files: usize, skipped_files: usize) {
+fn display_testability_matrix(store: &MetricsStore, counts: &FileCounts) {
     // Categorize functions into quadrants
-    let mut quick_wins = Vec::new();
-    let mut invest_tests = Vec::new();
-    let mut add_docs = Vec::new();
-    let mut refactor = Vec::new();
-
-    for func in all_metrics {
-        let low_complexity = func.mccabe <= 10;
-        let easy_to_test = func.test_scoring.total_score <= 10;
-
-        match (low_complexity, easy_to_test) {
-            (true, true) => quick_wins.push(func),
-            (false, true) => invest_tests.push(func),
-            (true, false) => add_docs.push(func),
-            (false, false) => refactor.push(func),
-        }
-    }
+    let matrix = store.matrix();
 
     // Print matrix results
     println!("\n=== TESTABILITY MATRIX ===\n");
 
     println!("📊 QUICK WINS (Low Complexity, Easy to Test) - Automate!");
     println!("=========================================================");
-    if quick_wins.is_empty() {
-        println!("  (none)");
-    } else {
-        for func in &quick_wins {
-            if func.file_path.is_empty() {
-                println!("  ✓ {} (McCabe: {}, TestScore: {})", func.name, func.mccabe, func.test_scoring.total_score);
-            } else {
-                println!("  ✓ {} [{}] (McCabe: {}, TestScore: {})", func.name, func.file_path, func.mccabe, func.test_scoring.total_score);
-            }
-        }
-    }
+    print_quadrant(store, &matrix.quick_wins, "✓");
     println!();
 
     println!("🎯 INVEST IN TESTS (High Complexity, Easy to Test)");
     println!("==================================================");
-    if invest_tests.is_empty() {
-        println!("  (none)");
-    } else {
-        for func in &invest_tests {
-            if func.file_path.is_empty() {
-                println!("  → {} (McCabe: {}, TestScore: {})", func.name, func.mccabe, func.test_scoring.total_score);
-            } else {
-                println!("  → {} [{}] (McCabe: {}, TestScore: {})", func.name, func.file_path, func.mccabe, func.test_scoring.total_score);
-            }
-        }
-    }
+    print_quadrant(store, &matrix.invest_tests, "→");
     println!();
 
     println!("📝 ADD DOCS (Low Complexity, Hard to Test)");
     println!("===========================================");
-    if add_docs.is_empty() {
-        println!("  (none)");
-    } else {
-        for func in &add_docs {
-            if func.file_path.is_empty() {
-                println!("  ⚠ {} (McCabe: {}, TestScore: {})", func.name, func.mccabe, func.test_scoring.total_score);
-            } else {
-                println!("  ⚠ {} [{}] (McCabe: {}, TestScore: {})", func.name, func.file_path, func.mccabe, func.test_scoring.total_score);
-            }
-        }
-    }
+    print_quadrant(store, &matrix.add_docs, "⚠");
     println!();
 
     println!("🚨 REFACTOR (High Complexity, Hard to Test) - HIGH RISK!");
     println!("========================================================");
-    if refactor.is_empty() {
-        println!("  (none)");
-    } else {
-        for func in &refactor {
-            if func.file_path.is_empty() {
-                println!("  ⛔ {} (McCabe: {}, TestScore: {})", func.name, func.mccabe, func.test_scoring.total_score);
-            } else {
-                println!("  ⛔ {} [{}] (McCabe: {}, TestScore: {})", func.name, func.file_path, func.mccabe, func.test_scoring.total_score);
-            }
-        }
-    }
+    print_quadrant(store, &matrix.refactor, "⛔");
     println!();
 
     // Print summary
     println!("=== SUMMARY ===\n");
-    println!("  Quick Wins:    {} functions", quick_wins.len());
-    println!("  Invest Tests:  {} functions", invest_tests.len());
-    println!("  Add Docs:      {} functions", add_docs.len());
-    println!("  Refactor:      {} functions", refactor.len());
-    println!("  Total:         {} functions", all_metrics.len());
+    println!("  Quick Wins:    {} functions", matrix.quick_wins.len());
+    println!("  Invest Tests:  {} functions", matrix.invest_tests.len());
+    println!("  Add Docs:      {} functions", matrix.add_docs.len());
+    println!("  Refactor:      {} functions", matrix.refactor.len());
+    println!("  Total:         {} functions", store.len());
 
-    if total_files > 1 {
+    if counts.total > 1 {
         println!();
         println!("=== FILES PROCESSED ===\n");
-        println!("  Total files found: {}", total_files);
-        println!("  Successfully processed: {}", total_files - skipped_files);
-        if skipped_files > 0 {
-            println!("  Skipped (encoding/parse errors): {}", skipped_files);
-        }
+        display_file_counts(counts);
     }
 }
 
-fn visit_functions<F>(cursor: &mut TreeCursor, source_code: &str, callback: &mut F)
-where
-    F: FnMut(Node, &str),
-{
-    let node = cursor.node();
-
-    if node.kind() == "function_definition" {
-        callback(node, source_code);
-    }
+/// Number of directories listed under DIRECTORY HOT SPOTS
+const HOT_SPOT_DIRECTORIES: usize = 10;
 
-    if cursor.goto_first_child() {
-        loop {
-            visit_functions(cursor, source_code, callback);
-            if !cursor.goto_next_sibling() {
-                break;
-            }
-        }
-        cursor.goto_parent();
-    }
+fn store_distributions(store: &MetricsStore) -> DirectoryDistributions {
+    let mut distributions = DirectoryDistributions::default();
+    store.rows().for_each(|row| distributions.add(&row));
+    distributions
 }
 
-fn get_function_name(node: Node, source_code: &str) -> Option<String> {
-    let mut cursor = node.walk();
-
-    for child in node.children(&mut cursor) {
-        if child.kind() == "function_declarator" {
-            return get_declarator_name(child, source_code);
-        } else if child.kind() == "pointer_declarator" {
-            // For functions returning pointers, the function_declarator is nested inside
-            if let Some(name) = get_function_name_from_declarator(child, source_code) {
-                return Some(name);
-            }
-        }
+/// Display percentiles of every metric, then the directories with the worst McCabe p90
+fn display_distribution(distributions: &DirectoryDistributions) {
+    println!("\n=== DISTRIBUTION ===\n");
+    println!("  {:<10} {:>6} {:>6} {:>6} {:>6}", "Metric", "p50", "p90", "p99", "Max");
+    for metric in DistributionMetric::ALL {
+        let histogram = distributions.overall.histogram(metric);
+        println!(
+            "  {:<10} {:>6} {:>6} {:>6} {:>6}",
+            metric.label(),
+            histogram.quantile(0.5),
+            histogram.quantile(0.9),
+            histogram.quantile(0.99),
+            histogram.max()
+        );
     }
 
-    None
+    println!("\n=== DIRECTORY HOT SPOTS (by McCabe p90) ===\n");
+    for (i, (directory, distribution)) in distributions
+        .hot_spots(DistributionMetric::McCabe, HOT_SPOT_DIRECTORIES)
+        .into_iter()
+        .enumerate()
+    {
+        let mccabe = distribution.histogram(DistributionMetric::McCabe);
+        let cognitive = distribution.histogram(DistributionMetric::Cognitive);
+        println!("{}. {} {} ({} functions)", i + 1, get_complexity_emoji(mccabe.quantile(0.9)), directory, mccabe.count());
+        println!(
+            "   McCabe p50/p90/p99: {}/{}/{}, Cognitive p50/p90/p99: {}/{}/{}, Max McCabe: {}",
+            mccabe.quantile(0.5),
+            mccabe.quantile(0.9),
+            mccabe.quantile(0.99),
+            cognitive.quantile(0.5),
+            cognitive.quantile(0.9),
+            cognitive.quantile(0.99),
+            mccabe.max()
+        );
+    }
 }
 
-fn get_function_name_from_declarator(node: Node, source_code: &str) -> Option<String> {
-    let mut cursor = node.walk();
+fn display_file_counts(counts: &FileCounts) {
+    println!("  Total files found: {}", counts.total);
+    println!("  Successfully processed: {}", counts.total - counts.skipped);
+    if !counts.copies.is_empty() {
+        println!("  Identical copies (counted once): {}", counts.duplicates());
 
-    for child in node.children(&mut cursor) {
-        if child.kind() == "function_declarator" {
-            return get_declarator_name(child, source_code);
-        } else if child.kind() == "pointer_declarator" {
-            if let Some(name) = get_function_name_from_declarator(child, source_code) {
-                return Some(name);
-            }
+        // The most copied files, as the summary lists the worst functions
+        let mut most_copied: Vec<_> = counts.copies.iter().collect();
+        most_copied.sort_by(|a, b| b.1.cmp(a.1));
+        for (original, copies) in most_copied.into_iter().take(5) {
+            println!("    {} ({} {})", original.display(), copies, if *copies == 1 { "copy" } else { "copies" });
         }
     }
-
-    None
+    if counts.skipped > 0 {
+        println!("  Skipped (unreadable, unparsable or over limits): {}", counts.skipped);
+    }
 }
 
-fn get_declarator_name(node: Node, source_code: &str) -> Option<String> {
-    let mut cursor = node.walk();
+fn print_quadrant(store: &MetricsStore, rows: &[u32], marker: &str) {
+    if rows.is_empty() {
+        println!("  (none)");
+        return;
+    }
 
-    for child in node.children(&mut cursor) {
-        if child.kind() == "identifier" {
-            return Some(child.utf8_text(source_code.as_bytes()).ok()?.to_string());
-        } else if child.kind() == "pointer_declarator" || child.kind() == "function_declarator" {
-            if let Some(name) = get_declarator_name(child, source_code) {
-                return Some(name);
-            }
+    for &index in rows {
+        let func = store.row(index);
+        if func.file_path.is_empty() {
+            println!("  {} {} (McCabe: {}, TestScore: {})", marker, func.name, func.mccabe, func.test_scoring.total_score);
+        } else {
+            println!("  {} {} [{}] (McCabe: {}, TestScore: {})", marker, func.name, func.file_path, func.mccabe, func.test_scoring.total_score);
         }
     }
-
-    None
 }
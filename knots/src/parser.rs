@@ -0,0 +1,64 @@
+// Per-thread reuse of tree-sitter C parsers
+
+use anyhow::{Context, Result};
+use std::cell::RefCell;
+use std::time::Duration;
+use tree_sitter::{Parser, Tree};
+
+thread_local! {
+    /// The calling thread's idle C parser, kept between files
+    static C_PARSER: RefCell<Option<Parser>> = const { RefCell::new(None) };
+}
+
+/// Run `f` with this thread's long-lived C parser.
+///
+/// The parser is created on first use and reset before it goes back to the pool, so
+/// every file starts from a clean state while its internal buffers are reused.
+/// Nested calls on the same thread get a fresh parser instead of deadlocking.
+pub fn with_c_parser<R>(f: impl FnOnce(&mut Parser) -> R) -> Result<R> {
+    let mut parser = match C_PARSER.with(|slot| slot.borrow_mut().take()) {
+        Some(parser) => parser,
+        None => new_c_parser()?,
+    };
+
+    let result = f(&mut parser);
+
+    parser.reset();
+    C_PARSER.with(|slot| *slot.borrow_mut() = Some(parser));
+
+    Ok(result)
+}
+
+/// Parse C source with this thread's pooled parser
+pub fn parse_c(source_code: &[u8]) -> Result<Option<Tree>> {
+    with_c_parser(|parser| parser.parse(source_code, None))
+}
+
+/// Parse C source with this thread's pooled parser, giving up (returning None) once
+/// parsing has taken longer than `timeout`
+pub fn parse_c_with_timeout(source_code: &[u8], timeout: Duration) -> Result<Option<Tree>> {
+    with_c_parser(|parser| {
+        // Zero means no timeout to tree-sitter
+        let micros = u64::try_from(timeout.as_micros()).unwrap_or(u64::MAX).max(1);
+        parser.set_timeout_micros(micros);
+        let tree = parser.parse(source_code, None);
+        // Other users of the pooled parser expect it to run to completion
+        parser.set_timeout_micros(0);
+        tree
+    })
+}
+
+/// Incrementally reparse C source with this thread's pooled parser. `old_tree` must
+/// already have been updated with `Tree::edit` to describe how the text changed.
+pub fn reparse_c(source_code: &[u8], old_tree: &Tree) -> Result<Option<Tree>> {
+    with_c_parser(|parser| parser.parse(source_code, Some(old_tree)))
+}
+
+/// A new parser configured for C
+pub(crate) fn new_c_parser() -> Result<Parser> {
+    let mut parser = Parser::new();
+    parser
+        .set_language(&tree_sitter_c::language())
+        .context("Failed to set C language")?;
+    Ok(parser)
+}
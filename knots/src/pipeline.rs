@@ -0,0 +1,498 @@
+// Parallel multi-file analysis pipeline shared by matrix and recursive modes
+
+use anyhow::Result;
+use std::collections::{BTreeMap, HashMap};
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{mpsc, Arc, Condvar, Mutex};
+use std::thread;
+use xxhash_rust::xxh3::xxh3_128;
+
+use knots::analysis::{filter_function_metrics, FunctionMetrics};
+use knots::filter::FilterRules;
+use knots::limits::{FileLimits, Stage};
+use knots::source::{SourceBytes, SourceReader};
+use knots::store::MetricsStore;
+
+use crate::cache::MetricsCache;
+use crate::timings::{FileTimer, Phase, Timings};
+
+/// Settings shared by every worker of a pipeline run
+pub struct PipelineConfig<'a> {
+    pub include_rules: &'a Option<FilterRules>,
+    pub exclude_rules: &'a Option<FilterRules>,
+    pub cache: Option<&'a MetricsCache>,
+    pub timings: &'a Timings,
+    pub limits: &'a FileLimits,
+    /// Measure files with identical contents once, reporting the copies this way
+    pub dedup: Option<DedupMode>,
+}
+
+/// How a deduplicated run reports files whose contents match an earlier file's
+#[derive(Debug, Clone, Copy, PartialEq, Eq, clap::ValueEnum)]
+pub enum DedupMode {
+    /// Report the first file's functions once and count the later files as copies of it
+    Collapse,
+    /// Report every copy's functions under its own path, measured once
+    Expand,
+}
+
+/// Outcome of analyzing a single file
+pub enum FileOutcome {
+    Analyzed(Vec<FunctionMetrics>),
+    Skipped(String),
+    /// Same contents as `original`, an earlier file whose functions stand for both
+    Duplicate { original: PathBuf },
+}
+
+/// How the files of a run fared, for the FILES PROCESSED summary
+#[derive(Debug, Default)]
+pub struct FileCounts {
+    pub total: usize,
+    /// Files that could not be read or parsed
+    pub skipped: usize,
+    /// Collapsed copies, by the file they are copies of
+    pub copies: BTreeMap<PathBuf, usize>,
+}
+
+impl FileCounts {
+    pub fn new(total: usize) -> Self {
+        Self {
+            total,
+            ..Self::default()
+        }
+    }
+
+    /// Count `outcome`, printing skip warnings as a serial run would, and return the
+    /// functions it reports, if any
+    pub fn record(&mut self, outcome: FileOutcome) -> Option<Vec<FunctionMetrics>> {
+        match outcome {
+            FileOutcome::Analyzed(functions) => Some(functions),
+            FileOutcome::Skipped(warning) => {
+                eprintln!("Warning: {}", warning);
+                self.skipped += 1;
+                None
+            }
+            FileOutcome::Duplicate { original } => {
+                *self.copies.entry(original).or_default() += 1;
+                None
+            }
+        }
+    }
+
+    /// Files counted once under an earlier file with the same contents
+    pub fn duplicates(&self) -> usize {
+        self.copies.values().sum()
+    }
+}
+
+/// Resolve the worker count from --jobs (0 means one worker per available CPU)
+pub fn resolve_jobs(requested: usize) -> usize {
+    if requested > 0 {
+        return requested;
+    }
+
+    thread::available_parallelism()
+        .map(|n| n.get())
+        .unwrap_or(1)
+}
+
+/// Analyze files across `jobs` worker threads into one store, in the same order as
+/// `files`, printing skip warnings as a serial run would. Each file's functions are
+/// interned into the store as soon as the file is released, so only the store grows
+/// with the size of the run. Returns the store and how the files fared.
+pub fn collect_metrics(files: &[PathBuf], jobs: usize, config: &PipelineConfig) -> Result<(MetricsStore, FileCounts)> {
+    let mut store = MetricsStore::new();
+    let mut counts = FileCounts::new(files.len());
+
+    for_each_outcome(files, jobs, config, |outcome| {
+        config.timings.time(Phase::Report, || {
+            if let Some(functions) = counts.record(outcome) {
+                functions.iter().for_each(|func| store.push(&func.columnar_row()));
+            }
+        });
+        Ok(())
+    })?;
+
+    Ok((store, counts))
+}
+
+/// Analyze files across `jobs` worker threads, handing each outcome to `sink` in the
+/// same order as `files` as soon as it and all earlier files are done
+pub fn for_each_outcome<F>(files: &[PathBuf], jobs: usize, config: &PipelineConfig, sink: F) -> Result<()>
+where
+    F: FnMut(FileOutcome) -> Result<()>,
+{
+    match config.dedup {
+        Some(mode) => for_each_unique_outcome(files, jobs, config, mode, sink),
+        None => for_each_file(files, jobs, |reader, file| analyze_file(reader, file, config), sink),
+    }
+}
+
+/// `for_each_outcome` for a deduplicated run. Each worker hashes the bytes it read and
+/// claims the hash; only the file that claims a content first measures it, and files
+/// with the same content (picked up meanwhile or later) wait for and reuse its result.
+/// The first file of each content in input order is reported as analyzed, whichever
+/// file measured it, so the output does not depend on timing. Every distinct content's
+/// functions stay in memory until the run ends, since a copy may come at any point.
+fn for_each_unique_outcome<F>(files: &[PathBuf], jobs: usize, config: &PipelineConfig, mode: DedupMode, mut sink: F) -> Result<()>
+where
+    F: FnMut(FileOutcome) -> Result<()>,
+{
+    let claims = ContentClaims::default();
+    let mut originals: HashMap<u128, usize> = HashMap::new();
+    let mut next_index = 0;
+
+    for_each_file(files, jobs, |reader, file| analyze_unique_file(reader, file, config, &claims), |(hash, outcome)| {
+        let index = next_index;
+        next_index += 1;
+        let Some(hash) = hash else { return sink(outcome) };
+
+        let original = *originals.entry(hash).or_insert(index);
+        match outcome {
+            FileOutcome::Analyzed(_) if original != index && mode == DedupMode::Collapse => {
+                sink(FileOutcome::Duplicate { original: files[original].clone() })
+            }
+            outcome => sink(outcome),
+        }
+    })
+}
+
+/// The result of measuring one content, shared with every file that has it: the file
+/// that measured it, and its filtered functions, or `None` if it was skipped
+type SharedResult = (PathBuf, Option<Arc<Vec<FunctionMetrics>>>);
+
+/// Claims on content hashes by the workers of a deduplicated run
+#[derive(Default)]
+struct ContentClaims {
+    slots: Mutex<HashMap<u128, Arc<ContentSlot>>>,
+}
+
+/// Where the file that claimed a content publishes its result
+#[derive(Default)]
+struct ContentSlot {
+    result: Mutex<Option<SharedResult>>,
+    ready: Condvar,
+}
+
+impl ContentClaims {
+    /// The slot for `hash`, and whether the caller is the first to claim it and so must
+    /// fill it
+    fn claim(&self, hash: u128) -> (Arc<ContentSlot>, bool) {
+        let mut slots = self.slots.lock().unwrap();
+        match slots.get(&hash) {
+            Some(slot) => (Arc::clone(slot), false),
+            None => {
+                let slot = Arc::new(ContentSlot::default());
+                slots.insert(hash, Arc::clone(&slot));
+                (slot, true)
+            }
+        }
+    }
+}
+
+impl ContentSlot {
+    fn fill(&self, result: SharedResult) {
+        *self.result.lock().unwrap() = Some(result);
+        self.ready.notify_all();
+    }
+
+    /// Block until the claiming file has filled the slot. It is already being measured
+    /// on another worker, which waits for nothing, so this cannot deadlock.
+    fn wait(&self) -> SharedResult {
+        let mut result = self.result.lock().unwrap();
+        loop {
+            if let Some(result) = &*result {
+                return result.clone();
+            }
+            result = self.ready.wait(result).unwrap();
+        }
+    }
+}
+
+/// Analyze one file of a deduplicated run, returning its content hash (`None` if it
+/// could not be read, or was skipped by the size limit) along with the outcome
+fn analyze_unique_file(
+    reader: &mut SourceReader,
+    file: &PathBuf,
+    config: &PipelineConfig,
+    claims: &ContentClaims,
+) -> Result<(Option<u128>, FileOutcome)> {
+    let mut timer = config.timings.file_timer();
+    let outcome = analyze_unique_file_timed(reader, file, config, claims, &mut timer);
+    config.timings.record_file(file, timer);
+    outcome
+}
+
+fn analyze_unique_file_timed(
+    reader: &mut SourceReader,
+    file: &PathBuf,
+    config: &PipelineConfig,
+    claims: &ContentClaims,
+    timer: &mut FileTimer,
+) -> Result<(Option<u128>, FileOutcome)> {
+    let source_code = match read_source(reader, file, config, timer) {
+        Ok(code) => code,
+        Err(skipped) => return Ok((None, skipped)),
+    };
+    let hash = xxh3_128(&source_code);
+    timer.lap(Phase::Read);
+
+    let (slot, claimed) = claims.claim(hash);
+    if claimed {
+        let outcome = analyze_source(&source_code, file, config, timer);
+        // Filled even on an error, so no copy waits forever for a run that is stopping
+        let shared = match &outcome {
+            Ok(FileOutcome::Analyzed(functions)) => Some(Arc::new(functions.clone())),
+            _ => None,
+        };
+        slot.fill((file.clone(), shared));
+        return Ok((Some(hash), outcome?));
+    }
+
+    let outcome = match slot.wait() {
+        (_, Some(functions)) => {
+            let file_path = file.to_str().unwrap_or("");
+            timer.functions = functions.len();
+            FileOutcome::Analyzed(
+                functions
+                    .iter()
+                    .map(|func| FunctionMetrics {
+                        file_path: file_path.to_string(),
+                        ..func.clone()
+                    })
+                    .collect(),
+            )
+        }
+        (measured, None) => FileOutcome::Skipped(format!(
+            "Skipping {}: same contents as {}, which was skipped",
+            file.display(),
+            measured.display()
+        )),
+    };
+    Ok((Some(hash), outcome))
+}
+
+/// Run `work` on every file across `jobs` worker threads, each with its own reusable
+/// `SourceReader`, handing the results to `sink` in the same order as `files`.
+///
+/// Workers pull the next unclaimed file from a shared cursor, so a few huge files
+/// cannot stall the others. A worker never runs more than a small window ahead of the
+/// oldest unfinished file, which bounds how many finished results wait for reordering.
+/// An error from `work` or `sink` stops the run.
+pub fn for_each_file<T, W, F>(files: &[PathBuf], jobs: usize, work: W, mut sink: F) -> Result<()>
+where
+    T: Send,
+    W: Fn(&mut SourceReader, &PathBuf) -> Result<T> + Sync,
+    F: FnMut(T) -> Result<()>,
+{
+    let jobs = jobs.clamp(1, files.len().max(1));
+    let next_file = AtomicUsize::new(0);
+    let window = EmitWindow::new(jobs * REORDER_WINDOW_PER_JOB);
+    let (sender, receiver) = mpsc::channel::<(usize, Result<T>)>();
+
+    thread::scope(|scope| {
+        for _ in 0..jobs {
+            let sender = sender.clone();
+            let (next_file, window, work) = (&next_file, &window, &work);
+            scope.spawn(move || {
+                let mut reader = SourceReader::new();
+                loop {
+                    let index = next_file.fetch_add(1, Ordering::Relaxed);
+                    if index >= files.len() || !window.wait_for_slot(index) {
+                        break;
+                    }
+                    let outcome = work(&mut reader, &files[index]);
+                    let failed = outcome.is_err();
+                    if sender.send((index, outcome)).is_err() || failed {
+                        break;
+                    }
+                }
+            });
+        }
+        drop(sender);
+
+        // Release results strictly in input order so the result is deterministic
+        let result = (|| -> Result<()> {
+            let mut pending = BTreeMap::new();
+            let mut next_index = 0;
+            for (index, outcome) in receiver.iter() {
+                pending.insert(index, outcome);
+                while let Some(outcome) = pending.remove(&next_index) {
+                    next_index += 1;
+                    window.advance(next_index);
+                    sink(outcome?)?;
+                }
+            }
+            Ok(())
+        })();
+
+        // On an error, wake any worker waiting for a slot so the scope can join
+        window.close();
+        drop(receiver);
+        result
+    })
+}
+
+/// How far (in files, per worker) analysis may run ahead of the oldest unfinished file
+const REORDER_WINDOW_PER_JOB: usize = 4;
+
+/// Tracks how many outcomes have been released so workers can stay within the window
+struct EmitWindow {
+    size: usize,
+    state: Mutex<(usize, bool)>,
+    advanced: Condvar,
+}
+
+impl EmitWindow {
+    fn new(size: usize) -> Self {
+        Self {
+            size,
+            state: Mutex::new((0, false)),
+            advanced: Condvar::new(),
+        }
+    }
+
+    /// Block until file `index` is within the window; returns false once closed
+    fn wait_for_slot(&self, index: usize) -> bool {
+        let mut state = self.state.lock().unwrap();
+        while !state.1 && index >= state.0 + self.size {
+            state = self.advanced.wait(state).unwrap();
+        }
+        !state.1
+    }
+
+    fn advance(&self, released: usize) {
+        self.state.lock().unwrap().0 = released;
+        self.advanced.notify_all();
+    }
+
+    fn close(&self) {
+        self.state.lock().unwrap().1 = true;
+        self.advanced.notify_all();
+    }
+}
+
+fn analyze_file(reader: &mut SourceReader, file: &PathBuf, config: &PipelineConfig) -> Result<FileOutcome> {
+    let mut timer = config.timings.file_timer();
+    let outcome = analyze_file_timed(reader, file, config, &mut timer);
+    config.timings.record_file(file, timer);
+    outcome
+}
+
+fn analyze_file_timed(
+    reader: &mut SourceReader,
+    file: &PathBuf,
+    config: &PipelineConfig,
+    timer: &mut FileTimer,
+) -> Result<FileOutcome> {
+    let source_code = match read_source(reader, file, config, timer) {
+        Ok(code) => code,
+        Err(skipped) => return Ok(skipped),
+    };
+    analyze_source(&source_code, file, config, timer)
+}
+
+/// Read `file`, or return the outcome that skips it because it is unreadable or over
+/// the size limit. Oversized files are skipped before hashing, even if the cache has them.
+fn read_source<'a>(
+    reader: &'a mut SourceReader,
+    file: &PathBuf,
+    config: &PipelineConfig,
+    timer: &mut FileTimer,
+) -> Result<SourceBytes<'a>, FileOutcome> {
+    let source_code = reader
+        .read(file)
+        .map_err(|e| FileOutcome::Skipped(format!("Skipping {}: {}", file.display(), e)))?;
+    timer.bytes = source_code.len() as u64;
+    timer.lap(Phase::Read);
+
+    match config.limits.check_size(timer.bytes) {
+        Some(reason) => Err(FileOutcome::Skipped(format!("Skipping {}: {}", file.display(), reason))),
+        None => Ok(source_code),
+    }
+}
+
+/// Measure (or load from the cache) and filter the functions of `file`'s contents
+fn analyze_source(
+    source_code: &[u8],
+    file: &PathBuf,
+    config: &PipelineConfig,
+    timer: &mut FileTimer,
+) -> Result<FileOutcome> {
+    // Unchanged contents reuse their cached metrics without being parsed
+    let cache_key = config.cache.map(|_| MetricsCache::content_key(source_code));
+    if let (Some(cache), Some(key)) = (config.cache, &cache_key) {
+        let cached = cache.load(key);
+        timer.lap(Phase::Cache);
+        if let Some(functions) = cached {
+            timer.functions = functions.len();
+            return Ok(FileOutcome::Analyzed(filter_file_metrics(functions, file, config, timer)));
+        }
+    }
+
+    // Each worker thread reuses one parser for all of its files. The tree is freed
+    // before the next file is parsed, so peak memory tracks the largest file (or, for
+    // split files, the largest piece), not the number of files.
+    let measured = config.limits.measure(source_code, |stage| match stage {
+        Stage::Parsed => timer.lap(Phase::Parse),
+        Stage::Measured => timer.lap(Phase::Metrics),
+    })?;
+    let functions = match measured {
+        Ok(functions) => functions,
+        Err(reason) => return Ok(FileOutcome::Skipped(format!("Skipping {}: {}", file.display(), reason))),
+    };
+    timer.functions = functions.len();
+
+    if let (Some(cache), Some(key)) = (config.cache, &cache_key) {
+        if let Err(e) = cache.store(key, &functions) {
+            eprintln!("Warning: {:#}", e);
+        }
+        timer.lap(Phase::Cache);
+    }
+
+    Ok(FileOutcome::Analyzed(filter_file_metrics(functions, file, config, timer)))
+}
+
+fn filter_file_metrics(
+    functions: Vec<FunctionMetrics>,
+    file: &PathBuf,
+    config: &PipelineConfig,
+    timer: &mut FileTimer,
+) -> Vec<FunctionMetrics> {
+    let filtered = filter_function_metrics(functions, file.to_str().unwrap_or(""), config.include_rules, config.exclude_rules);
+    timer.lap(Phase::Filter);
+    filtered
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_copies_wait_for_the_claiming_file() {
+        let claims = ContentClaims::default();
+        let (slot, claimed) = claims.claim(7);
+        assert!(claimed);
+
+        // Copies claimed while the first file is still measuring block until it is done
+        let copies: Vec<_> = (0..3)
+            .map(|_| {
+                let (slot, claimed) = claims.claim(7);
+                assert!(!claimed);
+                thread::spawn(move || slot.wait())
+            })
+            .collect();
+        assert!(claims.claim(8).1);
+
+        slot.fill((PathBuf::from("board1/hal.c"), Some(Arc::new(Vec::new()))));
+        for copy in copies {
+            let (measured, functions) = copy.join().unwrap();
+            assert_eq!(measured, PathBuf::from("board1/hal.c"));
+            assert!(functions.is_some());
+        }
+
+        // Later copies find the result ready
+        assert_eq!(claims.claim(7).0.wait().0, PathBuf::from("board1/hal.c"));
+    }
+}
@@ -0,0 +1,208 @@
+// Streaming recursive-mode report: per-function lines go to report.txt as each file
+// finishes, while only running totals and the worst functions stay in memory
+
+use anyhow::{Context, Result};
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+use std::fs;
+use std::io::{BufWriter, Write};
+
+use knots::analysis::FunctionMetrics;
+use knots::columnar::ColumnarRow;
+use knots::store::MetricTotals;
+
+use crate::get_complexity_emoji;
+
+/// Number of worst functions shown in the recursive summary
+pub const TOP_FUNCTIONS: usize = 5;
+
+/// Writes report.txt incrementally. The file is only created once the first function
+/// arrives, so a run that finds no functions leaves no empty report behind.
+pub struct ReportWriter {
+    verbose: bool,
+    file: Option<BufWriter<fs::File>>,
+}
+
+impl ReportWriter {
+    pub fn new(verbose: bool) -> Self {
+        Self { verbose, file: None }
+    }
+
+    /// Append the report lines for one file's functions
+    pub fn write_functions(&mut self, functions: &[FunctionMetrics]) -> Result<()> {
+        self.write_rows(functions.iter().map(FunctionMetrics::columnar_row))
+    }
+
+    /// Append the report lines for `rows`, such as those of a `MetricsStore`
+    pub fn write_rows<'a>(&mut self, rows: impl IntoIterator<Item = ColumnarRow<'a>>) -> Result<()> {
+        let mut rows = rows.into_iter().peekable();
+        if rows.peek().is_none() {
+            return Ok(());
+        }
+
+        let file = match &mut self.file {
+            Some(file) => file,
+            None => {
+                let created = fs::File::create("report.txt").context("Failed to create report.txt")?;
+                self.file.insert(BufWriter::new(created))
+            }
+        };
+
+        for row in rows {
+            write_function(file, &row, self.verbose)?;
+        }
+
+        Ok(())
+    }
+
+    /// Flush whatever is still buffered
+    pub fn finish(self) -> Result<()> {
+        if let Some(mut file) = self.file {
+            file.flush().context("Failed to write report.txt")?;
+        }
+        Ok(())
+    }
+}
+
+fn write_function(out: &mut impl Write, func: &ColumnarRow, verbose: bool) -> Result<()> {
+    let emoji = get_complexity_emoji(func.max_complexity());
+
+    if verbose {
+        writeln!(out, "Function: {} {} [{}]", func.name, emoji, func.file_path)?;
+        writeln!(out, "  McCabe Complexity: {}", func.mccabe)?;
+        writeln!(out, "  Cognitive Complexity: {}", func.cognitive)?;
+        writeln!(out, "  Nesting Depth: {}", func.nesting)?;
+        writeln!(out, "  SLOC: {}", func.sloc)?;
+        writeln!(out, "  ABC Magnitude: {:.2}", func.abc_magnitude)?;
+        writeln!(out, "  Return Count: {}", func.return_count)?;
+        writeln!(out, "  Test Scoring: {} ({})", func.test_scoring.total_score, func.test_scoring.classification())?;
+        writeln!(out, "    - Signature: {}", func.test_scoring.signature_score)?;
+        writeln!(out, "    - Dependency: {}", func.test_scoring.dependency_score)?;
+        writeln!(out, "    - Observable: {}", func.test_scoring.observable_score)?;
+        writeln!(out, "    - Implementation: {}", func.test_scoring.implementation_score)?;
+        writeln!(out, "    - Documentation: {}", func.test_scoring.documentation_score)?;
+        writeln!(out, "  Max Complexity: {}", func.max_complexity())?;
+        writeln!(out)?;
+    } else {
+        writeln!(
+            out,
+            "{} {} [{}] (McCabe: {}, Cognitive: {}, Nesting: {}, SLOC: {}, ABC: {:.2}, Returns: {}, TestScore: {})",
+            emoji, func.name, func.file_path, func.mccabe, func.cognitive, func.nesting, func.sloc, func.abc_magnitude, func.return_count, func.test_scoring.total_score
+        )?;
+    }
+
+    Ok(())
+}
+
+/// Running totals plus a bounded heap of the worst functions seen so far
+#[derive(Default)]
+pub struct SummaryStats {
+    pub totals: MetricTotals,
+    worst: BinaryHeap<Reverse<RankedFunction>>,
+}
+
+/// Heap entry ordered by max complexity, with earlier functions winning ties so the
+/// result matches a stable sort of the full list
+struct RankedFunction {
+    max_complexity: u32,
+    seq: Reverse<usize>,
+    metrics: FunctionMetrics,
+}
+
+impl RankedFunction {
+    fn key(&self) -> (u32, Reverse<usize>) {
+        (self.max_complexity, self.seq)
+    }
+}
+
+impl PartialEq for RankedFunction {
+    fn eq(&self, other: &Self) -> bool {
+        self.key() == other.key()
+    }
+}
+
+impl Eq for RankedFunction {}
+
+impl PartialOrd for RankedFunction {
+    fn partial_cmp(&self, other: &Self) -> Option<std::cmp::Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl Ord for RankedFunction {
+    fn cmp(&self, other: &Self) -> std::cmp::Ordering {
+        self.key().cmp(&other.key())
+    }
+}
+
+impl SummaryStats {
+    pub fn add(&mut self, func: &FunctionMetrics) {
+        let seq = self.totals.function_count;
+        self.totals.add(func);
+
+        // Only clone functions that can still make the list
+        let max_complexity = func.max_complexity();
+        if self.worst.len() == TOP_FUNCTIONS {
+            let weakest = &self.worst.peek().expect("heap is full").0;
+            if (max_complexity, Reverse(seq)) <= weakest.key() {
+                return;
+            }
+            self.worst.pop();
+        }
+        self.worst.push(Reverse(RankedFunction {
+            max_complexity,
+            seq: Reverse(seq),
+            metrics: func.clone(),
+        }));
+    }
+
+    /// The worst functions, worst first
+    pub fn worst_functions(&self) -> Vec<ColumnarRow<'_>> {
+        let mut ranked: Vec<&RankedFunction> = self.worst.iter().map(|entry| &entry.0).collect();
+        ranked.sort_by(|a, b| b.cmp(a));
+        ranked.into_iter().map(|entry| entry.metrics.columnar_row()).collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use knots::complexity::TestScoringMetric;
+
+    fn metrics(name: &str, mccabe: u32, cognitive: u32) -> FunctionMetrics {
+        FunctionMetrics {
+            name: name.to_string(),
+            file_path: String::new(),
+            mccabe,
+            cognitive,
+            nesting: 0,
+            sloc: 1,
+            abc_magnitude: 0.0,
+            return_count: 0,
+            test_scoring: TestScoringMetric::default(),
+        }
+    }
+
+    #[test]
+    fn test_worst_functions_match_stable_sort() {
+        let all: Vec<FunctionMetrics> = [(3, 1), (9, 2), (1, 4), (4, 9), (2, 2), (9, 1), (4, 4), (8, 7), (4, 1)]
+            .iter()
+            .enumerate()
+            .map(|(i, &(mccabe, cognitive))| metrics(&format!("f{}", i), mccabe, cognitive))
+            .collect();
+
+        let mut stats = SummaryStats::default();
+        for func in &all {
+            stats.add(func);
+        }
+
+        let mut sorted = all.clone();
+        sorted.sort_by(|a, b| b.max_complexity().cmp(&a.max_complexity()));
+        let expected: Vec<&str> = sorted.iter().take(TOP_FUNCTIONS).map(|f| f.name.as_str()).collect();
+        let actual: Vec<&str> = stats.worst_functions().iter().map(|f| f.name).collect();
+
+        assert_eq!(actual, expected);
+        assert_eq!(stats.totals.function_count, all.len());
+        assert_eq!(stats.totals.total_mccabe, 44);
+    }
+}
@@ -0,0 +1,342 @@
+// `knots serve`: a long-running daemon that answers analysis requests over a Unix socket
+//
+// The protocol is newline-delimited JSON; every request line gets one response line.
+//
+//   {"id": 1, "method": "analyze", "files": [{"path": "/src/a.c"}, {"path": "/src/b.c", "content": "..."}]}
+//   {"id": 2, "method": "ping"}
+//   {"id": 3, "method": "shutdown"}
+//
+// `content` analyzes an unsaved editor buffer in place of the file on disk. `id` is
+// optional and echoed back unchanged. Relative paths are resolved against the directory
+// the daemon was started in.
+
+use anyhow::{Context, Result};
+use serde::{Deserialize, Serialize};
+use serde_json::Value;
+use std::collections::HashMap;
+use std::io::{BufRead, BufReader, BufWriter, Write};
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::path::{Path, PathBuf};
+use std::net::Shutdown;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread;
+
+use knots::analysis::{filter_function_metrics, AnalysisSession, FunctionMetrics};
+use knots::filter::{should_process_file, FilterRules};
+use knots::source::SourceReader;
+
+use crate::cache::MetricsCache;
+
+/// Settings loaded once when the daemon starts
+pub struct ServeConfig {
+    pub socket: PathBuf,
+    pub include_rules: Option<FilterRules>,
+    pub exclude_rules: Option<FilterRules>,
+    pub workers: usize,
+}
+
+#[derive(Deserialize)]
+struct RequestLine {
+    #[serde(default)]
+    id: Value,
+    #[serde(flatten)]
+    request: Request,
+}
+
+#[derive(Deserialize)]
+#[serde(tag = "method", rename_all = "snake_case")]
+enum Request {
+    Analyze { files: Vec<FileRequest> },
+    Ping,
+    Shutdown,
+}
+
+#[derive(Deserialize)]
+struct FileRequest {
+    path: PathBuf,
+    /// Unsaved buffer contents to analyze instead of reading `path`
+    #[serde(default)]
+    content: Option<String>,
+}
+
+#[derive(Serialize)]
+struct Response {
+    id: Value,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    results: Option<Vec<FileResult>>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    error: Option<String>,
+}
+
+#[derive(Serialize)]
+struct FileResult {
+    path: String,
+    functions: Vec<FunctionMetrics>,
+    /// True when the file was answered from the in-memory cache without parsing
+    cached: bool,
+    /// True when the include/exclude file patterns rule the file out
+    #[serde(skip_serializing_if = "std::ops::Not::not")]
+    excluded: bool,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    error: Option<String>,
+}
+
+/// Unfiltered metrics of the most recently analyzed contents of one path
+struct CachedFile {
+    content_key: String,
+    functions: Arc<Vec<FunctionMetrics>>,
+}
+
+/// What one worker thread keeps warm from request to request
+struct Worker {
+    reader: SourceReader,
+    /// Has no filters: its results are cached unfiltered, and each request filters them
+    session: AnalysisSession,
+}
+
+/// State shared by every worker for the lifetime of the daemon
+struct Daemon {
+    config: ServeConfig,
+    files: Mutex<HashMap<PathBuf, CachedFile>>,
+    shutting_down: AtomicBool,
+    /// A handle to every connection being served, so a shutdown can unblock workers
+    /// waiting on other clients' requests
+    connections: Mutex<HashMap<u64, UnixStream>>,
+    next_connection: AtomicU64,
+}
+
+/// Run the daemon until a client sends `shutdown`
+pub fn run(config: ServeConfig) -> Result<()> {
+    let listener = bind(&config.socket)?;
+    eprintln!("knots: listening on {}", config.socket.display());
+
+    let daemon = Daemon {
+        config,
+        files: Mutex::new(HashMap::new()),
+        shutting_down: AtomicBool::new(false),
+        connections: Mutex::new(HashMap::new()),
+        next_connection: AtomicU64::new(0),
+    };
+
+    // Each worker keeps its own tree-sitter parser and read buffer warm across
+    // requests, so a long-lived editor connection does not block one-shot hook clients
+    let workers = (0..daemon.config.workers.max(1))
+        .map(|_| {
+            Ok(Worker {
+                reader: SourceReader::new(),
+                session: AnalysisSession::new()?,
+            })
+        })
+        .collect::<Result<Vec<_>>>()?;
+    thread::scope(|scope| {
+        for mut worker in workers {
+            let (daemon, listener) = (&daemon, &listener);
+            scope.spawn(move || {
+                while let Ok((stream, _)) = listener.accept() {
+                    if daemon.shutting_down.load(Ordering::SeqCst) {
+                        break;
+                    }
+                    if let Err(e) = daemon.serve_connection(stream, &mut worker) {
+                        eprintln!("Warning: client connection failed: {:#}", e);
+                    }
+                    if daemon.shutting_down.load(Ordering::SeqCst) {
+                        daemon.wake_workers();
+                        break;
+                    }
+                }
+            });
+        }
+    });
+
+    let _ = std::fs::remove_file(&daemon.config.socket);
+    Ok(())
+}
+
+/// Bind the socket, replacing a stale socket file left behind by a crashed daemon
+fn bind(socket: &Path) -> Result<UnixListener> {
+    if socket.exists() {
+        if UnixStream::connect(socket).is_ok() {
+            anyhow::bail!("A knots daemon is already listening on {}", socket.display());
+        }
+        std::fs::remove_file(socket)
+            .with_context(|| format!("Failed to remove stale socket: {}", socket.display()))?;
+    }
+
+    UnixListener::bind(socket).with_context(|| format!("Failed to bind socket: {}", socket.display()))
+}
+
+impl Daemon {
+    fn serve_connection(&self, stream: UnixStream, worker: &mut Worker) -> Result<()> {
+        let id = self.next_connection.fetch_add(1, Ordering::Relaxed);
+        self.connections.lock().unwrap().insert(id, stream.try_clone()?);
+        let served = self.serve_requests(stream, worker);
+        self.connections.lock().unwrap().remove(&id);
+        served
+    }
+
+    fn serve_requests(&self, stream: UnixStream, worker: &mut Worker) -> Result<()> {
+        // Checked after registering: a shutdown either sees this connection or is seen here
+        if self.shutting_down.load(Ordering::SeqCst) {
+            return Ok(());
+        }
+        let mut out = BufWriter::new(stream.try_clone()?);
+
+        for line in BufReader::new(stream).lines() {
+            let line = line?;
+            if line.trim().is_empty() {
+                continue;
+            }
+
+            let response = match serde_json::from_str::<RequestLine>(&line) {
+                Ok(RequestLine { id, request }) => self.handle(id, request, worker),
+                Err(e) => Response {
+                    id: Value::Null,
+                    results: None,
+                    error: Some(format!("Invalid request: {}", e)),
+                },
+            };
+
+            serde_json::to_writer(&mut out, &response)?;
+            out.write_all(b"\n")?;
+            out.flush()?;
+
+            if self.shutting_down.load(Ordering::SeqCst) {
+                break;
+            }
+        }
+
+        Ok(())
+    }
+
+    fn handle(&self, id: Value, request: Request, worker: &mut Worker) -> Response {
+        let results = match request {
+            Request::Analyze { files } => Some(files.iter().map(|file| self.analyze(file, worker)).collect()),
+            Request::Ping => None,
+            Request::Shutdown => {
+                self.shutting_down.store(true, Ordering::SeqCst);
+                None
+            }
+        };
+
+        Response { id, results, error: None }
+    }
+
+    fn analyze(&self, request: &FileRequest, worker: &mut Worker) -> FileResult {
+        let path = request.path.to_string_lossy().into_owned();
+        let mut result = FileResult {
+            path: path.clone(),
+            functions: Vec::new(),
+            cached: false,
+            excluded: false,
+            error: None,
+        };
+
+        let (include_rules, exclude_rules) = (&self.config.include_rules, &self.config.exclude_rules);
+        if !should_process_file(&path, include_rules, exclude_rules) {
+            result.excluded = true;
+            return result;
+        }
+
+        match self.measure(request, worker) {
+            Ok((functions, cached)) => {
+                result.functions = filter_function_metrics(functions.to_vec(), &path, include_rules, exclude_rules);
+                result.cached = cached;
+            }
+            Err(e) => result.error = Some(format!("{:#}", e)),
+        }
+
+        result
+    }
+
+    /// Unfiltered metrics for the requested contents, reusing the cached result when
+    /// the contents have not changed since the path was last analyzed
+    fn measure(&self, request: &FileRequest, worker: &mut Worker) -> Result<(Arc<Vec<FunctionMetrics>>, bool)> {
+        let disk_contents;
+        let source_code: &[u8] = match &request.content {
+            Some(content) => content.as_bytes(),
+            None => {
+                disk_contents = worker
+                    .reader
+                    .read(&request.path)
+                    .with_context(|| format!("Failed to read file: {}", request.path.display()))?;
+                &disk_contents
+            }
+        };
+
+        let content_key = MetricsCache::content_key(source_code);
+        if let Some(entry) = self.files.lock().unwrap().get(&request.path) {
+            if entry.content_key == content_key {
+                return Ok((Arc::clone(&entry.functions), true));
+            }
+        }
+
+        let functions = Arc::new(worker.session.analyze_bytes(source_code, &request.path.to_string_lossy())?);
+
+        self.files.lock().unwrap().insert(
+            request.path.clone(),
+            CachedFile {
+                content_key,
+                functions: Arc::clone(&functions),
+            },
+        );
+
+        Ok((functions, false))
+    }
+
+    /// Unblock workers waiting in accept(), or reading from another client, so they
+    /// notice the shutdown
+    fn wake_workers(&self) {
+        for connection in self.connections.lock().unwrap().values() {
+            let _ = connection.shutdown(Shutdown::Both);
+        }
+        for _ in 0..self.config.workers {
+            let _ = UnixStream::connect(&self.config.socket);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::mpsc;
+    use std::time::Duration;
+
+    #[test]
+    fn test_shutdown_closes_other_open_connections() {
+        let socket = std::env::temp_dir().join(format!("knots-serve-{}.sock", std::process::id()));
+        let config = ServeConfig {
+            socket: socket.clone(),
+            include_rules: None,
+            exclude_rules: None,
+            workers: 2,
+        };
+        let (done_sender, done) = mpsc::channel();
+        thread::spawn(move || done_sender.send(run(config).is_ok()));
+
+        let connect = || loop {
+            match UnixStream::connect(&socket) {
+                Ok(stream) => return stream,
+                Err(_) => thread::sleep(Duration::from_millis(10)),
+            }
+        };
+        let request = |stream: &UnixStream, line: &str| {
+            let mut writer = stream;
+            writer.write_all(line.as_bytes()).unwrap();
+            let mut response = String::new();
+            BufReader::new(stream).read_line(&mut response).unwrap();
+            response
+        };
+
+        // An editor-style connection stays open on one worker...
+        let editor = connect();
+        assert!(request(&editor, "{\"id\": 1, \"method\": \"ping\"}\n").contains("\"id\":1"));
+
+        // ...while another client shuts the daemon down
+        let client = connect();
+        assert!(request(&client, "{\"id\": 2, \"method\": \"shutdown\"}\n").contains("\"id\":2"));
+
+        assert_eq!(done.recv_timeout(Duration::from_secs(10)), Ok(true));
+        assert!(!socket.exists());
+    }
+}
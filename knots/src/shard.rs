@@ -0,0 +1,271 @@
+// Sharded runs for multi-node CI: `--shard i/N` analyzes a stable subset of the
+// discovered files into a partial results file, and `knots merge` combines the
+// partials into the output a single-node run would print
+
+use anyhow::{bail, Context, Result};
+use std::path::{Path, PathBuf};
+use std::str::FromStr;
+use xxhash_rust::xxh3::xxh3_64;
+
+use knots::columnar::{self, ColumnarReader, ShardCounts, FILE_ORDER_COLUMN};
+use knots::store::MetricsStore;
+
+use crate::pipeline::{self, FileOutcome, PipelineConfig};
+use crate::timings::Phase;
+
+/// One of `count` shards, parsed from `i/N` with `1 <= i <= N`
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Shard {
+    /// Zero-based
+    pub index: u64,
+    pub count: u64,
+}
+
+impl FromStr for Shard {
+    type Err = String;
+
+    fn from_str(value: &str) -> Result<Self, String> {
+        let parsed = value
+            .split_once('/')
+            .and_then(|(i, n)| Some((i.trim().parse::<u64>().ok()?, n.trim().parse::<u64>().ok()?)));
+        match parsed {
+            Some((i, n)) if n > 0 && (1..=n).contains(&i) => Ok(Shard { index: i - 1, count: n }),
+            _ => Err(format!("expected i/N with 1 <= i <= N, found '{}'", value)),
+        }
+    }
+}
+
+impl Shard {
+    /// Whether `path` belongs to this shard. The choice depends only on the path, so
+    /// every shard of a run agrees on it whatever order the files were found in.
+    pub fn contains(&self, path: &Path) -> bool {
+        xxh3_64(path.to_string_lossy().as_bytes()) % self.count == self.index
+    }
+}
+
+/// Analyze this shard's subset of `files` (the full run's list) and write the partial
+/// results to `output`. Returns the number of functions written.
+pub fn run(files: &[PathBuf], shard: Shard, output: &Path, jobs: usize, config: &PipelineConfig) -> Result<usize> {
+    // Keep each selected file's position in the full list so `merge` can restore it
+    let (positions, selected): (Vec<u32>, Vec<PathBuf>) = files
+        .iter()
+        .enumerate()
+        .filter(|(_, file)| shard.contains(file))
+        .map(|(position, file)| (position as u32, file.clone()))
+        .unzip();
+
+    let mut store = MetricsStore::new();
+    let mut file_order = Vec::new();
+    let mut skipped_files = 0;
+    let mut next_position = positions.iter();
+
+    pipeline::for_each_outcome(&selected, jobs, config, |outcome| {
+        let position = *next_position.next().expect("one outcome per file");
+        config.timings.time(Phase::Report, || match outcome {
+            FileOutcome::Analyzed(functions) => {
+                for func in &functions {
+                    store.push(&func.columnar_row());
+                    file_order.push(position);
+                }
+            }
+            FileOutcome::Skipped(warning) => {
+                eprintln!("Warning: {}", warning);
+                skipped_files += 1;
+            }
+            // Copies could lie in other shards, so --dedup is rejected with --shard
+            FileOutcome::Duplicate { .. } => unreachable!("sharded runs are not deduplicated"),
+        });
+        Ok(())
+    })?;
+
+    let counts = ShardCounts {
+        shard: shard.index,
+        shard_count: shard.count,
+        total_files: files.len() as u64,
+        skipped_files,
+    };
+    config
+        .timings
+        .time(Phase::Report, || columnar::write_partial_file(&store, &file_order, counts, output))?;
+
+    println!(
+        "Shard {}/{}: analyzed {} of {} files ({} skipped), {} functions written to {}",
+        shard.index + 1,
+        shard.count,
+        selected.len(),
+        files.len(),
+        skipped_files,
+        store.len(),
+        output.display()
+    );
+    Ok(store.len())
+}
+
+/// More shards than any CI matrix runs; a partial claiming more is corrupt
+const MAX_SHARDS: u64 = 65_536;
+
+/// The combined results of every shard of a run
+pub struct Merged {
+    /// Rows in the order a single-node run reports them
+    pub store: MetricsStore,
+    pub total_files: usize,
+    pub skipped_files: usize,
+}
+
+/// Combine partial results files. Every shard of the run must be present exactly once.
+pub fn merge(partials: &[PathBuf]) -> Result<Merged> {
+    let mut shards: Vec<Option<(MetricsStore, Vec<u32>)>> = Vec::new();
+    let mut run: Option<(u64, u64)> = None;
+    let mut skipped_files = 0;
+
+    for path in partials {
+        let mut reader = ColumnarReader::open(path)?;
+        let counts = reader
+            .shard_counts()?
+            .with_context(|| format!("{} is not a shard's partial results (written with --shard)", path.display()))?;
+        // The counts come from a file, so check them before they size anything
+        if counts.shard_count == 0 || counts.shard_count > MAX_SHARDS || counts.shard >= counts.shard_count {
+            bail!(
+                "{} has an invalid shard number {} of {}",
+                path.display(),
+                counts.shard + 1,
+                counts.shard_count
+            );
+        }
+        let (shard_count, total_files) = *run.get_or_insert((counts.shard_count, counts.total_files));
+        if (counts.shard_count, counts.total_files) != (shard_count, total_files) {
+            bail!(
+                "{} is shard {}/{} of a run over {} files, but the other partials are from a run of {} shards over {} files",
+                path.display(),
+                counts.shard + 1,
+                counts.shard_count,
+                counts.total_files,
+                shard_count,
+                total_files
+            );
+        }
+
+        shards.resize_with(shard_count as usize, || None);
+        let slot = &mut shards[counts.shard as usize];
+        if slot.is_some() {
+            bail!("Shard {}/{} is given more than once", counts.shard + 1, shard_count);
+        }
+        let store = reader.read_store().with_context(|| format!("Failed to read {}", path.display()))?;
+        let file_order = reader.u32_column(FILE_ORDER_COLUMN)?;
+        if file_order.len() != store.len() {
+            bail!("{} has {} file positions for {} rows", path.display(), file_order.len(), store.len());
+        }
+        *slot = Some((store, file_order));
+        skipped_files += counts.skipped_files as usize;
+    }
+
+    let Some((shard_count, total_files)) = run else {
+        bail!("No partial results given");
+    };
+    if let Some(missing) = shards.iter().position(Option::is_none) {
+        bail!("Shard {}/{} is missing", missing + 1, shard_count);
+    }
+    let shards: Vec<_> = shards.into_iter().flatten().collect();
+
+    // Each file lies in exactly one shard, so a stable sort by file position restores
+    // the single-node order, with each file's functions still in source order
+    let mut order: Vec<(u32, usize, u32)> = shards
+        .iter()
+        .enumerate()
+        .flat_map(|(shard, (_, file_order))| {
+            file_order.iter().enumerate().map(move |(row, &position)| (position, shard, row as u32))
+        })
+        .collect();
+    order.sort_by_key(|&(position, _, _)| position);
+
+    let mut store = MetricsStore::new();
+    for (_, shard, row) in order {
+        store.push(&shards[shard].0.row(row));
+    }
+
+    Ok(Merged {
+        store,
+        total_files: total_files as usize,
+        skipped_files,
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use knots::columnar::ColumnarRow;
+    use knots::complexity::TestScoringMetric;
+
+    #[test]
+    fn test_shards_partition_and_merge_in_file_order() {
+        assert_eq!("2/4".parse::<Shard>(), Ok(Shard { index: 1, count: 4 }));
+        assert!("0/4".parse::<Shard>().is_err());
+        assert!("5/4".parse::<Shard>().is_err());
+        assert!("4".parse::<Shard>().is_err());
+
+        let files: Vec<PathBuf> = (0..40).map(|i| PathBuf::from(format!("src/f{}.c", i))).collect();
+        let shards: Vec<Shard> = (0..3).map(|index| Shard { index, count: 3 }).collect();
+        for file in &files {
+            assert_eq!(shards.iter().filter(|shard| shard.contains(file)).count(), 1);
+        }
+
+        // Write each shard's partial by hand: two functions per file
+        let dir = std::env::temp_dir().join(format!("knots-shard-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let mut partials = Vec::new();
+        for shard in &shards {
+            let mut store = MetricsStore::new();
+            let mut file_order = Vec::new();
+            for (position, file) in files.iter().enumerate().filter(|(_, file)| shard.contains(file)) {
+                let file_path = file.to_string_lossy();
+                for name in ["a", "b"] {
+                    store.push(&ColumnarRow {
+                        name,
+                        file_path: &file_path,
+                        mccabe: position as u32,
+                        cognitive: 0,
+                        nesting: 0,
+                        sloc: 1,
+                        abc_magnitude: 0.5,
+                        return_count: 0,
+                        test_scoring: TestScoringMetric::default(),
+                    });
+                    file_order.push(position as u32);
+                }
+            }
+            let counts = ShardCounts {
+                shard: shard.index,
+                shard_count: 3,
+                total_files: files.len() as u64,
+                skipped_files: 1,
+            };
+            let path = dir.join(format!("shard-{}.col", shard.index));
+            columnar::write_partial_file(&store, &file_order, counts, &path).unwrap();
+            partials.push(path);
+        }
+
+        // Partials can be given in any order
+        partials.reverse();
+        let merged = merge(&partials).unwrap();
+        assert_eq!(merged.total_files, 40);
+        assert_eq!(merged.skipped_files, 3);
+        let rows: Vec<_> = merged.store.rows().map(|row| (row.file_path.to_string(), row.name.to_string())).collect();
+        let expected: Vec<_> = files
+            .iter()
+            .flat_map(|file| ["a", "b"].map(|name| (file.to_string_lossy().into_owned(), name.to_string())))
+            .collect();
+        assert_eq!(rows, expected);
+
+        assert!(merge(&partials[..2]).is_err());
+        let invalid = ShardCounts { shard: 3, shard_count: 3, total_files: 40, skipped_files: 0 };
+        let corrupt = dir.join("corrupt.col");
+        columnar::write_partial_file(&MetricsStore::new(), &[], invalid, &corrupt).unwrap();
+        assert!(merge(&[corrupt.clone()]).is_err());
+        let huge = ShardCounts { shard: 0, shard_count: u64::MAX, ..invalid };
+        columnar::write_partial_file(&MetricsStore::new(), &[], huge, &corrupt).unwrap();
+        assert!(merge(&[corrupt]).is_err());
+        assert!(merge(&[partials[0].clone(), partials[0].clone()]).is_err());
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -0,0 +1,72 @@
+// Byte-level source input: memory-mapped for large files, reusable buffers otherwise
+
+use memmap2::Mmap;
+use std::fs::File;
+use std::io::{self, Read};
+use std::ops::Deref;
+use std::path::Path;
+
+/// Files at least this large are memory-mapped instead of copied onto the heap
+pub const DEFAULT_MMAP_THRESHOLD: u64 = 1024 * 1024;
+
+/// Raw contents of a source file. Tree-sitter and the metrics work on bytes, so files
+/// that are not valid UTF-8 (e.g. Latin-1 comments in vendor code) are analyzed too.
+pub enum SourceBytes<'a> {
+    Mapped(Mmap),
+    Buffered(&'a [u8]),
+}
+
+impl Deref for SourceBytes<'_> {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            SourceBytes::Mapped(map) => map,
+            SourceBytes::Buffered(bytes) => bytes,
+        }
+    }
+}
+
+/// Reads source files, reusing one heap buffer for every file below the mmap threshold.
+/// Keep one reader per worker thread.
+pub struct SourceReader {
+    buffer: Vec<u8>,
+    mmap_threshold: u64,
+}
+
+impl SourceReader {
+    pub fn new() -> Self {
+        Self::with_mmap_threshold(DEFAULT_MMAP_THRESHOLD)
+    }
+
+    pub fn with_mmap_threshold(mmap_threshold: u64) -> Self {
+        Self {
+            buffer: Vec::new(),
+            mmap_threshold,
+        }
+    }
+
+    /// Read a file's bytes. The result borrows the reader's buffer until it is dropped.
+    pub fn read(&mut self, path: &Path) -> io::Result<SourceBytes<'_>> {
+        let mut file = File::open(path)?;
+        let len = file.metadata()?.len();
+
+        if len >= self.mmap_threshold && len > 0 {
+            // SAFETY: the map is read-only and dropped once the file is analyzed. As with
+            // any mmap, truncating the file while it is being analyzed is not supported.
+            let map = unsafe { Mmap::map(&file)? };
+            return Ok(SourceBytes::Mapped(map));
+        }
+
+        self.buffer.clear();
+        self.buffer.reserve(len as usize);
+        file.read_to_end(&mut self.buffer)?;
+        Ok(SourceBytes::Buffered(&self.buffer))
+    }
+}
+
+impl Default for SourceReader {
+    fn default() -> Self {
+        Self::new()
+    }
+}
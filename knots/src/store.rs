@@ -0,0 +1,297 @@
+// Interned, column-oriented in-memory store of function metrics for whole-run aggregation
+
+use std::cmp::Reverse;
+use std::collections::{BinaryHeap, HashMap};
+use std::sync::Arc;
+
+use crate::analysis::FunctionMetrics;
+use crate::columnar::ColumnarRow;
+use crate::complexity::TestScoringMetric;
+
+/// Functions at or below this McCabe complexity count as low complexity in the matrix
+pub const MATRIX_COMPLEXITY_LIMIT: u32 = 10;
+/// Functions at or below this test score count as easy to test in the matrix
+pub const MATRIX_TEST_SCORE_LIMIT: i32 = 10;
+
+/// Deduplicating string table. Each distinct string is allocated once and shared by the
+/// table and its lookup map.
+#[derive(Default)]
+pub struct StringInterner {
+    strings: Vec<Arc<str>>,
+    ids: HashMap<Arc<str>, u32>,
+}
+
+impl StringInterner {
+    pub fn intern(&mut self, value: &str) -> u32 {
+        if let Some(&id) = self.ids.get(value) {
+            return id;
+        }
+        let id = self.strings.len() as u32;
+        let shared: Arc<str> = Arc::from(value);
+        self.strings.push(Arc::clone(&shared));
+        self.ids.insert(shared, id);
+        id
+    }
+
+    pub fn get(&self, id: u32) -> &str {
+        &self.strings[id as usize]
+    }
+
+    /// Every interned string, in id order
+    pub fn strings(&self) -> &[Arc<str>] {
+        &self.strings
+    }
+}
+
+/// Sums of every metric over a set of functions
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct MetricTotals {
+    pub function_count: usize,
+    pub total_mccabe: u64,
+    pub total_cognitive: u64,
+    pub total_nesting: u64,
+    pub total_sloc: u64,
+    pub total_abc_magnitude: f64,
+    pub total_return_count: u64,
+    pub total_test_score: i64,
+}
+
+impl MetricTotals {
+    pub fn add(&mut self, func: &FunctionMetrics) {
+        self.function_count += 1;
+        self.total_mccabe += func.mccabe as u64;
+        self.total_cognitive += func.cognitive as u64;
+        self.total_nesting += func.nesting as u64;
+        self.total_sloc += func.sloc as u64;
+        self.total_abc_magnitude += func.abc_magnitude;
+        self.total_return_count += func.return_count as u64;
+        self.total_test_score += func.test_scoring.total_score as i64;
+    }
+}
+
+/// Row indices of a store split into the four testability matrix quadrants, each in
+/// store order
+#[derive(Debug, Default, PartialEq)]
+pub struct TestabilityMatrix {
+    /// Low complexity, easy to test
+    pub quick_wins: Vec<u32>,
+    /// High complexity, easy to test
+    pub invest_tests: Vec<u32>,
+    /// Low complexity, hard to test
+    pub add_docs: Vec<u32>,
+    /// High complexity, hard to test
+    pub refactor: Vec<u32>,
+}
+
+/// Metrics for many functions, one contiguous array per metric.
+///
+/// Function names and file paths are interned, so a path is stored once however many
+/// functions the file has, and each row costs a few dozen bytes with no heap allocation
+/// of its own. Totals, matrix buckets and rankings scan only the arrays they need instead
+/// of walking (or cloning and sorting) a vector of `FunctionMetrics`.
+#[derive(Default)]
+pub struct MetricsStore {
+    pub(crate) strings: StringInterner,
+    pub(crate) name: Vec<u32>,
+    pub(crate) file_path: Vec<u32>,
+    pub(crate) mccabe: Vec<u32>,
+    pub(crate) cognitive: Vec<u32>,
+    pub(crate) nesting: Vec<u32>,
+    pub(crate) sloc: Vec<u32>,
+    pub(crate) abc_magnitude: Vec<f64>,
+    pub(crate) return_count: Vec<u32>,
+    pub(crate) signature_score: Vec<u32>,
+    pub(crate) dependency_score: Vec<u32>,
+    pub(crate) observable_score: Vec<u32>,
+    pub(crate) implementation_score: Vec<u32>,
+    pub(crate) documentation_score: Vec<i32>,
+    pub(crate) total_score: Vec<i32>,
+}
+
+impl MetricsStore {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn len(&self) -> usize {
+        self.mccabe.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.mccabe.is_empty()
+    }
+
+    pub fn push(&mut self, row: &ColumnarRow) {
+        let name = self.strings.intern(row.name);
+        let file_path = self.strings.intern(row.file_path);
+        self.push_ids(name, file_path, row);
+    }
+
+    /// Add one file's functions, interning the path once for all of them. The
+    /// functions' own `file_path` is ignored.
+    pub fn push_file(&mut self, file_path: &str, functions: &[FunctionMetrics]) {
+        if functions.is_empty() {
+            return;
+        }
+        let file_path = self.strings.intern(file_path);
+        for func in functions {
+            let name = self.strings.intern(&func.name);
+            self.push_ids(name, file_path, &func.columnar_row());
+        }
+    }
+
+    fn push_ids(&mut self, name: u32, file_path: u32, row: &ColumnarRow) {
+        self.name.push(name);
+        self.file_path.push(file_path);
+        self.mccabe.push(row.mccabe);
+        self.cognitive.push(row.cognitive);
+        self.nesting.push(row.nesting);
+        self.sloc.push(row.sloc);
+        self.abc_magnitude.push(row.abc_magnitude);
+        self.return_count.push(row.return_count);
+        self.signature_score.push(row.test_scoring.signature_score);
+        self.dependency_score.push(row.test_scoring.dependency_score);
+        self.observable_score.push(row.test_scoring.observable_score);
+        self.implementation_score.push(row.test_scoring.implementation_score);
+        self.documentation_score.push(row.test_scoring.documentation_score);
+        self.total_score.push(row.test_scoring.total_score);
+    }
+
+    /// Row `index`, borrowing its name and path from the string table
+    pub fn row(&self, index: u32) -> ColumnarRow<'_> {
+        let i = index as usize;
+        ColumnarRow {
+            name: self.strings.get(self.name[i]),
+            file_path: self.strings.get(self.file_path[i]),
+            mccabe: self.mccabe[i],
+            cognitive: self.cognitive[i],
+            nesting: self.nesting[i],
+            sloc: self.sloc[i],
+            abc_magnitude: self.abc_magnitude[i],
+            return_count: self.return_count[i],
+            test_scoring: TestScoringMetric {
+                signature_score: self.signature_score[i],
+                dependency_score: self.dependency_score[i],
+                observable_score: self.observable_score[i],
+                implementation_score: self.implementation_score[i],
+                documentation_score: self.documentation_score[i],
+                total_score: self.total_score[i],
+            },
+        }
+    }
+
+    /// Every row in insertion order
+    pub fn rows(&self) -> impl Iterator<Item = ColumnarRow<'_>> {
+        (0..self.len() as u32).map(|index| self.row(index))
+    }
+
+    pub fn totals(&self) -> MetricTotals {
+        fn sum(values: &[u32]) -> u64 {
+            values.iter().map(|&v| v as u64).sum()
+        }
+
+        MetricTotals {
+            function_count: self.len(),
+            total_mccabe: sum(&self.mccabe),
+            total_cognitive: sum(&self.cognitive),
+            total_nesting: sum(&self.nesting),
+            total_sloc: sum(&self.sloc),
+            total_abc_magnitude: self.abc_magnitude.iter().sum(),
+            total_return_count: sum(&self.return_count),
+            total_test_score: self.total_score.iter().map(|&v| v as i64).sum(),
+        }
+    }
+
+    /// Split the rows into testability matrix quadrants by McCabe complexity and test score
+    pub fn matrix(&self) -> TestabilityMatrix {
+        let mut matrix = TestabilityMatrix::default();
+        for (index, (&mccabe, &score)) in self.mccabe.iter().zip(&self.total_score).enumerate() {
+            let quadrant = match (mccabe <= MATRIX_COMPLEXITY_LIMIT, score <= MATRIX_TEST_SCORE_LIMIT) {
+                (true, true) => &mut matrix.quick_wins,
+                (false, true) => &mut matrix.invest_tests,
+                (true, false) => &mut matrix.add_docs,
+                (false, false) => &mut matrix.refactor,
+            };
+            quadrant.push(index as u32);
+        }
+        matrix
+    }
+
+    /// The `count` rows with the highest max(McCabe, cognitive), worst first. Earlier rows
+    /// win ties, matching a stable sort of the whole store.
+    pub fn worst(&self, count: usize) -> Vec<u32> {
+        if count == 0 {
+            return Vec::new();
+        }
+
+        let mut heap: BinaryHeap<Reverse<(u32, Reverse<u32>)>> = BinaryHeap::with_capacity(count + 1);
+        for (index, (&mccabe, &cognitive)) in self.mccabe.iter().zip(&self.cognitive).enumerate() {
+            let key = (mccabe.max(cognitive), Reverse(index as u32));
+            if heap.len() == count {
+                if key <= heap.peek().expect("heap is full").0 {
+                    continue;
+                }
+                heap.pop();
+            }
+            heap.push(Reverse(key));
+        }
+
+        let mut ranked: Vec<_> = heap.into_iter().map(|Reverse(key)| key).collect();
+        ranked.sort_by(|a, b| b.cmp(a));
+        ranked.into_iter().map(|(_, Reverse(index))| index).collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn metrics(name: &str, mccabe: u32, cognitive: u32, total_score: i32) -> FunctionMetrics {
+        FunctionMetrics {
+            name: name.to_string(),
+            file_path: String::new(),
+            mccabe,
+            cognitive,
+            nesting: 1,
+            sloc: 10,
+            abc_magnitude: 1.5,
+            return_count: 1,
+            test_scoring: TestScoringMetric { total_score, ..Default::default() },
+        }
+    }
+
+    #[test]
+    fn test_store_aggregates_over_columns() {
+        let all = vec![
+            metrics("init", 2, 1, 3),
+            metrics("parse", 14, 20, 4),
+            metrics("init", 5, 12, 15),
+            metrics("emit", 12, 3, 22),
+            metrics("free", 12, 0, 1),
+        ];
+
+        let mut store = MetricsStore::new();
+        store.push_file("src/a.c", &all[..3]);
+        store.push_file("src/b.c", &all[3..]);
+
+        // One entry per distinct name and path
+        assert_eq!(store.strings.strings().len(), 6);
+        assert_eq!(store.row(2).name, "init");
+        assert_eq!(store.row(3).file_path, "src/b.c");
+
+        let mut expected = MetricTotals::default();
+        all.iter().for_each(|func| expected.add(func));
+        assert_eq!(store.totals(), expected);
+        assert_eq!(store.totals().total_mccabe, 45);
+
+        let matrix = store.matrix();
+        assert_eq!(matrix.quick_wins, vec![0]);
+        assert_eq!(matrix.invest_tests, vec![1, 4]);
+        assert_eq!(matrix.add_docs, vec![2]);
+        assert_eq!(matrix.refactor, vec![3]);
+
+        // Ties on 12 keep store order
+        assert_eq!(store.worst(3), vec![1, 2, 3]);
+        assert_eq!(store.worst(10), vec![1, 2, 3, 4, 0]);
+    }
+}
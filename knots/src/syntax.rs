@@ -0,0 +1,192 @@
+// Numeric node-kind and field ids of the C grammar, resolved once per process, and the
+// iterative tree walk every traversal is built on
+//
+// The metric walks visit every node of every function, so instead of comparing
+// `node.kind()` strings they look the node's `kind_id()` up in a table of `KindClass`
+// flags built from `tree_sitter_c::language()` on first use. Operators and fields are
+// matched by id as well, which also avoids decoding operator text as UTF-8.
+
+use std::sync::OnceLock;
+use tree_sitter::{Language, TreeCursor};
+
+/// What a node kind means to the metric walks, as a set of flags
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct KindClass(u32);
+
+impl KindClass {
+    pub const NONE: Self = Self(0);
+    /// Adds a McCabe decision point
+    pub const DECISION: Self = Self(1 << 0);
+    /// Opens a level of the nesting depth metric
+    pub const NESTING: Self = Self(1 << 1);
+    /// Counts as an ABC condition
+    pub const CONDITION: Self = Self(1 << 2);
+    /// Cognitive control structure: +1 plus the nesting level, and its children nest deeper
+    pub const COGNITIVE_STRUCTURE: Self = Self(1 << 3);
+    /// Counts as an ABC assignment
+    pub const ASSIGNMENT: Self = Self(1 << 4);
+    /// `assignment_expression`, whose left side may be a global
+    pub const ASSIGNMENT_EXPRESSION: Self = Self(1 << 5);
+    pub const CALL: Self = Self(1 << 6);
+    pub const RETURN: Self = Self(1 << 7);
+    pub const ELSE_CLAUSE: Self = Self(1 << 8);
+    pub const GOTO: Self = Self(1 << 9);
+    pub const BINARY_EXPRESSION: Self = Self(1 << 10);
+    pub const IF_STATEMENT: Self = Self(1 << 11);
+    pub const FUNCTION_DEFINITION: Self = Self(1 << 12);
+    pub const IDENTIFIER: Self = Self(1 << 13);
+
+    pub const fn union(self, other: Self) -> Self {
+        Self(self.0 | other.0)
+    }
+
+    /// Whether every flag of `other` is set
+    #[inline]
+    pub fn contains(self, other: Self) -> bool {
+        self.0 & other.0 == other.0
+    }
+}
+
+/// Shared by every branching statement: loops, switch and if
+const CONTROL_STRUCTURE: KindClass = KindClass::DECISION
+    .union(KindClass::NESTING)
+    .union(KindClass::CONDITION)
+    .union(KindClass::COGNITIVE_STRUCTURE);
+
+/// Named node kinds and what they mean to the walks. Kinds the grammar does not have
+/// (`catch_clause` is kept for parity with the cognitive complexity specification) are
+/// skipped when the table is built.
+const NAMED_KINDS: &[(&str, KindClass)] = &[
+    ("if_statement", CONTROL_STRUCTURE.union(KindClass::IF_STATEMENT)),
+    ("while_statement", CONTROL_STRUCTURE),
+    ("do_statement", CONTROL_STRUCTURE),
+    ("for_statement", CONTROL_STRUCTURE),
+    ("switch_statement", CONTROL_STRUCTURE),
+    ("compound_statement", KindClass::NESTING),
+    ("conditional_expression", KindClass::DECISION.union(KindClass::CONDITION)),
+    ("goto_statement", KindClass::DECISION.union(KindClass::GOTO)),
+    ("catch_clause", KindClass::COGNITIVE_STRUCTURE),
+    ("else_clause", KindClass::ELSE_CLAUSE),
+    ("assignment_expression", KindClass::ASSIGNMENT.union(KindClass::ASSIGNMENT_EXPRESSION)),
+    ("update_expression", KindClass::ASSIGNMENT),
+    ("call_expression", KindClass::CALL),
+    ("return_statement", KindClass::RETURN),
+    ("binary_expression", KindClass::BINARY_EXPRESSION),
+    ("function_definition", KindClass::FUNCTION_DEFINITION),
+    ("identifier", KindClass::IDENTIFIER),
+];
+
+/// Kind and field ids of the C grammar
+#[derive(Debug)]
+pub struct CSyntax {
+    classes: Vec<KindClass>,
+    /// Kind id of the anonymous `&&` token
+    pub and_operator: u16,
+    /// Kind id of the anonymous `||` token
+    pub or_operator: u16,
+    pub field_operator: u16,
+    pub field_function: u16,
+    pub field_left: u16,
+}
+
+impl CSyntax {
+    /// The process-wide table, built on first use
+    pub fn get() -> &'static CSyntax {
+        static SYNTAX: OnceLock<CSyntax> = OnceLock::new();
+        SYNTAX.get_or_init(|| CSyntax::new(&tree_sitter_c::language()))
+    }
+
+    fn new(language: &Language) -> Self {
+        let mut classes = vec![KindClass::NONE; language.node_kind_count()];
+        for &(kind, class) in NAMED_KINDS {
+            // 0 means the grammar has no such kind
+            let id = language.id_for_node_kind(kind, true);
+            if id != 0 {
+                classes[id as usize] = classes[id as usize].union(class);
+            }
+        }
+
+        // A missing field resolves to 0, which no node has
+        let field = |name: &str| language.field_id_for_name(name).map_or(0, u16::from);
+
+        Self {
+            classes,
+            and_operator: language.id_for_node_kind("&&", false),
+            or_operator: language.id_for_node_kind("||", false),
+            field_operator: field("operator"),
+            field_function: field("function"),
+            field_left: field("left"),
+        }
+    }
+
+    /// Flags of the node kind with id `kind_id`
+    #[inline]
+    pub fn class(&self, kind_id: u16) -> KindClass {
+        self.classes.get(kind_id as usize).copied().unwrap_or_default()
+    }
+}
+
+/// Visit the cursor's node and all of its descendants in preorder, without recursion.
+///
+/// `visit` is called with the cursor on each node and the state of that node's parent
+/// (`root` for the starting node), which it may update, and returns the state the
+/// node's own children inherit. `stack` holds one state per ancestor, so the native
+/// stack stays flat however deeply the C nests; pass the same vector to later walks to
+/// reuse its allocation. The cursor is back on the starting node when this returns.
+pub fn walk_preorder<S, F>(cursor: &mut TreeCursor, root: &mut S, stack: &mut Vec<S>, mut visit: F)
+where
+    F: FnMut(&TreeCursor, &mut S) -> S,
+{
+    stack.clear();
+    let state = visit(cursor, root);
+    stack.push(state);
+
+    loop {
+        if cursor.goto_first_child() {
+            let state = visit(cursor, stack.last_mut().expect("parent state"));
+            stack.push(state);
+            continue;
+        }
+
+        // Finished this node's subtree: move to its next sibling, climbing until an
+        // ancestor has one or the starting node is done
+        loop {
+            stack.pop();
+            let Some(parent) = stack.last_mut() else { return };
+            if cursor.goto_next_sibling() {
+                let state = visit(cursor, parent);
+                stack.push(state);
+                break;
+            }
+            cursor.goto_parent();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_kind_table_matches_grammar() {
+        let language = tree_sitter_c::language();
+        let syntax = CSyntax::get();
+
+        // A grammar upgrade that renames a kind would silently zero a metric
+        for &(kind, class) in NAMED_KINDS.iter().filter(|(kind, _)| *kind != "catch_clause") {
+            let id = language.id_for_node_kind(kind, true);
+            assert_ne!(id, 0, "C grammar has no '{}' kind", kind);
+            assert!(syntax.class(id).contains(class));
+        }
+
+        assert_eq!(language.node_kind_for_id(syntax.and_operator), Some("&&"));
+        assert_eq!(language.node_kind_for_id(syntax.or_operator), Some("||"));
+        assert_ne!(syntax.field_operator, 0);
+        assert_ne!(syntax.field_function, 0);
+        assert_ne!(syntax.field_left, 0);
+
+        let if_class = syntax.class(language.id_for_node_kind("if_statement", true));
+        assert!(if_class.contains(KindClass::DECISION.union(KindClass::IF_STATEMENT)));
+        assert!(!if_class.contains(KindClass::CALL));
+    }
+}
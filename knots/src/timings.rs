@@ -0,0 +1,327 @@
+// Phase timing and per-file profiling for --timings / --timings-json
+
+use anyhow::{Context, Result};
+use serde::Serialize;
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+/// Number of slowest files listed in the timings output
+pub const SLOWEST_FILES: usize = 10;
+
+/// A stage of a run that is timed separately
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Phase {
+    Discover,
+    Read,
+    Cache,
+    Parse,
+    Metrics,
+    Filter,
+    Report,
+}
+
+impl Phase {
+    const ALL: [Phase; 7] = [
+        Phase::Discover,
+        Phase::Read,
+        Phase::Cache,
+        Phase::Parse,
+        Phase::Metrics,
+        Phase::Filter,
+        Phase::Report,
+    ];
+
+    fn name(self) -> &'static str {
+        match self {
+            Phase::Discover => "discover",
+            Phase::Read => "read",
+            Phase::Cache => "cache",
+            Phase::Parse => "parse",
+            Phase::Metrics => "metrics",
+            Phase::Filter => "filter",
+            Phase::Report => "report",
+        }
+    }
+}
+
+const PHASE_COUNT: usize = Phase::ALL.len();
+
+#[derive(Debug, Clone, Copy, Default)]
+struct PhaseTotal {
+    elapsed: Duration,
+    count: u64,
+}
+
+/// Time spent on one file, ordered by total time for the slowest-files heap
+#[derive(Debug, Clone, PartialEq, Eq, PartialOrd, Ord)]
+struct FileTiming {
+    elapsed: Duration,
+    path: PathBuf,
+    bytes: u64,
+    functions: usize,
+}
+
+#[derive(Default)]
+struct State {
+    phases: [PhaseTotal; PHASE_COUNT],
+    files: u64,
+    /// Min-heap of the slowest files seen so far
+    slowest: BinaryHeap<Reverse<FileTiming>>,
+}
+
+/// Collects phase totals and the slowest files across all worker threads.
+///
+/// When disabled every method is a no-op and no clock is read, so the normal run pays
+/// nothing for it. Per-file phases are accumulated in a `FileTimer` on the worker and
+/// merged under the lock once per file.
+pub struct Timings {
+    enabled: bool,
+    started: Instant,
+    state: Mutex<State>,
+}
+
+impl Timings {
+    pub fn new(enabled: bool) -> Self {
+        Self {
+            enabled,
+            started: Instant::now(),
+            state: Mutex::new(State::default()),
+        }
+    }
+
+    /// Run `f` and add its wall time to `phase`
+    pub fn time<T>(&self, phase: Phase, f: impl FnOnce() -> T) -> T {
+        if !self.enabled {
+            return f();
+        }
+        let start = Instant::now();
+        let result = f();
+        self.record(phase, start.elapsed());
+        result
+    }
+
+    fn record(&self, phase: Phase, elapsed: Duration) {
+        let mut state = self.state.lock().unwrap();
+        let total = &mut state.phases[phase as usize];
+        total.elapsed += elapsed;
+        total.count += 1;
+    }
+
+    /// Start timing one file's phases
+    pub fn file_timer(&self) -> FileTimer {
+        FileTimer {
+            last: self.enabled.then(Instant::now),
+            phases: [PhaseTotal::default(); PHASE_COUNT],
+            bytes: 0,
+            functions: 0,
+        }
+    }
+
+    /// Merge a finished file's phases into the totals
+    pub fn record_file(&self, path: &Path, timer: FileTimer) {
+        if timer.last.is_none() {
+            return;
+        }
+
+        let mut state = self.state.lock().unwrap();
+        let mut elapsed = Duration::ZERO;
+        for (total, file) in state.phases.iter_mut().zip(&timer.phases) {
+            total.elapsed += file.elapsed;
+            total.count += file.count;
+            elapsed += file.elapsed;
+        }
+        state.files += 1;
+
+        let timing = FileTiming {
+            elapsed,
+            path: path.to_path_buf(),
+            bytes: timer.bytes,
+            functions: timer.functions,
+        };
+        let is_slower = state.slowest.peek().map_or(true, |Reverse(fastest)| timing > *fastest);
+        if state.slowest.len() < SLOWEST_FILES {
+            state.slowest.push(Reverse(timing));
+        } else if is_slower {
+            state.slowest.pop();
+            state.slowest.push(Reverse(timing));
+        }
+    }
+
+    /// Print the timings table to stderr, keeping stdout for the normal output
+    pub fn print(&self) {
+        if !self.enabled {
+            return;
+        }
+        let summary = self.summary();
+
+        eprintln!();
+        eprintln!("Timings ({} files, {:.1} ms wall):", summary.files, summary.wall_ms);
+        eprintln!("  {:<10} {:>12} {:>10}", "phase", "total ms", "count");
+        for phase in &summary.phases {
+            eprintln!("  {:<10} {:>12.1} {:>10}", phase.phase, phase.total_ms, phase.count);
+        }
+        eprintln!("  (per-file phases are summed across worker threads)");
+
+        if !summary.slowest_files.is_empty() {
+            eprintln!("Slowest files:");
+            for file in &summary.slowest_files {
+                eprintln!(
+                    "  {:>10.1} ms  {:>10} bytes  {:>5} functions  {}",
+                    file.total_ms, file.bytes, file.functions, file.path
+                );
+            }
+        }
+
+        match summary.peak_rss_bytes {
+            Some(bytes) => eprintln!("Peak memory: {:.1} MiB", bytes as f64 / (1024.0 * 1024.0)),
+            None => eprintln!("Peak memory: unavailable on this platform"),
+        }
+    }
+
+    /// Write the timings as JSON to `path`
+    pub fn write_json(&self, path: &Path) -> Result<()> {
+        let json = serde_json::to_string_pretty(&self.summary())?;
+        fs::write(path, json + "\n").with_context(|| format!("Failed to write timings: {}", path.display()))
+    }
+
+    fn summary(&self) -> TimingsSummary {
+        let state = self.state.lock().unwrap();
+
+        let phases = Phase::ALL
+            .iter()
+            .zip(&state.phases)
+            .filter(|(_, total)| total.count > 0)
+            .map(|(phase, total)| PhaseSummary {
+                phase: phase.name(),
+                total_ms: as_ms(total.elapsed),
+                count: total.count,
+            })
+            .collect();
+
+        let slowest_files = state
+            .slowest
+            .clone()
+            .into_sorted_vec()
+            .into_iter()
+            .map(|Reverse(file)| FileSummary {
+                path: file.path.display().to_string(),
+                total_ms: as_ms(file.elapsed),
+                bytes: file.bytes,
+                functions: file.functions,
+            })
+            .collect();
+
+        TimingsSummary {
+            wall_ms: as_ms(self.started.elapsed()),
+            files: state.files,
+            peak_rss_bytes: peak_rss_bytes(),
+            phases,
+            slowest_files,
+        }
+    }
+}
+
+/// Phase laps for a single file, owned by the worker analyzing it
+pub struct FileTimer {
+    /// End of the previous lap; None when timings are disabled
+    last: Option<Instant>,
+    phases: [PhaseTotal; PHASE_COUNT],
+    pub bytes: u64,
+    pub functions: usize,
+}
+
+impl FileTimer {
+    /// Charge the time since the previous lap (or the start) to `phase`
+    pub fn lap(&mut self, phase: Phase) {
+        if let Some(last) = &mut self.last {
+            let now = Instant::now();
+            let total = &mut self.phases[phase as usize];
+            total.elapsed += now - *last;
+            total.count += 1;
+            *last = now;
+        }
+    }
+}
+
+#[derive(Serialize)]
+struct TimingsSummary {
+    wall_ms: f64,
+    files: u64,
+    peak_rss_bytes: Option<u64>,
+    phases: Vec<PhaseSummary>,
+    slowest_files: Vec<FileSummary>,
+}
+
+#[derive(Serialize)]
+struct PhaseSummary {
+    phase: &'static str,
+    total_ms: f64,
+    count: u64,
+}
+
+#[derive(Serialize)]
+struct FileSummary {
+    path: String,
+    total_ms: f64,
+    bytes: u64,
+    functions: usize,
+}
+
+fn as_ms(duration: Duration) -> f64 {
+    duration.as_secs_f64() * 1000.0
+}
+
+/// Peak resident set size of this process (VmHWM), where the platform exposes it
+fn peak_rss_bytes() -> Option<u64> {
+    let status = fs::read_to_string("/proc/self/status").ok()?;
+    let line = status.lines().find(|line| line.starts_with("VmHWM:"))?;
+    let kib: u64 = line.trim_start_matches("VmHWM:").trim().trim_end_matches("kB").trim().parse().ok()?;
+    Some(kib * 1024)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_slowest_files_and_phase_totals() {
+        let timings = Timings::new(true);
+        for i in 0..(SLOWEST_FILES as u64 + 5) {
+            let mut timer = timings.file_timer();
+            timer.lap(Phase::Read);
+            // Make file i take roughly i units so the ordering is known
+            timer.phases[Phase::Parse as usize].elapsed = Duration::from_millis(i);
+            timer.phases[Phase::Parse as usize].count = 1;
+            timer.bytes = i;
+            timings.record_file(Path::new(&format!("f{}.c", i)), timer);
+        }
+        timings.time(Phase::Report, || ());
+
+        let summary = timings.summary();
+        assert_eq!(summary.files, SLOWEST_FILES as u64 + 5);
+        assert_eq!(summary.slowest_files.len(), SLOWEST_FILES);
+        assert_eq!(summary.slowest_files[0].path, format!("f{}.c", SLOWEST_FILES + 4));
+        assert_eq!(summary.slowest_files.last().unwrap().bytes, 5);
+
+        let names: Vec<_> = summary.phases.iter().map(|p| p.phase).collect();
+        assert_eq!(names, vec!["read", "parse", "report"]);
+        assert_eq!(summary.phases[1].count, SLOWEST_FILES as u64 + 5);
+    }
+
+    #[test]
+    fn test_disabled_timings_record_nothing() {
+        let timings = Timings::new(false);
+        let mut timer = timings.file_timer();
+        timer.lap(Phase::Read);
+        timings.record_file(Path::new("a.c"), timer);
+        assert_eq!(timings.time(Phase::Report, || 7), 7);
+
+        let summary = timings.summary();
+        assert_eq!(summary.files, 0);
+        assert!(summary.phases.is_empty());
+    }
+}
@@ -0,0 +1,370 @@
+// Watch mode: re-analyze C files as they change, reparsing edited files incrementally
+
+use anyhow::Result;
+use std::collections::BTreeMap;
+use std::fs;
+use std::ops::Range;
+use std::path::PathBuf;
+use std::thread;
+use std::time::{Duration, Instant, SystemTime};
+use tree_sitter::{InputEdit, Node, Point, Tree};
+
+use knots::analysis::{filter_function_metrics, measure_function, visit_functions, FunctionMetrics};
+use knots::filter::FilterRules;
+use knots::store::MetricsStore;
+
+use crate::discover::WalkOptions;
+use crate::report::{ReportWriter, TOP_FUNCTIONS};
+use crate::pipeline::FileCounts;
+use crate::{collect_files, display_recursive_summary, display_testability_matrix};
+
+/// How often the known files are checked for changes
+const POLL_INTERVAL: Duration = Duration::from_millis(300);
+
+/// How often the tree is walked again for added and removed files, at least. A slow walk
+/// (a large tree on a network share) is repeated at most once per ten times its length,
+/// so polling stays mostly idle.
+const REDISCOVER_INTERVAL: Duration = Duration::from_secs(5);
+
+pub struct WatchConfig<'a> {
+    pub path: &'a PathBuf,
+    pub matrix: bool,
+    pub verbose: bool,
+    pub include_rules: &'a Option<FilterRules>,
+    pub exclude_rules: &'a Option<FilterRules>,
+    pub walk: WalkOptions,
+}
+
+/// Modification time and length, used to notice changed files without reading them
+type Stamp = (Option<SystemTime>, u64);
+
+struct WatchedFile {
+    /// None until the file is first analyzed
+    stamp: Option<Stamp>,
+    /// None when the file could not be read or parsed
+    parsed: Option<ParsedFile>,
+}
+
+/// A file's last analyzed contents, kept so the next edit can be reparsed incrementally
+struct ParsedFile {
+    source: Vec<u8>,
+    tree: Tree,
+    functions: Vec<MeasuredFunction>,
+}
+
+struct MeasuredFunction {
+    /// Bytes the metrics depend on: the preceding doc comment, if any, through the end
+    /// of the function body
+    dependency: Range<usize>,
+    range: Range<usize>,
+    metrics: FunctionMetrics,
+}
+
+/// What one polling pass changed
+#[derive(Default)]
+struct UpdateStats {
+    changed_files: usize,
+    reused_functions: usize,
+    measured_functions: usize,
+    warnings: Vec<String>,
+}
+
+/// Watch `config.path` until interrupted, refreshing the summary (or testability
+/// matrix) in place whenever a file changes.
+///
+/// Changes are detected by polling the modification times of the files found by the
+/// last walk; the walk itself is repeated only every `REDISCOVER_INTERVAL` or more, to
+/// pick up added files. An edited file is diffed
+/// against its previous contents, the old tree is edited to match, and the file is
+/// reparsed incrementally. Functions outside the edited and structurally changed
+/// ranges keep their previous metrics.
+pub fn run(config: &WatchConfig) -> Result<()> {
+    let mut files: BTreeMap<PathBuf, WatchedFile> = BTreeMap::new();
+    let mut first_pass = true;
+    // When the last walk finished, and how long it took
+    let mut last_walk: Option<(Instant, Duration)> = None;
+
+    loop {
+        let mut update = UpdateStats::default();
+
+        if last_walk.map_or(true, |(at, took)| at.elapsed() >= REDISCOVER_INTERVAL.max(took * 10)) {
+            let started = Instant::now();
+            match collect_files(config.path, true, config.include_rules, config.exclude_rules, config.walk) {
+                Ok(paths) => {
+                    // Paths come sorted from the walk
+                    let before = files.len();
+                    files.retain(|path, _| paths.binary_search(path).is_ok());
+                    update.changed_files += before - files.len();
+                    for path in paths {
+                        files.entry(path).or_insert(WatchedFile { stamp: None, parsed: None });
+                    }
+                }
+                Err(e) => update.warnings.push(format!("{:#}", e)),
+            }
+            last_walk = Some((Instant::now(), started.elapsed()));
+        }
+
+        let mut removed = Vec::new();
+        for (path, file) in files.iter_mut() {
+            let stamp = match fs::metadata(path) {
+                Ok(meta) => (meta.modified().ok(), meta.len()),
+                Err(_) => {
+                    removed.push(path.clone());
+                    continue;
+                }
+            };
+            if file.stamp == Some(stamp) {
+                continue;
+            }
+
+            file.parsed = update_file(path, file.parsed.take(), &mut update);
+            file.stamp = Some(stamp);
+            update.changed_files += 1;
+        }
+        for path in removed {
+            files.remove(&path);
+            update.changed_files += 1;
+        }
+
+        if first_pass || update.changed_files > 0 || !update.warnings.is_empty() {
+            render(config, &files, &update)?;
+            first_pass = false;
+        }
+
+        thread::sleep(POLL_INTERVAL);
+    }
+}
+
+fn update_file(path: &PathBuf, previous: Option<ParsedFile>, update: &mut UpdateStats) -> Option<ParsedFile> {
+    let source = match fs::read(path) {
+        Ok(source) => source,
+        Err(e) => {
+            update.warnings.push(format!("Skipping {}: {}", path.display(), e));
+            return None;
+        }
+    };
+
+    let result = match previous {
+        Some(previous) => reparse(previous, source, update),
+        None => parse(source, update),
+    };
+
+    match result {
+        Ok(Some(parsed)) => Some(parsed),
+        Ok(None) => {
+            update.warnings.push(format!("Failed to parse {}", path.display()));
+            None
+        }
+        Err(e) => {
+            update.warnings.push(format!("Failed to parse {}: {:#}", path.display(), e));
+            None
+        }
+    }
+}
+
+fn parse(source: Vec<u8>, update: &mut UpdateStats) -> Result<Option<ParsedFile>> {
+    let tree = match knots::parser::parse_c(&source)? {
+        Some(tree) => tree,
+        None => return Ok(None),
+    };
+
+    let functions = measure_tree(&tree, &source, |_| None);
+    update.measured_functions += functions.len();
+    Ok(Some(ParsedFile { source, tree, functions }))
+}
+
+fn reparse(previous: ParsedFile, source: Vec<u8>, update: &mut UpdateStats) -> Result<Option<ParsedFile>> {
+    let ParsedFile { source: old_source, mut tree, functions: old_functions } = previous;
+    let edit = diff_edit(&old_source, &source);
+
+    tree.edit(&edit);
+    let new_tree = match knots::parser::reparse_c(&source, &tree)? {
+        Some(new_tree) => new_tree,
+        None => return Ok(None),
+    };
+
+    // Anything touching the edited text or a range whose syntax changed is re-measured
+    let mut dirty: Vec<Range<usize>> = vec![edit.start_byte..edit.new_end_byte];
+    dirty.extend(tree.changed_ranges(&new_tree).map(|range| range.start_byte..range.end_byte));
+
+    // Translate the surviving functions into the new text's coordinates
+    let delta = edit.new_end_byte as isize - edit.old_end_byte as isize;
+    let shift = |range: &Range<usize>| (range.start as isize + delta) as usize..(range.end as isize + delta) as usize;
+    let mut reusable: BTreeMap<(usize, usize), MeasuredFunction> = BTreeMap::new();
+    for function in old_functions {
+        let moved = if function.dependency.end <= edit.start_byte {
+            function
+        } else if function.dependency.start >= edit.old_end_byte {
+            MeasuredFunction {
+                dependency: shift(&function.dependency),
+                range: shift(&function.range),
+                metrics: function.metrics,
+            }
+        } else {
+            continue;
+        };
+        reusable.insert((moved.range.start, moved.range.end), moved);
+    }
+
+    let mut reused = 0;
+    let functions = measure_tree(&new_tree, &source, |candidate| {
+        let clean = !dirty.iter().any(|range| overlaps(range, &candidate.dependency));
+        let previous = reusable.remove(&(candidate.range.start, candidate.range.end))?;
+        if clean && previous.dependency == candidate.dependency {
+            reused += 1;
+            Some(previous.metrics)
+        } else {
+            None
+        }
+    });
+
+    update.reused_functions += reused;
+    update.measured_functions += functions.len() - reused;
+    Ok(Some(ParsedFile { source, tree: new_tree, functions }))
+}
+
+/// Location of a function in the tree, offered for reuse before it is measured
+struct Candidate {
+    dependency: Range<usize>,
+    range: Range<usize>,
+}
+
+/// Measure every function in `tree`, taking metrics from `reuse` where it has them
+fn measure_tree<F>(tree: &Tree, source_code: &[u8], mut reuse: F) -> Vec<MeasuredFunction>
+where
+    F: FnMut(&Candidate) -> Option<FunctionMetrics>,
+{
+    let mut functions = Vec::new();
+    let mut cursor = tree.root_node().walk();
+
+    visit_functions(&mut cursor, source_code, &mut |node: Node, src| {
+        let candidate = Candidate {
+            dependency: dependency_range(node),
+            range: node.byte_range(),
+        };
+        if let Some(metrics) = reuse(&candidate).or_else(|| measure_function(node, src)) {
+            functions.push(MeasuredFunction {
+                dependency: candidate.dependency,
+                range: candidate.range,
+                metrics,
+            });
+        }
+    });
+
+    functions
+}
+
+fn dependency_range(node: Node) -> Range<usize> {
+    let start = match node.prev_sibling() {
+        Some(sibling) if sibling.kind() == "comment" => sibling.start_byte(),
+        _ => node.start_byte(),
+    };
+    start..node.end_byte()
+}
+
+fn overlaps(a: &Range<usize>, b: &Range<usize>) -> bool {
+    a.start <= b.end && b.start <= a.end
+}
+
+/// Describe the change from `old` to `new` as a single edit spanning everything between
+/// their common prefix and common suffix
+fn diff_edit(old: &[u8], new: &[u8]) -> InputEdit {
+    let prefix = old.iter().zip(new).take_while(|(a, b)| a == b).count();
+    let max_suffix = old.len().min(new.len()) - prefix;
+    let suffix = old
+        .iter()
+        .rev()
+        .zip(new.iter().rev())
+        .take(max_suffix)
+        .take_while(|(a, b)| a == b)
+        .count();
+
+    let old_end = old.len() - suffix;
+    let new_end = new.len() - suffix;
+
+    InputEdit {
+        start_byte: prefix,
+        old_end_byte: old_end,
+        new_end_byte: new_end,
+        start_position: point_at(old, prefix),
+        old_end_position: point_at(old, old_end),
+        new_end_position: point_at(new, new_end),
+    }
+}
+
+fn point_at(text: &[u8], offset: usize) -> Point {
+    let before = &text[..offset];
+    let row = before.iter().filter(|&&b| b == b'\n').count();
+    let line_start = before.iter().rposition(|&b| b == b'\n').map_or(0, |i| i + 1);
+    Point::new(row, offset - line_start)
+}
+
+fn render(config: &WatchConfig, files: &BTreeMap<PathBuf, WatchedFile>, update: &UpdateStats) -> Result<()> {
+    let mut store = MetricsStore::new();
+    let mut counts = FileCounts::new(files.len());
+    for (path, file) in files {
+        match &file.parsed {
+            Some(parsed) => store.push_file(
+                &path.to_string_lossy(),
+                &filter_function_metrics(
+                    parsed.functions.iter().map(|function| function.metrics.clone()).collect(),
+                    "",
+                    config.include_rules,
+                    config.exclude_rules,
+                ),
+            ),
+            None => counts.skipped += 1,
+        }
+    }
+
+    // Clear the screen and redraw from the top
+    print!("\x1b[2J\x1b[H");
+
+    if store.is_empty() {
+        println!("No functions found in any files (skipped {} files)", counts.skipped);
+    } else if config.matrix {
+        display_testability_matrix(&store, &counts);
+    } else {
+        let mut report = ReportWriter::new(config.verbose);
+        report.write_rows(store.rows())?;
+        report.finish()?;
+        let worst: Vec<_> = store.worst(TOP_FUNCTIONS).into_iter().map(|index| store.row(index)).collect();
+        display_recursive_summary(&store.totals(), &worst, &counts);
+    }
+
+    for warning in &update.warnings {
+        eprintln!("Warning: {}", warning);
+    }
+    println!(
+        "\nWatching {} files in {} ({} changed, {} functions re-measured, {} reused). Press Ctrl-C to stop.",
+        files.len(),
+        config.path.display(),
+        update.changed_files,
+        update.measured_functions,
+        update.reused_functions
+    );
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_diff_edit_spans_changed_bytes() {
+        let old = b"int a(void) {\n  return 1;\n}\n";
+        let new = b"int a(void) {\n  return 42;\n}\n";
+        let edit = diff_edit(old, new);
+
+        assert_eq!(edit.start_byte, 23);
+        assert_eq!(edit.old_end_byte, 24);
+        assert_eq!(edit.new_end_byte, 25);
+        assert_eq!((edit.start_position.row, edit.start_position.column), (1, 9));
+        assert_eq!((edit.new_end_position.row, edit.new_end_position.column), (1, 11));
+
+        // Repeated bytes at the boundary are not counted twice
+        let edit = diff_edit(b"aaa", b"aaaa");
+        assert_eq!((edit.start_byte, edit.old_end_byte, edit.new_end_byte), (3, 3, 4));
+    }
+}